@@ -0,0 +1,36 @@
+#!/bin/sh
+# Replays a pcap file with packet by packet and with batched header
+# decoding and prints the throughput of each, best of RUNS replays.
+#
+# Usage: bench/decode.sh FILE [RUNS] [BINARY] [EXTRA OPTIONS...]
+#   RUNS defaults to 3
+#   BINARY defaults to build/idsniff
+
+set -e
+
+FILE=$1
+RUNS=${2:-3}
+BIN=${3:-$(dirname "$0")/../build/idsniff}
+if [ -z "$FILE" ]; then
+	echo "Usage: $0 FILE [RUNS] [BINARY] [EXTRA OPTIONS...]" >&2
+	exit 1
+fi
+shift $(( $# < 3 ? $# : 3 ))
+
+printf "%-8s %14s %10s\n" decode packets/sec speedup
+base=
+for mode in packet batch; do
+	best=0
+	run=0
+	while [ "$run" -lt "$RUNS" ]; do
+		pps=$("$BIN" -r "$FILE" -d "$mode" "$@" 2>/dev/null \
+		    | sed -n 's/^Replayed .*(\([0-9.]*\) packets\/sec)$/\1/p')
+		best=$(awk -v a="$best" -v b="$pps" 'BEGIN { print (b > a ? b : a) }')
+		run=$((run + 1))
+	done
+	if [ -z "$base" ]; then
+		base=$best
+	fi
+	awk -v mode="$mode" -v pps="$best" -v base="$base" \
+	    'BEGIN { printf "%-8s %14.0f %9.2fx\n", mode, pps, pps / base }'
+done
@@ -0,0 +1,308 @@
+#!/usr/bin/env python3
+"""Generate the pcap fixtures of bench/regress.sh.
+
+Usage: bench/fixtures.py DIR
+
+Writes NAME.pcap and NAME.expect pairs into DIR. An .expect file lists
+the detection counts the report must show, one "key value" per line
+with the keys of the "detections" object of idsniff -j. A NAME.args
+file, if any, lists the options of each run of the fixture, one run per
+line.
+"""
+
+import os
+import random
+import struct
+import sys
+
+BLACKLISTED = "www.telegraph.co.uk"
+# SYNs of the heavy source of the ipv6 fixture, 2001:db8:0:1::5000
+HEAVY_SYNS = 200
+
+
+def eth(ethertype):
+    return b"\x00\x11\x22\x33\x44\x55\x66\x77\x88\x99\xaa\xbb" + struct.pack("!H", ethertype)
+
+
+def ipv4(src, dst, proto, payload):
+    header = struct.pack("!BBHHHBBH4s4s", 0x45, 0, 20 + len(payload), 0, 0, 64, proto, 0,
+                         src.to_bytes(4, "big"), dst.to_bytes(4, "big"))
+    return eth(0x0800) + header + payload
+
+
+def ipv6(src, dst, proto, payload, ext=()):
+    """ext lists (next header value, header bytes) pairs put before payload."""
+    chain = b""
+    kinds = [kind for kind, _ in ext] + [proto]
+    for i, (_, header) in enumerate(ext):
+        chain += bytes([kinds[i + 1]]) + header[1:]
+    body = chain + payload
+    header = struct.pack("!IHBB16s16s", 6 << 28, len(body), kinds[0], 64,
+                         src.to_bytes(16, "big"), dst.to_bytes(16, "big"))
+    return eth(0x86dd) + header + body
+
+
+def options(units):
+    """Hop-by-Hop or Destination Options header of 8 * units bytes of padding."""
+    return bytes([0, units - 1, 1, 8 * units - 4]) + b"\0" * (8 * units - 4)
+
+
+def tcp6(src, dst, sport, dport, seq, flags, data=b"", ext=()):
+    return ipv6(src, dst, 6, struct.pack("!HHIIBBHHH", sport, dport, seq, 0, 5 << 4, flags,
+                                         65535, 0, 0) + data, ext)
+
+
+def tcp(src, dst, sport, dport, seq, flags, data=b""):
+    return ipv4(src, dst, 6, struct.pack("!HHIIBBHHH", sport, dport, seq, 0, 5 << 4, flags,
+                                         65535, 0, 0) + data)
+
+
+def udp(src, dst, sport, dport, data):
+    return ipv4(src, dst, 17, struct.pack("!HHHH", sport, dport, 8 + len(data), 0) + data)
+
+
+def icmp_echo(src, dst):
+    return ipv4(src, dst, 1, struct.pack("!BBHHH", 8, 0, 0, 1, 1) + b"x" * 56)
+
+
+def arp_reply():
+    return eth(0x0806) + struct.pack("!HHBBH", 1, 0x0800, 6, 4, 2) + b"\0" * 20
+
+
+def stp_bpdu():
+    """802.3 frame with LLC, its type field is its length."""
+    bpdu = b"\x42\x42\x03" + b"\0" * 35
+    return b"\x01\x80\xc2\x00\x00\x00\x66\x77\x88\x99\xaa\xbb" + struct.pack("!H", len(bpdu)) + bpdu
+
+
+def dns_query(name):
+    qname = b"".join(bytes([len(label)]) + label.encode() for label in name.split(".")) + b"\0"
+    return struct.pack("!HHHHHH", 1, 0x0100, 1, 0, 0, 0) + qname + b"\0\x01\0\x01"
+
+
+def http_get(host):
+    return ("GET / HTTP/1.1\r\nUser-Agent: bench\r\nHost: %s\r\n\r\n" % host).encode()
+
+
+def write(directory, name, packets, expect, runs=None):
+    with open(os.path.join(directory, name + ".pcap"), "wb") as f:
+        f.write(struct.pack("<IHHiIII", 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1))
+        for i, p in enumerate(packets):
+            f.write(struct.pack("<IIII", 1000 + i // 1000000, i % 1000000, len(p), len(p)) + p)
+    with open(os.path.join(directory, name + ".expect"), "w") as f:
+        for key in ("syn", "arp", "blacklist", "dns", "port_scans", "host_scans", "udp_floods", "icmp_floods",
+                    "non_ethernet"):
+            f.write("%s %d\n" % (key, expect.get(key, 0)))
+    if runs:
+        with open(os.path.join(directory, name + ".args"), "w") as f:
+            f.write("".join(run + "\n" for run in runs))
+
+
+def syn_flood(directory):
+    rng = random.Random(1)
+    packets = [tcp(rng.getrandbits(32), 0x0a000002, rng.randrange(1024, 65536), 80, 1, 0x02)
+               for _ in range(200000)]
+    write(directory, "syn_flood", packets, {"syn": len(packets)})
+
+
+def mixed(directory):
+    """Ordinary traffic with a few detections of every kind mixed in, and
+    spanning tree frames that are not Ethernet II."""
+    rng = random.Random(2)
+    packets = []
+    expect = {"syn": 0, "arp": 0, "blacklist": 0, "dns": 0, "non_ethernet": 0}
+    for i in range(100000):
+        if i % 1000 == 0:
+            packets.append(stp_bpdu())
+            expect["non_ethernet"] += 1
+        client = 0x0a010000 | (i % 4096)
+        kind = i % 100
+        if kind < 40:
+            packets.append(tcp(client, 0x0a000002, 10000 + i % 50000, 443, i, 0x18, b"x" * 200))
+        elif kind < 70:
+            packets.append(udp(client, 0x0a000003, 5353, 53, dns_query("host%d.example.com" % i)))
+        elif kind < 90:
+            packets.append(tcp(client, 0x0a000002, 10000 + i % 50000, 80, 1, 0x18,
+                               http_get("www.example.com")))
+        elif kind < 94:
+            packets.append(tcp(client, 0x0a000002, rng.randrange(1024, 65536), 80, 1, 0x02))
+            expect["syn"] += 1
+        elif kind < 96:
+            packets.append(udp(client, 0x0a000003, 5353, 53, dns_query(BLACKLISTED)))
+            expect["dns"] += 1
+        elif kind < 98:
+            # A server and ports of their own so every request is a new flow
+            packets.append(tcp(client, 0x0a000004, 1024 + i % 60000, 80, 1, 0x18,
+                               http_get(BLACKLISTED)))
+            expect["blacklist"] += 1
+        else:
+            packets.append(arp_reply())
+            expect["arp"] += 1
+    write(directory, "mixed", packets, expect)
+
+
+def port_scan(directory):
+    """One vertical and one horizontal scan among ordinary clients, and
+    sources trying fewer ports or hosts than a scan, in sequence."""
+    rng = random.Random(3)
+    packets = [tcp(0x0a000001, 0x0a000101, 40000, port, 1, 0x02) for port in range(1, 1001)]
+    packets += [tcp(0x0a000002, 0x0a010000 | host, 40001, 22, 1, 0x02) for host in range(500)]
+    packets += [tcp(0x0a000003, 0x0a000101, 40002, port, 1, 0x02) for port in range(60)]
+    packets += [tcp(0x0a000004, 0x0a000102, 40003, port, 1, 0x02) for port in range(1, 91)]
+    packets += [tcp(0x0a000005, 0x0a040000 | host, 40004, 22, 1, 0x02) for host in range(56)]
+    for client in range(2000):
+        for k in range(5):
+            packets.append(tcp(0x0a020000 | client, 0x0a030000 | k % 3, 40000 + k,
+                               80 if k % 2 else 443, 1, 0x02))
+    rng.shuffle(packets)
+    write(directory, "port_scan", packets,
+          {"syn": len(packets), "port_scans": 1, "host_scans": 1})
+
+
+def flood(directory):
+    """A DNS amplification flood and an ICMP flood, one victim each, over
+    ordinary UDP to many destinations. Packets are 1us apart."""
+    rng = random.Random(4)
+    packets = [udp(0x0b000000 | rng.randrange(1000), 0x0a000009, 53, rng.randrange(1024, 65536), b"r" * 512)
+               for _ in range(100000)]
+    packets += [icmp_echo(0x0b100000 | rng.randrange(1000), 0x0a00000a) for _ in range(5000)]
+    packets += [udp(0x0a010000 | i % 4096, 0x0c000000 | i % 200, 5000, 6000, b"d" * 64) for i in range(20000)]
+    rng.shuffle(packets)
+    write(directory, "flood", packets, {"udp_floods": 1, "icmp_floods": 1})
+
+
+def ipv6_mixed(directory):
+    """SYN flood from one /64, one source of which is heavy, and
+    blacklisted requests over IPv6 behind extension headers, among IPv4
+    SYNs and fragments past the first."""
+    rng = random.Random(5)
+    net = 0x20010db8000000010000000000000000
+    server = 0x20010db8000000020000000000000080
+    packets = [tcp6(net | rng.getrandbits(64), server, rng.randrange(1024, 65536), 80, 1, 0x02,
+                    ext=[(0, options(1))] if i % 2 else [])
+               for i in range(20000)]
+    packets += [tcp(rng.getrandbits(32), 0x0a000002, rng.randrange(1024, 65536), 80, 1, 0x02)
+                for _ in range(1000)]
+    packets += [tcp6(net | 0x5000, server, 10000 + i, 80, 1, 0x02) for i in range(HEAVY_SYNS)]
+    for i in range(1000):
+        packets.append(tcp6(net | 0x1000 | i, server, 20000 + i, 80, 1, 0x18, http_get("www.example.com")))
+    # Routing header with no segments left, then Destination Options
+    routing = bytes([0, 0, 0, 0]) + b"\0" * 4
+    for i in range(50):
+        packets.append(tcp6(net | 0x2000 | i, server | 1, 30000 + i, 80, 1, 0x18, http_get(BLACKLISTED),
+                            ext=[(43, routing), (60, options(2))]))
+    # Atomic fragments, offset 0 and no more fragments
+    fragment = bytes([0, 0, 0, 0]) + struct.pack("!I", 7)
+    for i in range(30):
+        query = struct.pack("!HHHH", 5353, 53, 8 + len(dns_query(BLACKLISTED)), 0) + dns_query(BLACKLISTED)
+        packets.append(ipv6(net | 0x3000 | i, server | 2, 17, query, ext=[(44, fragment)]))
+    # Later fragments whose bytes look like a SYN must not count
+    later = bytes([0, 0]) + struct.pack("!H", 185 << 3) + struct.pack("!I", 8)
+    for i in range(100):
+        packets.append(ipv6(net | 0x4000 | i, server, 6, struct.pack("!HHIIBBHHH", 1, 80, 1, 0, 5 << 4,
+                                                                     0x02, 65535, 0, 0), ext=[(44, later)]))
+    rng.shuffle(packets)
+    write(directory, "ipv6", packets, {"syn": 21000 + HEAVY_SYNS, "blacklist": 50, "dns": 30})
+
+
+# Runs of the reassembly fixtures: with work stealing a worker may
+# analyse a later segment of a flow before its start
+SCHEDULERS = ["-m rr -t 4", "-m flow -t 4"]
+
+
+def split_http(directory):
+    """HTTP requests split across segments, within the method and within
+    the Host header, in order. Flows overlap a few dozen at a time."""
+    splits = [
+        lambda r: [r[:2], r[2:30], r[30:]],  # "GE", "T / HTTP/1.1..."
+        lambda r: [r[:3], r[3:r.index(b"Host") + 9], r[r.index(b"Host") + 9:]],  # "GET", " / ..."
+        lambda r: [r[:1], r[1:]],  # "G", "ET / ..."
+        lambda r: [r[:r.index(b"Host") + 2], r[r.index(b"Host") + 2:]],  # "...Ho", "st: ..."
+    ]
+    flows = []
+    expect = 0
+    for i in range(1000):
+        host = BLACKLISTED if i % 5 < 3 else "www.example.com"
+        expect += host == BLACKLISTED
+        seq = 1000 + i * 7919
+        segments = []
+        for part in splits[i % len(splits)](http_get(host)):
+            segments.append(tcp(0x0a040000 | i, 0x0a000004, 20000 + i, 80, seq, 0x18, part))
+            seq += len(part)
+        flows.append(segments)
+    packets = []
+    for start in range(0, len(flows), 40):
+        window = flows[start:start + 40]
+        for k in range(max(len(f) for f in window)):
+            packets += [f[k] for f in window if k < len(f)]
+    write(directory, "split_http", packets, {"blacklist": expect}, SCHEDULERS)
+
+
+def reordered_http(directory):
+    """HTTP requests split across segments that arrive out of order: the
+    continuation before the start, the start last, a tail segment before
+    the middle one, letters of the method reversed, and retransmissions."""
+    orders = [
+        [1, 0, 2],
+        [2, 1, 0],
+        [0, 2, 1],
+        [1, 2, 0, 1],
+    ]
+    flows = []
+    expect = 0
+    for i in range(1200):
+        host = BLACKLISTED if i % 3 else "www.example.com"
+        expect += host == BLACKLISTED
+        request = http_get(host)
+        if i < 1000:
+            host_at = request.index(b"Host") + 8
+            parts = [request[:20], request[20:host_at], request[host_at:]]
+        else:
+            # "GE", "T", " / HTTP/1.1...": a "T" ahead of "GE" looks like a start
+            parts = [request[:2], request[2:3], request[3:]]
+        seq = 5000 + i * 104729
+        offsets = [0, len(parts[0]), len(parts[0]) + len(parts[1])]
+        flows.append([tcp(0x0a050000 | i, 0x0a000005, 30000 + i, 80, seq + offsets[k], 0x18, parts[k])
+                      for k in orders[i % len(orders)]])
+    packets = []
+    for start in range(0, len(flows), 40):
+        window = flows[start:start + 40]
+        for k in range(max(len(f) for f in window)):
+            packets += [f[k] for f in window if k < len(f)]
+    write(directory, "reordered_http", packets, {"blacklist": expect}, SCHEDULERS)
+
+
+def malformed(directory):
+    """SYNs among IPv4 headers shorter than 20 bytes, whose bytes past the
+    header look like a SYN, and frames shorter than an Ethernet header.
+    Both ways of decoding headers must drop the same frames."""
+    packets = []
+    for i in range(1000):
+        packets.append(tcp(0x0a000001 + i, 0x0a000002, 1024 + i, 80, 1, 0x02))
+        # IHL 4: read from inside the IP header, the acknowledgement
+        # number would be taken for SYN flags
+        short = bytearray(tcp(0x0a000001 + i, 0x0a000002, 1024 + i, 80, 1, 0x10))
+        short[14] = 0x44
+        short[14 + 20 + 9] = 0x02
+        packets.append(bytes(short))
+        packets.append(eth(0x0800)[:10])
+    write(directory, "malformed", packets, {"syn": 1000}, ["-d batch", "-d packet"])
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.stderr.write("Usage: %s DIR\n" % sys.argv[0])
+        sys.exit(1)
+    os.makedirs(sys.argv[1], exist_ok=True)
+    syn_flood(sys.argv[1])
+    mixed(sys.argv[1])
+    port_scan(sys.argv[1])
+    flood(sys.argv[1])
+    ipv6_mixed(sys.argv[1])
+    split_http(sys.argv[1])
+    reordered_http(sys.argv[1])
+    malformed(sys.argv[1])
+
+
+if __name__ == "__main__":
+    main()
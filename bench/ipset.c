@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ip_set.h"
+
+/*
+ * Checks ip_set_add_bulk, ip_set_union and ip_set_intersect against sets
+ * built one ip_set_add at a time, on random batches: small and large
+ * ones (insertion or radix sort, stack or heap scratch space), values
+ * from a narrow range (many duplicates and common elements) or from the
+ * whole range (every radix pass). Then times bulk against one at a time
+ * insertion.
+ *
+ * Usage: ipset [ROUNDS] [SEED]
+ */
+
+#define MAX_BATCH 5000
+#define TIMED_BATCH 1000
+#define TIMED_BATCHES 20
+
+static uint64_t rng_state;
+
+/* xorshift64, the sequence only depends on SEED */
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (uint32_t) (rng_state >> 32);
+}
+
+/* A random batch, of values below range (0 for any value) */
+static int random_batch(uint32_t* a, uint32_t range)
+{
+	int n = rng() % 2 ? rng() % 40 : rng() % MAX_BATCH;
+	int i;
+	for (i = 0; i < n; ++i)
+	{
+		a[i] = range ? rng() % range : rng();
+	}
+	return n;
+}
+
+static void add_each(struct ip_set* s, const uint32_t* a, int n)
+{
+	int i;
+	for (i = 0; i < n; ++i)
+	{
+		ip_set_add(s, a[i]);
+	}
+}
+
+/**
+ * @return
+ *		1 if both sets have the same elements, in ascending order
+ *		0 otherwise, after printing the first difference
+ */
+static int same(struct ip_set* got, struct ip_set* want, const char* what, int round)
+{
+	int i;
+	for (i = 0; i < got->size && i < want->size; ++i)
+	{
+		if (ip_set_get(got, i) != ip_set_get(want, i))
+		{
+			break;
+		}
+	}
+	if (i == got->size && i == want->size)
+	{
+		return 1;
+	}
+	fprintf(stderr, "%s, round %d: %d elements instead of %d, first difference at %d\n",
+	    what, round, got->size, want->size, i);
+	return 0;
+}
+
+/**
+ * Run the checks for a number of rounds.
+ * @return
+ *		Number of checks that failed
+ */
+static int check(int rounds)
+{
+	static uint32_t a[MAX_BATCH], b[MAX_BATCH];
+	int failed = 0, round;
+	for (round = 0; round < rounds; ++round)
+	{
+		uint32_t range = rng() % 2 ? 1000 : 0;
+		int n = random_batch(a, range);
+		int m = random_batch(b, range);
+		struct ip_set bulk, each, other, want;
+		ip_set_init(&bulk);
+		ip_set_init(&each);
+		ip_set_init(&other);
+		ip_set_init(&want);
+
+		/* Bulk insertion into a set that is not empty */
+		add_each(&bulk, a, n / 2);
+		add_each(&each, a, n);
+		int before = bulk.size;
+		int added = ip_set_add_bulk(&bulk, a + n / 2, n - n / 2);
+		failed += !same(&bulk, &each, "ip_set_add_bulk", round);
+		if (added != bulk.size - before)
+		{
+			fprintf(stderr, "ip_set_add_bulk, round %d: returned %d, %d added\n",
+			    round, added, bulk.size - before);
+			++failed;
+		}
+
+		/* Union, of a set with itself too */
+		add_each(&other, b, m);
+		add_each(&want, a, n);
+		add_each(&want, b, m);
+		ip_set_union(&each, &other);
+		failed += !same(&each, &want, "ip_set_union", round);
+		ip_set_union(&each, &each);
+		failed += !same(&each, &want, "ip_set_union with itself", round);
+
+		/* Intersection, against the elements of a that are in b */
+		ip_set_clear(&want);
+		int i;
+		for (i = 0; i < n; ++i)
+		{
+			if (ip_set_has(&other, a[i]))
+			{
+				ip_set_add(&want, a[i]);
+			}
+		}
+		int size = bulk.size;
+		int removed = ip_set_intersect(&bulk, &other);
+		failed += !same(&bulk, &want, "ip_set_intersect", round);
+		if (removed != size - bulk.size)
+		{
+			fprintf(stderr, "ip_set_intersect, round %d: returned %d, %d removed\n",
+			    round, removed, size - bulk.size);
+			++failed;
+		}
+		ip_set_intersect(&bulk, &bulk);
+		failed += !same(&bulk, &want, "ip_set_intersect with itself", round);
+
+		ip_set_destroy(&bulk);
+		ip_set_destroy(&each);
+		ip_set_destroy(&other);
+		ip_set_destroy(&want);
+	}
+	return failed;
+}
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+ * Time TIMED_BATCHES batches of TIMED_BATCH random elements inserted
+ * into one set, in bulk or one at a time.
+ * @return
+ *		Seconds taken
+ */
+static double timed(int bulk)
+{
+	static uint32_t a[TIMED_BATCH];
+	struct ip_set s;
+	ip_set_init(&s);
+	double start = now();
+	int k, i;
+	for (k = 0; k < TIMED_BATCHES; ++k)
+	{
+		for (i = 0; i < TIMED_BATCH; ++i)
+		{
+			a[i] = rng();
+		}
+		if (bulk)
+		{
+			ip_set_add_bulk(&s, a, TIMED_BATCH);
+		}
+		else
+		{
+			add_each(&s, a, TIMED_BATCH);
+		}
+	}
+	double t = now() - start;
+	ip_set_destroy(&s);
+	return t;
+}
+
+int main(int argc, char* argv[])
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 500;
+	rng_state = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+	if (rounds <= 0 || !rng_state)
+	{
+		fprintf(stderr, "Usage: %s [ROUNDS] [SEED], a positive number of rounds and a non zero seed\n", argv[0]);
+		return 1;
+	}
+	int failed = check(rounds);
+	printf("%d rounds, %d checks failed\n", rounds, failed);
+	if (failed)
+	{
+		return 1;
+	}
+	double each = timed(0), bulk = timed(1);
+	printf("%d elements: one at a time %.3f s, in bulk %.3f s (%.1fx)\n",
+	    TIMED_BATCH * TIMED_BATCHES, each, bulk, each / bulk);
+	return 0;
+}
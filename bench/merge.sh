@@ -0,0 +1,62 @@
+#!/bin/sh
+# Writes the summaries of two fixtures with idsniff -s, as two sensors
+# would, merges them with idsagg and checks the combined counts against
+# the sum of the fixtures' expected ones, and that the heavy IPv6 source
+# of the ipv6 fixture heads the merged top sources.
+#
+# Usage: bench/merge.sh DIR [BINARY] [AGGREGATOR]
+#   DIR is created with bench/fixtures.py if it does not exist
+#   BINARY defaults to build/idsniff
+#   AGGREGATOR defaults to build/idsagg
+
+set -e
+
+DIR=$1
+BIN=${2:-$(dirname "$0")/../build/idsniff}
+AGG=${3:-$(dirname "$0")/../build/idsagg}
+if [ -z "$DIR" ]; then
+	echo "Usage: $0 DIR [BINARY] [AGGREGATOR]" >&2
+	exit 1
+fi
+
+if [ ! -d "$DIR" ]; then
+	"$(dirname "$0")/fixtures.py" "$DIR"
+fi
+
+OUT=$(mktemp)
+trap 'rm -f "$OUT" "$DIR/mixed.summary" "$DIR/ipv6.summary"' EXIT
+for name in mixed ipv6; do
+	"$BIN" -r "$DIR/$name.pcap" -s "$DIR/$name.summary" </dev/null >/dev/null 2>&1
+done
+"$AGG" "$DIR/mixed.summary" "$DIR/ipv6.summary" >"$OUT"
+
+# Sum of a count over both fixtures: expected KEY
+expected() {
+	cat "$DIR/mixed.expect" "$DIR/ipv6.expect" | awk -v key="$1" '$1 == key { n += $2 } END { print n + 0 }'
+}
+
+status=0
+# Count on the line of the report matching PATTERN: check KEY PATTERN
+check() {
+	got=$(sed -n "s/$2/\1/p" "$OUT")
+	want=$(expected "$1")
+	if [ "$got" != "$want" ]; then
+		echo "$1: $got, expected $want" >&2
+		status=1
+	fi
+}
+check syn '^	\([0-9]*\) SYN packets detected.*'
+check arp '^	\([0-9]*\) ARP packets received'
+check blacklist '^URL Blacklist violations: \([0-9]*\)'
+check dns '^DNS Blacklist violations: \([0-9]*\)'
+
+heaviest=$(grep -A1 'Heaviest sources' "$OUT" | sed -n '2s/^[[:space:]]*//p')
+if [ "$heaviest" != "2001:db8:0:1::5000 200 SYN packets" ]; then
+	echo "heaviest source: $heaviest, expected 2001:db8:0:1::5000 200 SYN packets" >&2
+	status=1
+fi
+
+if [ $status -eq 0 ]; then
+	echo "merged summaries ok"
+fi
+exit $status
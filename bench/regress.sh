@@ -0,0 +1,98 @@
+#!/bin/sh
+# Replays every NAME.pcap fixture of a directory through the whole
+# pipeline, checks the detection counts against NAME.expect and records
+# the measurements of idsniff -j, one JSON object per line, in a results
+# file. Given the results file of another build, fails when a fixture's
+# throughput dropped by more than THRESHOLD percent. A fixture with a
+# NAME.args file is run once per line of it, with the options on the
+# line, and recorded as "NAME options".
+#
+# Usage: bench/regress.sh DIR [BINARY] [RESULTS] [BASELINE] [THRESHOLD] [EXTRA OPTIONS...]
+#   DIR is created with bench/fixtures.py if it does not exist
+#   BINARY defaults to build/idsniff
+#   RESULTS defaults to DIR/results.json
+#   THRESHOLD defaults to 10
+
+set -e
+
+DIR=$1
+BIN=${2:-$(dirname "$0")/../build/idsniff}
+RESULTS=${3:-$DIR/results.json}
+BASELINE=$4
+THRESHOLD=${5:-10}
+if [ -z "$DIR" ]; then
+	echo "Usage: $0 DIR [BINARY] [RESULTS] [BASELINE] [THRESHOLD] [EXTRA OPTIONS...]" >&2
+	exit 1
+fi
+shift $(( $# < 5 ? $# : 5 ))
+
+if [ ! -d "$DIR" ]; then
+	"$(dirname "$0")/fixtures.py" "$DIR"
+fi
+
+# Value of a numeric field in a JSON line: field NAME LINE
+field() {
+	echo "$2" | sed -n "s/.*\"$1\": *\([0-9.]*\).*/\1/p"
+}
+
+RUN=$(mktemp)
+trap 'rm -f "$RUN"' EXIT
+: >"$RESULTS"
+status=0
+printf "%-28s %14s %10s %10s %10s %s\n" fixture packets/sec cpu_s rss_kb analyse_us result
+
+# Replay one fixture and report it: run PCAP EXPECT LABEL [OPTIONS...]
+# Its variables are not those of the loop calling it.
+run() {
+	run_pcap=$1
+	run_expect=$2
+	label=$3
+	shift 3
+	if ! "$BIN" -r "$run_pcap" -j "$RUN" "$@" </dev/null >/dev/null 2>&1; then
+		echo "$label: idsniff failed" >&2
+		status=1
+		return
+	fi
+	line=$(sed "s/^{/{\"fixture\": \"$label\", /" "$RUN")
+	echo "$line" >>"$RESULTS"
+
+	result=ok
+	while read -r key count; do
+		got=$(field "$key" "$line")
+		if [ "$got" != "$count" ]; then
+			result="FAIL $key $got, expected $count"
+			status=1
+		fi
+	done <"$run_expect"
+
+	pps=$(field pps "$line")
+	if [ -n "$BASELINE" ] && [ "$result" = ok ]; then
+		base=$(field pps "$(grep "\"fixture\": \"$label\"" "$BASELINE" || true)")
+		if [ -n "$base" ]; then
+			result=$(awk -v pps="$pps" -v base="$base" -v t="$THRESHOLD" 'BEGIN {
+				change = (pps - base) * 100 / base
+				printf "%s %+.1f%%", change < -t ? "SLOWER" : "ok", change }')
+			case $result in SLOWER*) status=1 ;; esac
+		fi
+	fi
+	cpu=$(awk -v u="$(field cpu_user "$line")" -v s="$(field cpu_sys "$line")" 'BEGIN { print u + s }')
+	printf "%-28s %14.0f %10.3f %10d %10.3f %s\n" "$label" "$pps" "$cpu" \
+	    "$(field peak_rss_kb "$line")" "$(field analyse "$line")" "$result"
+}
+
+for pcap in "$DIR"/*.pcap; do
+	name=$(basename "$pcap" .pcap)
+	expect="$DIR/$name.expect"
+	if [ ! -f "$expect" ]; then
+		continue
+	fi
+	if [ ! -f "$DIR/$name.args" ]; then
+		run "$pcap" "$expect" "$name" "$@"
+		continue
+	fi
+	while read -r args; do
+		# Options of the line split on spaces, then the common ones
+		run "$pcap" "$expect" "$name $args" $args "$@"
+	done <"$DIR/$name.args"
+done
+exit $status
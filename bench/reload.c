@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h> /* symlink */
+
+#include "blacklist.h"
+
+/*
+ * Reloads the blacklist on SIGHUP, through the reloader thread of the
+ * sensor, while workers look domains up without pause. PATH is a
+ * symbolic link switched between two indexes written next to it, each
+ * reload is waited for before the next one. A lookup that reads a
+ * freed index crashes (or is reported by AddressSanitizer), one that
+ * finds a listed domain missing or an unlisted one present fails the
+ * run. The window of such races is a few instructions, run it with more
+ * threads than CPUs for workers to be preempted in it.
+ *
+ * Usage: reload PATH [SECONDS] [THREADS]
+ */
+
+#define MAX_WORKERS 64
+/* Longest wait for one reload (seconds) */
+#define RELOAD_WAIT 5
+
+/* evil.com is in both indexes, bad.org only in the second */
+static const char* first[] = {"evil.com"};
+static const char* second[] = {"evil.com", "bad.org"};
+
+static atomic_int stop;
+static atomic_ulong lookups, wrong;
+
+static void* worker(void* arg)
+{
+	(void) arg;
+	static const unsigned char qname[] = "\3www\4evil\3com";
+	char domain[64];
+	while (!atomic_load(&stop))
+	{
+		int ok = is_blacklisted_domain("www.evil.com", 12)
+		    && !is_blacklisted_domain("www.example.com", 15)
+		    && blacklist_count_qname(qname, sizeof(qname), domain, sizeof(domain));
+		/* bad.org comes and goes with the reloads */
+		is_blacklisted_domain("bad.org:80", 10);
+		atomic_fetch_add_explicit(&lookups, 4, memory_order_relaxed);
+		if (!ok)
+		{
+			atomic_fetch_add(&wrong, 1);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Write the index of the given domains to path.
+ * @return
+ *		0 on success, -1 otherwise
+ */
+static int write_index(const char* path, const char* const* names, int n)
+{
+	size_t size;
+	void* index = dindex_build(names, n, &size);
+	int r = index ? dindex_write(path, index, size) : -1;
+	free(index);
+	return r;
+}
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* path = argc > 1 ? argv[1] : NULL;
+	double seconds = argc > 2 ? atof(argv[2]) : 2;
+	int nworkers = argc > 3 ? atoi(argv[3]) : 4;
+	if (!path || seconds <= 0 || nworkers <= 0 || nworkers > MAX_WORKERS)
+	{
+		fprintf(stderr, "Usage: %s PATH [SECONDS] [THREADS], at most %d threads\n", argv[0], MAX_WORKERS);
+		return 1;
+	}
+	char targets[2][4096], link[4096];
+	snprintf(targets[0], sizeof(targets[0]), "%s.1", path);
+	snprintf(targets[1], sizeof(targets[1]), "%s.2", path);
+	snprintf(link, sizeof(link), "%s.link", path);
+	unlink(path);
+	if (write_index(targets[0], first, 1) != 0 || write_index(targets[1], second, 2) != 0
+	    || symlink(targets[0], path) != 0 || blacklist_init(path) != 0)
+	{
+		fprintf(stderr, "Cannot set up the indexes at %s\n", path);
+		return 1;
+	}
+	/* Before the workers, for SIGHUP to be left to the reloader */
+	blacklist_start_reloader(path);
+	pthread_t workers[MAX_WORKERS];
+	int i;
+	for (i = 0; i < nworkers; ++i)
+	{
+		pthread_create(&workers[i], NULL, &worker, NULL);
+	}
+
+	int reloads = 0, failed = 0;
+	double start = now();
+	while (!failed && now() - start < seconds)
+	{
+		int n = reloads % 2 ? 1 : 2;
+		unlink(link);
+		if (symlink(targets[n - 1], link) != 0 || rename(link, path) != 0)
+		{
+			fprintf(stderr, "Cannot switch %s to %s\n", path, targets[n - 1]);
+			failed = 1;
+			break;
+		}
+		kill(getpid(), SIGHUP);
+		double sent = now();
+		while (blacklist_size() != n && now() - sent < RELOAD_WAIT)
+		{
+			sched_yield();
+		}
+		if (blacklist_size() != n)
+		{
+			fprintf(stderr, "Reload %d not done after %d s\n", reloads + 1, RELOAD_WAIT);
+			failed = 1;
+		}
+		++reloads;
+	}
+
+	atomic_store(&stop, 1);
+	for (i = 0; i < nworkers; ++i)
+	{
+		pthread_join(workers[i], NULL);
+	}
+	blacklist_stop_reloader();
+	blacklist_destroy();
+	unlink(path);
+	unlink(targets[0]);
+	unlink(targets[1]);
+	fprintf(stderr, "%d reloads, %lu lookups by %d threads, %lu wrong\n",
+	    reloads, atomic_load(&lookups), nworkers, atomic_load(&wrong));
+	return failed || atomic_load(&wrong) ? 1 : 0;
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Replays a pcap file through the whole pipeline with 1 to N workers and
+# prints the throughput of each run.
+#
+# Usage: bench/scaling.sh FILE [MAX_WORKERS] [BINARY] [EXTRA OPTIONS...]
+#   MAX_WORKERS defaults to the number of CPUs
+#   BINARY defaults to build/idsniff
+
+set -e
+
+FILE=$1
+MAX=${2:-$(nproc)}
+BIN=${3:-$(dirname "$0")/../build/idsniff}
+if [ -z "$FILE" ]; then
+	echo "Usage: $0 FILE [MAX_WORKERS] [BINARY] [EXTRA OPTIONS...]" >&2
+	exit 1
+fi
+shift $(( $# < 3 ? $# : 3 ))
+
+printf "%-8s %14s %10s\n" workers packets/sec speedup
+base=
+n=1
+while [ "$n" -le "$MAX" ]; do
+	pps=$("$BIN" -r "$FILE" -t "$n" "$@" 2>/dev/null \
+	    | sed -n 's/^Replayed .*(\([0-9.]*\) packets\/sec)$/\1/p')
+	if [ -z "$base" ]; then
+		base=$pps
+	fi
+	awk -v n="$n" -v pps="$pps" -v base="$base" \
+	    'BEGIN { printf "%-8d %14.0f %9.2fx\n", n, pps, pps / base }'
+	n=$((n + 1))
+done
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Replays a pcap file, interrupts the replay with SIGINT after a delay
+# and prints how long the shutdown took: until capture stopped, until
+# every captured packet was analysed, and until the report was printed.
+# The file must be large enough to still be replaying when interrupted.
+#
+# Usage: bench/shutdown.sh FILE [DELAY] [BINARY] [EXTRA OPTIONS...]
+#   DELAY in seconds, defaults to 1
+#   BINARY defaults to build/idsniff
+
+set -e
+
+FILE=$1
+DELAY=${2:-1}
+BIN=${3:-$(dirname "$0")/../build/idsniff}
+if [ -z "$FILE" ]; then
+	echo "Usage: $0 FILE [DELAY] [BINARY] [EXTRA OPTIONS...]" >&2
+	exit 1
+fi
+shift $(( $# < 3 ? $# : 3 ))
+
+OUT=$(mktemp)
+trap 'rm -f "$OUT"' EXIT
+"$BIN" -r "$FILE" "$@" >"$OUT" 2>&1 &
+pid=$!
+sleep "$DELAY"
+kill -INT "$pid" 2>/dev/null || true
+wait "$pid"
+
+if ! grep '^Shutdown latency' "$OUT"; then
+	echo "Replay finished before the interrupt, use a larger file or shorter delay" >&2
+	exit 1
+fi
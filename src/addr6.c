@@ -0,0 +1,24 @@
+#include "addr6.h"
+/* Includes are in header file */
+
+uint32_t addr6_digest_key[4];
+
+void addr6_init(void)
+{
+	if (getrandom(addr6_digest_key, sizeof(addr6_digest_key), 0) == sizeof(addr6_digest_key))
+	{
+		return;
+	}
+	/* No entropy source, time and pid still differ between runs */
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	uint64_t seed = ((uint64_t) t.tv_sec * 1000000 + t.tv_usec) ^ (uint64_t) getpid() << 32;
+	int i;
+	for (i = 0; i < 4; ++i)
+	{
+		seed += 0x9e3779b97f4a7c15ull;
+		uint64_t z = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		addr6_digest_key[i] = (uint32_t) (z ^ (z >> 31));
+	}
+}
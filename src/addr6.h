@@ -0,0 +1,100 @@
+#ifndef CS241_ADDR6_H
+#define CS241_ADDR6_H
+
+#include <stdint.h> /* uint64_t */
+#include <string.h> /* memcpy */
+#include <sys/random.h> /* getrandom */
+#include <sys/time.h> /* gettimeofday */
+#include <unistd.h> /* getpid */
+#ifdef __SSE2__
+#include <emmintrin.h> /* _mm_cmpeq_epi8 */
+#endif
+
+/**
+ * An IPv6 address in network byte order, 16 byte aligned so that it is
+ * compared with one SIMD load per side. Tables keep these inline, a key
+ * is never a pointer to memory of its own.
+ */
+struct addr6
+{
+	union
+	{
+		unsigned char b[16];
+		uint64_t w[2];
+#ifdef __SSE2__
+		__m128i v;
+#endif
+	};
+} __attribute__((aligned(16)));
+
+/* Random key of addr6_digest, set by addr6_init */
+extern uint32_t addr6_digest_key[4];
+
+/**
+ * Pick the key of addr6_digest. Must be called once before any packet
+ * is analysed.
+ */
+void addr6_init(void);
+
+/**
+ * Load an address from a packet, which has no particular alignment.
+ */
+static inline void addr6_load(struct addr6* a, const unsigned char* p)
+{
+	memcpy(a->b, p, 16);
+}
+
+/**
+ * Compare two addresses.
+ * @return
+ *		1 if both are the same address
+ *		0 otherwise.
+ */
+static inline int addr6_eq(const struct addr6* a, const struct addr6* b)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(a->v, b->v)) == 0xffff;
+#else
+	return a->w[0] == b->w[0] && a->w[1] == b->w[1];
+#endif
+}
+
+/**
+ * Hash of an address, the same in every process so that sketches of
+ * several sensors merge.
+ */
+static inline uint32_t addr6_hash(const struct addr6* a)
+{
+	/* Each half mixed on its own first, sources usually share the
+	 * network half */
+	uint64_t h = a->w[0] * 0x9e3779b97f4a7c15ull ^ a->w[1] * 0xc2b2ae3d27d4eb4full;
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ull;
+	return (uint32_t) (h >> 32);
+}
+
+/**
+ * Keyed 32 bit digest of an address, which stands for it in a flow_key.
+ * The key is random so that nobody can pick an address whose digest
+ * matches the one of another flow and share its reassembly or cached
+ * verdict. Two addresses share a digest with probability about 2^-32,
+ * their flows then also need the same other end and ports to collide.
+ */
+static inline uint32_t addr6_digest(const struct addr6* a)
+{
+	uint32_t x[4];
+	memcpy(x, a->b, 16);
+	/* NH universal hash over the four words, then the murmur3
+	 * finaliser */
+	uint64_t h = (uint64_t) (x[0] + addr6_digest_key[0]) * (x[1] + addr6_digest_key[1])
+	    + (uint64_t) (x[2] + addr6_digest_key[2]) * (x[3] + addr6_digest_key[3]);
+	uint32_t d = (uint32_t) (h >> 32) ^ (uint32_t) h * 0x85ebca6bu;
+	d ^= d >> 16;
+	d *= 0x85ebca6bu;
+	d ^= d >> 13;
+	d *= 0xc2b2ae35u;
+	d ^= d >> 16;
+	return d;
+}
+
+#endif
@@ -0,0 +1,336 @@
+#include "allowlist.h"
+/* Includes are in header file */
+
+uint32_t* allow_root = NULL;
+uint32_t* allow_chunks = NULL;
+static int nchunks = 0, chunk_capacity = 0;
+static int networks4 = 0, networks6 = 0;
+
+/* IPv6 networks of one prefix length */
+struct allow6_set
+{
+	int bits;
+	struct addr6 mask;
+	uint32_t nslots; /* Power of two, at most half used */
+	struct addr6* slots;
+	unsigned char* used;
+};
+static struct allow6_set allow6[129];
+int allow6_lengths = 0;
+
+/* IPv6 networks read, until the sets are built */
+struct network6
+{
+	struct addr6 a;
+	int bits;
+};
+static struct network6* read6 = NULL;
+static int nread6 = 0, read6_capacity = 0;
+
+static void out_of_memory(void)
+{
+	fprintf(stderr, "%s\n", "[ERROR] Failed to load allowlist (memory allocation error)");
+	exit(1);
+}
+
+/**
+ * Add a chunk of ALLOW_NONE entries, allow_chunks may move.
+ * @return
+ *		Number of the chunk
+ */
+static uint32_t chunk_new(void)
+{
+	if (nchunks >= chunk_capacity)
+	{
+		int capacity = chunk_capacity ? chunk_capacity * 2 : 16;
+		uint32_t* chunks = mem_alloc(MEM_ALLOWLIST, (size_t) capacity * ALLOW_CHUNK * sizeof(uint32_t), 0);
+		if (allow_chunks)
+		{
+			memcpy(chunks, allow_chunks, (size_t) chunk_capacity * ALLOW_CHUNK * sizeof(uint32_t));
+		}
+		mem_free(MEM_ALLOWLIST, allow_chunks, (size_t) chunk_capacity * ALLOW_CHUNK * sizeof(uint32_t));
+		allow_chunks = chunks;
+		chunk_capacity = capacity;
+	}
+	memset(allow_chunks + (size_t) nchunks * ALLOW_CHUNK, 0, ALLOW_CHUNK * sizeof(uint32_t));
+	return nchunks++;
+}
+
+/* Allow n entries from e on, chunks they pointed to are left unused */
+static void allow_range(uint32_t* e, uint32_t n)
+{
+	uint32_t i;
+	for (i = 0; i < n; ++i)
+	{
+		e[i] = ALLOW_ALL;
+	}
+}
+
+/**
+ * Add an IPv4 network, a is in host byte order with the host bits clear.
+ */
+static void allow_add4(uint32_t a, int bits)
+{
+	if (!allow_root)
+	{
+		allow_root = mem_alloc(MEM_ALLOWLIST, 65536 * sizeof(uint32_t), 1);
+		/* Chunk numbers start above ALLOW_ALL */
+		nchunks = ALLOW_ALL + 1;
+	}
+	if (bits <= 16)
+	{
+		allow_range(allow_root + (a >> 16), 1u << (16 - bits));
+		return;
+	}
+	uint32_t* e = allow_root + (a >> 16);
+	if (*e == ALLOW_ALL)
+	{
+		return;
+	}
+	if (*e == ALLOW_NONE)
+	{
+		*e = chunk_new();
+	}
+	size_t i = (size_t) *e * ALLOW_CHUNK + ((a >> 8) & 0xff);
+	if (bits <= 24)
+	{
+		allow_range(allow_chunks + i, 1u << (24 - bits));
+		return;
+	}
+	if (allow_chunks[i] == ALLOW_ALL)
+	{
+		return;
+	}
+	if (allow_chunks[i] == ALLOW_NONE)
+	{
+		uint32_t c = chunk_new();
+		allow_chunks[i] = c;
+	}
+	allow_range(allow_chunks + (size_t) allow_chunks[i] * ALLOW_CHUNK + (a & 0xff), 1u << (32 - bits));
+}
+
+/* Mask of the first bits of an address */
+static void mask6(struct addr6* m, int bits)
+{
+	int k;
+	for (k = 0; k < 16; ++k)
+	{
+		int b = bits - 8 * k;
+		m->b[k] = b >= 8 ? 0xff : b <= 0 ? 0 : (unsigned char) (0xff << (8 - b));
+	}
+}
+
+static void read_add6(const struct addr6* a, int bits)
+{
+	if (nread6 == read6_capacity)
+	{
+		read6_capacity = read6_capacity ? read6_capacity * 2 : 64;
+		read6 = realloc(read6, read6_capacity * sizeof(*read6));
+		if (!read6)
+		{
+			out_of_memory();
+		}
+	}
+	read6[nread6].a = *a;
+	read6[nread6].bits = bits;
+	++nread6;
+}
+
+/* Build the IPv6 sets from the networks read */
+static void allow6_build(void)
+{
+	int count[129] = {0};
+	int set_of[129];
+	int i;
+	for (i = 0; i < nread6; ++i)
+	{
+		++count[read6[i].bits];
+	}
+	for (i = 0; i <= 128; ++i)
+	{
+		if (!count[i])
+		{
+			continue;
+		}
+		struct allow6_set* s = allow6 + allow6_lengths;
+		set_of[i] = allow6_lengths++;
+		s->bits = i;
+		mask6(&s->mask, i);
+		s->nslots = 4;
+		while (s->nslots < 2 * (uint32_t) count[i])
+		{
+			s->nslots *= 2;
+		}
+		s->slots = mem_alloc(MEM_ALLOWLIST, s->nslots * sizeof(struct addr6), 1);
+		s->used = mem_alloc(MEM_ALLOWLIST, s->nslots, 1);
+	}
+	for (i = 0; i < nread6; ++i)
+	{
+		struct allow6_set* s = allow6 + set_of[read6[i].bits];
+		uint32_t j = addr6_hash(&read6[i].a) & (s->nslots - 1);
+		while (s->used[j] && !addr6_eq(&s->slots[j], &read6[i].a))
+		{
+			j = (j + 1) & (s->nslots - 1);
+		}
+		s->slots[j] = read6[i].a;
+		s->used[j] = 1;
+	}
+	free(read6);
+	read6 = NULL;
+	nread6 = read6_capacity = 0;
+}
+
+/**
+ * Parse a line of the allowlist and add its network.
+ * @return
+ *		1 if a network was added
+ *		0 if the line has none
+ *		-1 if it is malformed
+ */
+static int parse_network(char* line)
+{
+	char* hash = strchr(line, '#');
+	if (hash)
+	{
+		*hash = '\0';
+	}
+	char* start = line + strspn(line, " \t");
+	int n = strcspn(start, " \t\r\n");
+	if (start[n + strspn(start + n, " \t\r\n")] != '\0')
+	{
+		return -1;
+	}
+	start[n] = '\0';
+	if (n == 0)
+	{
+		return 0;
+	}
+	int v6 = strchr(start, ':') != NULL;
+	int bits = v6 ? 128 : 32;
+	char* slash = strchr(start, '/');
+	if (slash)
+	{
+		char* end;
+		long b = strtol(slash + 1, &end, 10);
+		if (end == slash + 1 || *end != '\0' || b < 0 || b > bits)
+		{
+			return -1;
+		}
+		bits = b;
+		*slash = '\0';
+	}
+	if (v6)
+	{
+		struct addr6 a, m;
+		if (inet_pton(AF_INET6, start, a.b) != 1)
+		{
+			return -1;
+		}
+		mask6(&m, bits);
+		a.w[0] &= m.w[0];
+		a.w[1] &= m.w[1];
+		read_add6(&a, bits);
+		++networks6;
+	}
+	else
+	{
+		struct in_addr a;
+		if (inet_pton(AF_INET, start, &a) != 1)
+		{
+			return -1;
+		}
+		uint32_t host = ntohl(a.s_addr);
+		allow_add4(bits ? host & (0xffffffffu << (32 - bits)) : 0, bits);
+		++networks4;
+	}
+	return 1;
+}
+
+/**
+ * Skip the rest of a line longer than the buffer it was read into.
+ * @return
+ *		1 if the rest has anything but blanks
+ *		0 otherwise
+ */
+static int skip_line(FILE* f)
+{
+	int c, text = 0;
+	while ((c = getc(f)) != EOF && c != '\n')
+	{
+		text |= !isspace(c);
+	}
+	return text;
+}
+
+int allowlist_load(const char* path)
+{
+	FILE* f = fopen(path, "r");
+	if (!f)
+	{
+		fprintf(stderr, "[ERROR] Cannot open allowlist %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	char line[256];
+	int lineno = 0;
+	while (fgets(line, sizeof(line), f))
+	{
+		++lineno;
+		size_t len = strlen(line);
+		if (len == sizeof(line) - 1 && line[len - 1] != '\n'
+		    && skip_line(f) && !strchr(line, '#'))
+		{
+			/* Only a comment makes a line this long */
+			fprintf(stderr, "[WARNING] %s:%d is not a network, skipped\n", path, lineno);
+			continue;
+		}
+		if (parse_network(line) < 0)
+		{
+			fprintf(stderr, "[WARNING] %s:%d is not a network, skipped\n", path, lineno);
+		}
+	}
+	fclose(f);
+	allow6_build();
+	return 0;
+}
+
+void allowlist_destroy(void)
+{
+	mem_free(MEM_ALLOWLIST, allow_root, 65536 * sizeof(uint32_t));
+	mem_free(MEM_ALLOWLIST, allow_chunks, (size_t) chunk_capacity * ALLOW_CHUNK * sizeof(uint32_t));
+	allow_root = allow_chunks = NULL;
+	int i;
+	for (i = 0; i < allow6_lengths; ++i)
+	{
+		mem_free(MEM_ALLOWLIST, allow6[i].slots, allow6[i].nslots * sizeof(struct addr6));
+		mem_free(MEM_ALLOWLIST, allow6[i].used, allow6[i].nslots);
+	}
+	allow6_lengths = 0;
+}
+
+void allowlist_size(int* v4, int* v6)
+{
+	*v4 = networks4;
+	*v6 = networks6;
+}
+
+int allowlist_has6(const struct addr6* a)
+{
+	int i;
+	for (i = 0; i < allow6_lengths; ++i)
+	{
+		const struct allow6_set* s = allow6 + i;
+		struct addr6 m;
+		m.w[0] = a->w[0] & s->mask.w[0];
+		m.w[1] = a->w[1] & s->mask.w[1];
+		uint32_t j = addr6_hash(&m) & (s->nslots - 1);
+		while (s->used[j])
+		{
+			if (addr6_eq(&s->slots[j], &m))
+			{
+				return 1;
+			}
+			j = (j + 1) & (s->nslots - 1);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,102 @@
+#ifndef CS241_ALLOWLIST_H
+#define CS241_ALLOWLIST_H
+
+#include <stdio.h> /* fopen, fprintf */
+#include <stdlib.h> /* strtol */
+#include <string.h> /* strchr, memcpy */
+#include <stdint.h> /* uint32_t */
+#include <errno.h> /* errno */
+#include <ctype.h> /* isspace */
+#include <arpa/inet.h> /* inet_pton */
+#include "addr6.h" /* struct addr6 */
+#include "mem.h" /* mem_alloc */
+
+/*
+ * Networks whose SYN packets are not counted, load balancers and health
+ * checkers which would otherwise pass for a SYN flood. Loaded once at
+ * start and only read afterwards.
+ *
+ * IPv4 networks are in a DIR-16-8-8 trie: a table of 65536 entries by
+ * the top 16 bits of the address, and chunks of 256 entries by each of
+ * the next two bytes for networks longer than /16. An entry is
+ * ALLOW_NONE, ALLOW_ALL for a range entirely allowed, or the number of
+ * the chunk refining it, so that a lookup reads three entries at most.
+ * IPv6 networks are in a hash set per prefix length, a lookup probes
+ * one set per length in use.
+ */
+#define ALLOW_NONE 0
+#define ALLOW_ALL 1
+/* Entries per chunk, chunks 0 and 1 are never used so that entries
+ * above ALLOW_ALL are chunk numbers */
+#define ALLOW_CHUNK 256
+
+/* The IPv4 trie, NULL while no allowlist is loaded */
+extern uint32_t* allow_root;
+extern uint32_t* allow_chunks;
+/* Number of IPv6 prefix lengths in use */
+extern int allow6_lengths;
+
+/**
+ * Load the networks of a file, one per line in CIDR notation (10.0.0.0/8,
+ * 2001:db8::/32, or an address alone for a host); # starts a comment.
+ * Malformed lines are reported and skipped. Must be called before any
+ * packet is analysed.
+ * @return
+ *		0 on success
+ *		-1 if the file cannot be read, after printing why
+ */
+int allowlist_load(const char* path);
+
+/**
+ * Free all resources of the allowlist.
+ */
+void allowlist_destroy(void);
+
+/**
+ * Number of IPv4 and IPv6 networks loaded.
+ */
+void allowlist_size(int* v4, int* v6);
+
+/**
+ * @return
+ *		1 if an allowlist is loaded
+ *		0 otherwise.
+ */
+static inline int allowlist_active(void)
+{
+	return allow_root != NULL || allow6_lengths > 0;
+}
+
+/**
+ * Whether an IPv4 address (host byte order) is in an allowed network.
+ * @return
+ *		1 if it is
+ *		0 otherwise.
+ */
+static inline int allowlist_has(uint32_t a)
+{
+	if (!allow_root)
+	{
+		return 0;
+	}
+	uint32_t e = allow_root[a >> 16];
+	if (e > ALLOW_ALL)
+	{
+		e = allow_chunks[e * ALLOW_CHUNK + ((a >> 8) & 0xff)];
+		if (e > ALLOW_ALL)
+		{
+			e = allow_chunks[e * ALLOW_CHUNK + (a & 0xff)];
+		}
+	}
+	return e == ALLOW_ALL;
+}
+
+/**
+ * Whether an IPv6 address is in an allowed network.
+ * @return
+ *		1 if it is
+ *		0 otherwise.
+ */
+int allowlist_has6(const struct addr6* a);
+
+#endif
@@ -4,31 +4,24 @@
 /* Check if character is in the ASCII printable range. */
 #define IS_PRINTABLE(c) (((unsigned char)(c)) >= 0x20 && ((unsigned char)(c)) <= 0x7e)
 
-extern struct ip_set unique_ips;
-extern int total_syn_packets;
-extern int total_arp_packets;
-extern int total_blacklist_viol;
-extern long long first_syn_time, last_syn_time;
 extern long long get_time(void);
+extern struct src_table syn_sources;
+extern struct scan_table scan_sources;
+extern struct rate_table flood_dests;
 
-pthread_mutex_t
-	/* Resources mutexed
-	 * unique_ips, total_syn_packets,
-	 * last_syn_time, first_syn_time */
-	syn_mutex = PTHREAD_MUTEX_INITIALIZER,
-	/* Resources mutexed: total_arp_packets */
-	arp_mutex = PTHREAD_MUTEX_INITIALIZER,
-	/* Resources mutexed: total_blacklist_viol */
-	blacklist_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-/* Control during compilation of messages 
- * verbose command line argument overrides all to 1 */
-static const int
-	showether = 0,
-	showarp   = 0,
-	showipv4  = 0,
-	showtcp   = 0,
-	show_detections = 1;
+/* Headers printed, set with analysis_debug; the verbose command line
+ * argument prints all but Ethernet */
+static int
+	show_ether = 0,
+	show_arp   = 0,
+	show_ipv4  = 0,
+	show_ipv6  = 0,
+	show_tcp   = 0,
+	show_udp   = 0;
+/* Any of the above, frames are then decoded even if no detector needs
+ * them */
+static int debugging = 0;
+static const int show_detections = 1;
 
 /** 
  * In: 32 bit (uint32_t) int (host byte ordering)
@@ -50,6 +43,12 @@ void print_inet_addr(uint32_t a)
 	// printf("%lu.%lu.%lu.%lu", a >> 24, (a >> 16) % 256, (a >> 8) % 256, a % 256);
 }
 
+void print_inet6_addr(const struct addr6* a)
+{
+	char s[INET6_ADDRSTRLEN];
+	printf("%s", inet_ntop(AF_INET6, a->b, s, sizeof(s)));
+}
+
 /**
  *	In: Takes an array of 6 bytes (unsigned char)
  *	Out: Prints MAC address in hexadecimal, colon (:) as
@@ -137,6 +136,10 @@ int is_syn_packet(struct tcphdr* tcp_h)
  */
 const char *memmem(const char *haystack, size_t haystacklen, const char *needle, size_t needlelen)
 {
+	if (haystacklen < needlelen)
+	{
+		return NULL;
+	}
 	int i = 0;
 	while (i <= haystacklen - needlelen)
 	{
@@ -165,6 +168,10 @@ const char *memmem(const char *haystack, size_t haystacklen, const char *needle,
  */
 const char *memmem_nocase(const char *haystack, size_t haystacklen, const char *needle, size_t needlelen)
 {
+	if (haystacklen < needlelen)
+	{
+		return NULL;
+	}
 	int i = 0;
 	while (i <= haystacklen - needlelen)
 	{
@@ -178,20 +185,18 @@ const char *memmem_nocase(const char *haystack, size_t haystacklen, const char *
 }
 
 /**
- * Given a string checks if it is an HTTP request and if so if it is to one
- * (and only) blacklisted urls.
+ * Given a string checks if it is an HTTP request and if so if its Host
+ * header names a blacklisted domain (see is_blacklisted_domain).
  * @arg s
  *		Given string to check, not null terminated.
  * @arg
  * 		n Length of string 
  * @return
  *		1 iff the given string is both an HTTP request and it violates
- *		the pre-determined blacklist, otherwise a 0 is returned. (www.telegraph.co.uk)
+ *		the blacklist, otherwise a 0 is returned.
  */
 int is_blacklist_req(const char* s, int n)
 {
-	static const char* blacklist_domain = "www.telegraph.co.uk";
-
 	/* first newline */
 	const char* nl = memchr(s, '\n', n); /* Possibly returns NULL if no \n */
 	if (!nl)
@@ -200,7 +205,7 @@ int is_blacklist_req(const char* s, int n)
 		return 0;
 	}
 	/* Ignore possible Carriage Return */
-	int firstlinelen = nl - s - (*(nl - 1)=='\r'?1:0);
+	int firstlinelen = nl - s - ((nl > s && *(nl - 1)=='\r')?1:0);
 
 	/* HTTP REQUEST CHECK
 	 * Case insensitive test of first line of given string
@@ -226,185 +231,1151 @@ int is_blacklist_req(const char* s, int n)
 			/* Host header not found */ 
 			break;
 		}
-		printf("%.*s\n", len, s + linestart);
 		/* HTTP headers are case insensitive, as is the domain name (unlike complete URL) */
-		if (memcmp_nocase(s + linestart,"Host",4) == 0) /* Found HOSTS header */
+		if (len > 5 && memcmp_nocase(s + linestart,"Host:",5) == 0) /* Found HOSTS header */
+		{
+			/* Header value, without leading whitespace */
+			int value = linestart + 5;
+			while (value < linestart + len && (s[value] == ' ' || s[value] == '\t')) ++value;
+			return is_blacklisted_domain(s + value, linestart + len - value);
+		}
+		linestart = next_nl + 1;
+	}
+	return 0;
+}
+
+/* Payload inspection of the packets of one analyse call */
+struct sample_tally
+{
+	int shift; /* Sampling rate, from sampling_shift */
+	unsigned long inspected, skipped;
+};
+
+/**
+ * Whether to inspect the payload of a packet of flow key, counting it
+ * in the tally.
+ */
+static int sample(struct sample_tally* t, const struct flow_key* key)
+{
+	if (sampling_keep(flow_hash(key), t->shift))
+	{
+		++t->inspected;
+		return 1;
+	}
+	++t->skipped;
+	return 0;
+}
+
+/**
+ * Add a tally to the statistics.
+ */
+static void sample_tally_add(struct stats* st, const struct sample_tally* t)
+{
+	if (t->inspected)
+	{
+		atomic_fetch_add(&st->payload_inspected, t->inspected);
+	}
+	if (t->skipped)
+	{
+		atomic_fetch_add(&st->payload_skipped, t->skipped);
+	}
+}
+
+/**
+ * Count one blacklisted domain request, found while inspecting 1 in
+ * 2^shift flows.
+ */
+static void blacklist_violation(struct stats* st, int shift, int verbose)
+{
+	if (show_detections || verbose)
+	{
+		puts("BLACKLISTED DOMAIN DETECTED");
+	}
+	prof_lock(&st->blacklist_mutex, PROF_LOCK_BLACKLIST);
+	++st->total_blacklist_viol;
+	st->est_blacklist_viol += 1UL << shift;
+	pthread_mutex_unlock(&st->blacklist_mutex);
+}
+
+/**
+ * Count n SYN packets seen at time now.
+ */
+static void syn_count(struct stats* st, int n, long long now, int verbose)
+{
+	if (show_detections || verbose)
+	{
+		int i;
+		for (i = 0; i < n; ++i)
+		{
+			puts("SYN PACKET RECEIVED");
+		}
+	}
+	prof_lock(&st->syn_mutex, PROF_LOCK_SYN);
+	st->last_syn_time = now;
+	if (!st->total_syn_packets)
+	{
+		st->first_syn_time = now;
+	}
+	st->total_syn_packets += n;
+	pthread_mutex_unlock(&st->syn_mutex);
+}
+
+/**
+ * Record the source of a SYN packet in the window and in the distinct
+ * sources of the epoch.
+ */
+static void syn_source(struct stats* st, uint32_t src_ipa, long long now, int verbose)
+{
+	hll_add(st->syn_sources_hll, src_ipa);
+	if (src_table_touch(&syn_sources, src_ipa, now) && (show_detections || verbose))
+	{
+		printf("/!\\ New SYN Src IP: "); print_inet_addr(src_ipa); puts("");
+	}
+}
+
+/**
+ * Record an IPv6 source of a SYN packet, as syn_source.
+ */
+static void syn_source6(struct stats* st, const struct addr6* src_ipa, long long now, int verbose)
+{
+	hll_add(st->syn_sources_hll, addr6_hash(src_ipa));
+	if (src_table_touch6(&syn_sources, src_ipa, now) && (show_detections || verbose))
+	{
+		printf("/!\\ New SYN Src IP: "); print_inet6_addr(src_ipa); puts("");
+	}
+}
+
+/**
+ * PORT SCAN DETECTION
+ * Every connection attempt (SYN) counts towards the distinct ports and
+ * hosts its source tried within its window.
+ * @return
+ *		DETECT_SCAN if the source just crossed a scan threshold
+ *		0 otherwise.
+ */
+static int detect_scan(struct stats* st, uint32_t src, uint32_t dst, uint16_t dport, long long now, int verbose)
+{
+	int crossed = scan_table_touch(&scan_sources, src, dst, dport, now);
+	if (!crossed)
+	{
+		return 0;
+	}
+	if (crossed & SCAN_VERTICAL)
+	{
+		atomic_fetch_add(&st->vertical_scans, 1);
+	}
+	if (crossed & SCAN_HORIZONTAL)
+	{
+		atomic_fetch_add(&st->horizontal_scans, 1);
+	}
+	if ((crossed & SCAN_VERTICAL) && (show_detections || verbose))
+	{
+		printf("/!\\ Port scan from "); print_inet_addr(src); puts("");
+	}
+	if ((crossed & SCAN_HORIZONTAL) && (show_detections || verbose))
+	{
+		printf("/!\\ Host scan from "); print_inet_addr(src); puts("");
+	}
+	return DETECT_SCAN;
+}
+
+/* Packets over the rate of one analyse call, added to the statistics at
+ * once so that a flood does not make every packet update them */
+struct flood_tally
+{
+	unsigned long udp_over, icmp_over;
+	/* Destinations that went over their rate */
+	unsigned long udp_floods, icmp_floods;
+};
+
+/**
+ * UDP AND ICMP FLOOD DETECTION
+ * Every UDP and ICMP packet takes a token from the bucket of its
+ * destination, packets finding it empty are part of a flood.
+ * @arg ts
+ *		Capture time (micro seconds), so that replays see the rate of
+ *		the capture
+ * @return
+ *		DETECT_FLOOD for the first packet over the rate of a destination
+ *		0 otherwise.
+ */
+static int detect_flood(struct flood_tally* t, int proto, uint32_t dst, long long ts, int verbose)
+{
+	int udp = proto == 0x11;
+	int hit = rate_table_hit(&flood_dests, proto, dst, ts,
+	    udp ? RATE_UDP_PPS : RATE_ICMP_PPS, udp ? RATE_UDP_BURST : RATE_ICMP_BURST);
+	if (!hit)
+	{
+		return 0;
+	}
+	udp ? ++t->udp_over : ++t->icmp_over;
+	if (!(hit & RATE_FIRST))
+	{
+		return 0;
+	}
+	udp ? ++t->udp_floods : ++t->icmp_floods;
+	if (show_detections || verbose)
+	{
+		printf("/!\\ %s flood to ", udp ? "UDP" : "ICMP"); print_inet_addr(dst); puts("");
+	}
+	return DETECT_FLOOD;
+}
+
+/**
+ * Add a tally to the statistics.
+ */
+static void flood_tally_add(struct stats* st, const struct flood_tally* t)
+{
+	if (t->udp_over)
+	{
+		atomic_fetch_add(&st->udp_flood_packets, t->udp_over);
+		atomic_fetch_add(&st->udp_floods, t->udp_floods);
+	}
+	if (t->icmp_over)
+	{
+		atomic_fetch_add(&st->icmp_flood_packets, t->icmp_over);
+		atomic_fetch_add(&st->icmp_floods, t->icmp_floods);
+	}
+}
+
+/**
+ * BLACKLISTED URL DETECTION
+ * Segments go through reassembly so that requests whose headers span
+ * several segments are still checked. Once a verdict is reached it is
+ * cached and the payload of the remaining segments of the flow is not
+ * parsed again.
+ * @return
+ *		DETECT_BLACKLIST if the segment completed a blacklisted request
+ *		0 otherwise.
+ */
+static int detect_http(struct stats* st, struct sample_tally* t, const struct flow_key* key,
+    uint32_t seq, int tcp_close, const unsigned char* payload, int len, int verbose)
+{
+	int verdict;
+	if (!sample(t, key))
+	{
+		return 0;
+	}
+	if (fcache_lookup(key, &verdict))
+	{
+		/* Already classified (and counted) */
+		if (tcp_close)
 		{
-			if (memmem_nocase(s + linestart, n - len, blacklist_domain, strlen(blacklist_domain)))
+			fcache_remove(key);
+		}
+	}
+	else if (reasm_segment(key, seq, tcp_close, (const char*) payload, len, get_time(),
+	        is_blacklist_req, &verdict))
+	{
+		if (!tcp_close)
+		{
+			fcache_insert(key, verdict);
+		}
+		if (verdict)
+		{
+			blacklist_violation(st, t->shift, verbose);
+			return DETECT_BLACKLIST;
+		}
+	}
+	return 0;
+}
+
+/**
+ * BLACKLISTED TLS SERVER NAME DETECTION
+ * Only the first data segment of each flow is parsed for a ClientHello,
+ * the flow cache then marks the flow as done.
+ * @return
+ *		DETECT_BLACKLIST if the server name is blacklisted
+ *		0 otherwise.
+ */
+static int detect_tls(struct stats* st, struct sample_tally* t, const struct flow_key* key,
+    int tcp_close, const unsigned char* payload, int len, int verbose)
+{
+	int verdict;
+	if (!sample(t, key))
+	{
+		return 0;
+	}
+	if (fcache_lookup(key, &verdict))
+	{
+		if (tcp_close)
+		{
+			fcache_remove(key);
+		}
+	}
+	else if (len > 0)
+	{
+		const char* sni;
+		int sni_len;
+		verdict = tls_client_hello_sni(payload, len, &sni, &sni_len)
+		    && is_blacklisted_domain(sni, sni_len);
+		if (!tcp_close)
+		{
+			fcache_insert(key, verdict);
+		}
+		if (verdict)
+		{
+			blacklist_violation(st, t->shift, verbose);
+			return DETECT_BLACKLIST;
+		}
+	}
+	return 0;
+}
+
+/**
+ * BLACKLISTED DNS QUERY DETECTION
+ * The QNAME is matched in wire format straight from the packet buffer.
+ * @return
+ *		DETECT_DNS if the query is for a blacklisted domain
+ *		0 otherwise.
+ */
+static int detect_dns(struct stats* st, struct sample_tally* t, const struct flow_key* key,
+    const unsigned char* payload, int len, int verbose)
+{
+	int qlen;
+	if (!sample(t, key))
+	{
+		return 0;
+	}
+	int qname = dns_query_qname(payload, len, &qlen);
+	if (qname < 0)
+	{
+		return 0;
+	}
+	char domain[DINDEX_NAME_MAX + 1];
+	if (!blacklist_count_qname(payload + qname, qlen, domain, sizeof(domain)))
+	{
+		return 0;
+	}
+	if (show_detections || verbose)
+	{
+		printf("BLACKLISTED DNS QUERY DETECTED: %s\n", domain);
+	}
+	prof_lock(&st->blacklist_mutex, PROF_LOCK_BLACKLIST);
+	++st->total_dns_viol;
+	st->est_dns_viol += 1UL << t->shift;
+	pthread_mutex_unlock(&st->blacklist_mutex);
+	return DETECT_DNS;
+}
+
+/**
+ * Count n ARP packets.
+ */
+static void arp_count(struct stats* st, int n, int verbose)
+{
+	if (show_detections || verbose)
+	{
+		int i;
+		for (i = 0; i < n; ++i)
+		{
+			puts("ARP packet detected");
+		}
+	}
+	prof_lock(&st->arp_mutex, PROF_LOCK_ARP);
+	st->total_arp_packets += n;
+	pthread_mutex_unlock(&st->arp_mutex);
+}
+
+/* State shared by the detectors over one analyse or analyse_batch call */
+struct run
+{
+	/* Statistics of the current epoch, held until the end so that the
+	 * epoch cannot be swapped out from under the packets */
+	struct stats* st;
+	struct sample_tally tally;
+	struct flood_tally floods;
+	long long now; /* get_time() of the call, 0 until a detector needs it */
+	int verbose;
+};
+
+static long long run_now(struct run* r)
+{
+	if (!r->now)
+	{
+		r->now = get_time();
+	}
+	return r->now;
+}
+
+/* Headers of a frame, as handed to detectors by analyse. Fields of
+ * layers the frame does not have are 0; addresses and ports are in host
+ * byte order, the addresses of an IPv6 frame are their addr6_digest. */
+struct frame
+{
+	struct run* run;
+	const unsigned char* data;
+	int len; /* Captured bytes */
+	long long ts;
+	int v6;
+	struct addr6 src6; /* IPv6 only */
+	uint32_t src, dst;
+	uint8_t proto, tcp_flags;
+	uint16_t sport, dport;
+	uint32_t seq;
+	int allowed; /* SYN from an allowlisted network */
+	const unsigned char* payload;
+	int payload_len; /* Within the captured bytes */
+};
+
+/* A decoded batch, as handed to detectors by analyse_batch */
+struct batch
+{
+	struct run* run;
+	const unsigned char* const* frames;
+	const long long* ts;
+	const struct decoded_batch* b;
+	int* detected; /* DETECT_ flags of each frame */
+};
+
+/* SYN FLOODING DETECT */
+static int syn_frame(struct frame* f)
+{
+	if (f->tcp_flags == TH_SYN && !f->allowed)
+	{
+		long long now = run_now(f->run);
+		syn_count(f->run->st, 1, now, f->run->verbose);
+		if (f->v6)
+		{
+			syn_source6(f->run->st, &f->src6, now, f->run->verbose);
+		}
+		else
+		{
+			syn_source(f->run->st, f->src, now, f->run->verbose);
+		}
+	}
+	return 0;
+}
+
+static void syn_lanes(struct batch* c)
+{
+	const struct decoded_batch* b = c->b;
+	if (!b->nlane[LANE_SYN] && !b->nlane[LANE_SYN6])
+	{
+		return;
+	}
+	long long now = run_now(c->run);
+	syn_count(c->run->st, b->nlane[LANE_SYN] + b->nlane[LANE_SYN6], now, 0);
+	int k;
+	for (k = 0; k < b->nlane[LANE_SYN]; ++k)
+	{
+		syn_source(c->run->st, b->src[b->lane[LANE_SYN][k]], now, 0);
+	}
+	for (k = 0; k < b->nlane[LANE_SYN6]; ++k)
+	{
+		struct addr6 src;
+		addr6_load(&src, c->frames[b->lane[LANE_SYN6][k]] + ETH_HLEN + 8);
+		syn_source6(c->run->st, &src, now, 0);
+	}
+}
+
+static int scan_frame(struct frame* f)
+{
+	if (f->tcp_flags != TH_SYN || f->allowed)
+	{
+		return 0;
+	}
+	return detect_scan(f->run->st, f->src, f->dst, f->dport, run_now(f->run), f->run->verbose);
+}
+
+static void scan_lanes(struct batch* c)
+{
+	const struct decoded_batch* b = c->b;
+	int k;
+	for (k = 0; k < b->nlane[LANE_SYN]; ++k)
+	{
+		int i = b->lane[LANE_SYN][k];
+		c->detected[i] |= detect_scan(c->run->st, b->src[i], b->dst[i], b->dport[i], run_now(c->run), 0);
+	}
+}
+
+static int http_frame(struct frame* f)
+{
+	const int tcp_close = f->tcp_flags & (TH_FIN | TH_RST);
+	if (f->payload_len == 0 && !tcp_close)
+	{
+		return 0;
+	}
+	struct flow_key key = {f->src, f->dst, f->sport, f->dport};
+	return detect_http(f->run->st, &f->run->tally, &key, f->seq, tcp_close,
+	    f->payload, f->payload_len, f->run->verbose);
+}
+
+static void http_lanes(struct batch* c)
+{
+	const struct decoded_batch* b = c->b;
+	int k;
+	for (k = 0; k < b->nlane[LANE_HTTP]; ++k)
+	{
+		int i = b->lane[LANE_HTTP][k];
+		struct flow_key key = {b->src[i], b->dst[i], b->sport[i], b->dport[i]};
+		c->detected[i] |= detect_http(c->run->st, &c->run->tally, &key, b->seq[i],
+		    b->tcp_flags[i] & (TH_FIN | TH_RST), c->frames[i] + b->payload_off[i], b->payload_len[i], 0);
+	}
+}
+
+static int tls_frame(struct frame* f)
+{
+	const int tcp_close = f->tcp_flags & (TH_FIN | TH_RST);
+	if (f->payload_len == 0 && !tcp_close)
+	{
+		return 0;
+	}
+	struct flow_key key = {f->src, f->dst, f->sport, f->dport};
+	return detect_tls(f->run->st, &f->run->tally, &key, tcp_close, f->payload, f->payload_len, f->run->verbose);
+}
+
+static void tls_lanes(struct batch* c)
+{
+	const struct decoded_batch* b = c->b;
+	int k;
+	for (k = 0; k < b->nlane[LANE_TLS]; ++k)
+	{
+		int i = b->lane[LANE_TLS][k];
+		struct flow_key key = {b->src[i], b->dst[i], b->sport[i], b->dport[i]};
+		c->detected[i] |= detect_tls(c->run->st, &c->run->tally, &key, b->tcp_flags[i] & (TH_FIN | TH_RST),
+		    c->frames[i] + b->payload_off[i], b->payload_len[i], 0);
+	}
+}
+
+static int dns_frame(struct frame* f)
+{
+	struct flow_key key = {f->src, f->dst, f->sport, f->dport};
+	return detect_dns(f->run->st, &f->run->tally, &key, f->payload, f->payload_len, f->run->verbose);
+}
+
+static void dns_lanes(struct batch* c)
+{
+	const struct decoded_batch* b = c->b;
+	int k;
+	for (k = 0; k < b->nlane[LANE_DNS]; ++k)
+	{
+		int i = b->lane[LANE_DNS][k];
+		struct flow_key key = {b->src[i], b->dst[i], b->sport[i], b->dport[i]};
+		c->detected[i] |= detect_dns(c->run->st, &c->run->tally, &key,
+		    c->frames[i] + b->payload_off[i], b->payload_len[i], 0);
+	}
+}
+
+static int flood_frame(struct frame* f)
+{
+	return detect_flood(&f->run->floods, f->proto, f->dst, f->ts, f->run->verbose);
+}
+
+static void udp_flood_lanes(struct batch* c)
+{
+	const struct decoded_batch* b = c->b;
+	int k;
+	for (k = 0; k < b->nlane[LANE_UDP]; ++k)
+	{
+		int i = b->lane[LANE_UDP][k];
+		c->detected[i] |= detect_flood(&c->run->floods, 0x11, b->dst[i], c->ts[i], 0);
+	}
+}
+
+static void icmp_flood_lanes(struct batch* c)
+{
+	const struct decoded_batch* b = c->b;
+	int k;
+	for (k = 0; k < b->nlane[LANE_ICMP]; ++k)
+	{
+		int i = b->lane[LANE_ICMP][k];
+		c->detected[i] |= detect_flood(&c->run->floods, 0x01, b->dst[i], c->ts[i], 0);
+	}
+}
+
+static int arp_frame(struct frame* f)
+{
+	arp_count(f->run->st, 1, f->run->verbose);
+	return DETECT_ARP;
+}
+
+static void arp_lanes(struct batch* c)
+{
+	const struct decoded_batch* b = c->b;
+	if (!b->nlane[LANE_ARP])
+	{
+		return;
+	}
+	arp_count(c->run->st, b->nlane[LANE_ARP], 0);
+	int k;
+	for (k = 0; k < b->nlane[LANE_ARP]; ++k)
+	{
+		c->detected[b->lane[LANE_ARP][k]] |= DETECT_ARP;
+	}
+}
+
+#define FAMILY_IPV4 0x1
+#define FAMILY_IPV6 0x2
+#define ANY_PORT -1
+#define LANE(l) (1u << (l))
+
+/**
+ * A detector and what it registers for: an EtherType, or an IP protocol
+ * over some IP versions and optionally a destination port. Each has a
+ * function for single frames (analyse) and one going over its lanes of
+ * a decoded batch (analyse_batch).
+ */
+struct detector
+{
+	const char* name; /* As given to -x */
+	const char* what;
+	uint16_t ethertype; /* 0 for detectors above IP */
+	uint8_t proto; /* IP protocol */
+	uint8_t families; /* FAMILY_ flags */
+	int port; /* Destination port, or ANY_PORT */
+	unsigned lanes; /* LANE() of the lanes the batch function reads */
+	int (*frame)(struct frame* f); /* Returns DETECT_ flags */
+	void (*batch)(struct batch* c);
+};
+
+/* Registry, frames go through detectors in this order */
+static const struct detector detectors[] = {
+	{"syn", "SYN packets and their sources, for SYN floods", 0, 0x06, FAMILY_IPV4 | FAMILY_IPV6, ANY_PORT,
+	    LANE(LANE_SYN) | LANE(LANE_SYN6), syn_frame, syn_lanes},
+	{"scan", "Port and host scans", 0, 0x06, FAMILY_IPV4, ANY_PORT,
+	    LANE(LANE_SYN), scan_frame, scan_lanes},
+	{"http", "HTTP requests for blacklisted hosts", 0, 0x06, FAMILY_IPV4 | FAMILY_IPV6, 80,
+	    LANE(LANE_HTTP), http_frame, http_lanes},
+	{"tls", "TLS ClientHellos for blacklisted server names", 0, 0x06, FAMILY_IPV4 | FAMILY_IPV6, 443,
+	    LANE(LANE_TLS), tls_frame, tls_lanes},
+	{"dns", "DNS queries for blacklisted domains", 0, 0x11, FAMILY_IPV4 | FAMILY_IPV6, 53,
+	    LANE(LANE_DNS), dns_frame, dns_lanes},
+	{"udp_flood", "UDP floods", 0, 0x11, FAMILY_IPV4, ANY_PORT,
+	    LANE(LANE_UDP), flood_frame, udp_flood_lanes},
+	{"icmp_flood", "ICMP floods", 0, 0x01, FAMILY_IPV4, ANY_PORT,
+	    LANE(LANE_ICMP), flood_frame, icmp_flood_lanes},
+	{"arp", "ARP packets", 0x0806, 0, 0, ANY_PORT,
+	    LANE(LANE_ARP), arp_frame, arp_lanes},
+};
+#define DETECTORS ((int) (sizeof(detectors) / sizeof(detectors[0])))
+
+/* Detectors registered for the same key, as indices in detectors */
+#define HOOKS_MAX 7
+struct hooks
+{
+	uint8_t n;
+	uint8_t d[HOOKS_MAX];
+};
+
+/* Enabled detectors, set up by analysis_init: per IP version (IPv6
+ * second) and protocol, and in registry order for batches */
+static struct hooks ip_hooks[2][256];
+static uint8_t enabled[DETECTORS];
+static int nenabled = 0;
+
+static void hooks_add(struct hooks* h, int detector)
+{
+	if (h->n < HOOKS_MAX)
+	{
+		h->d[h->n++] = detector;
+	}
+	else
+	{
+		fprintf(stderr, "[WARNING] Too many detectors on one protocol, %s left out\n", detectors[detector].name);
+	}
+}
+
+/**
+ * Run the detectors registered for the protocol of a frame. f has its
+ * IP fields set, the upper layer header is decoded here.
+ * @arg off
+ *		Offset of the upper layer header in the frame
+ * @arg l4_len
+ *		Length of the upper layer header and payload, from the IP header
+ * @return
+ *		The DETECT_ flags of the detections the frame triggered
+ */
+static int analyse_l4(struct frame* f, int off, int l4_len)
+{
+	const struct hooks* h = &ip_hooks[f->v6][f->proto];
+	const int verbose = f->run->verbose;
+	if (!h->n && !show_tcp && !show_udp && !verbose)
+	{
+		return 0;
+	}
+	const unsigned char* l4 = f->data + off;
+	if (f->proto == 0x06) /* TCP */
+	{
+		if (f->len < off + 20)
+		{
+			return 0;
+		}
+		/* BEGIN TCP DATA */
+		const struct tcphdr* tcp_header = (const struct tcphdr*) l4;
+		f->sport = ntohs(tcp_header->source);
+		f->dport = ntohs(tcp_header->dest);
+		f->seq = ntohl(tcp_header->seq);
+		f->tcp_flags = tcp_header->th_flags;
+		if (show_tcp || verbose)
+		{
+			printf("TCP Src Port: %hu\n", f->sport);
+			printf("TCP Dest Port: %hu\n", f->dport);
+			printf("TCP Flags: ");
+			if (tcp_header->syn)
 			{
-				/* Domain is blacklisted */
-				return 1;
+				printf("SYN ");
 			}
-			/* Return since domain is not blacklisted */
-			break;
+			if (tcp_header->fin)
+			{
+				printf("FIN ");
+			}
+			if (tcp_header->rst)
+			{
+				printf("RST ");
+			}
+			if (tcp_header->psh)
+			{
+				printf("PSH ");
+			}
+			if (tcp_header->ack)
+			{
+				printf("ACK ");
+			}
+			if (tcp_header->urg)
+			{
+				printf("URG");
+			}
+			puts("");
+		}
+		if (f->tcp_flags == TH_SYN && allowlist_active()
+		    && (f->v6 ? allowlist_has6(&f->src6) : allowlist_has(f->src)))
+		{
+			/* Trusted, the SYN detectors and their mutexes are skipped */
+			f->allowed = 1;
+			atomic_fetch_add(&f->run->st->allowed_syn_packets, 1);
+		}
+		const int tcp_hdr_len = tcp_header->doff * 4;
+		f->payload = l4 + tcp_hdr_len;
+		f->payload_len = l4_len - tcp_hdr_len;
+		/* END TCP DATA */
+	}
+	else if (f->proto == 0x11) /* UDP */
+	{
+		if (f->len < off + 8)
+		{
+			return 0;
+		}
+		/* BEGIN UDP DATA */
+		const struct udphdr* udp_header = (const struct udphdr*) l4;
+		f->sport = ntohs(udp_header->source);
+		f->dport = ntohs(udp_header->dest);
+		if (show_udp || verbose)
+		{
+			printf("UDP Src Port: %hu\n", f->sport);
+			printf("UDP Dest Port: %hu\n", f->dport);
+			printf("UDP Len: %hu\n", ntohs(udp_header->len));
+		}
+		f->payload = l4 + sizeof(struct udphdr);
+		f->payload_len = ntohs(udp_header->len) - (int) sizeof(struct udphdr);
+		/* END UDP DATA */
+	}
+	else if (f->proto != 0x01 && !f->v6 && verbose)
+	{
+		fprintf(stderr, "=== UNKNOWN/UNIMPLEMENTED IP Protocol 0x%hhx ===\n", f->proto);
+	}
+	if (f->payload)
+	{
+		/* Never read past what was captured */
+		if (f->payload_len > f->len - (f->payload - f->data))
+		{
+			f->payload_len = f->len - (f->payload - f->data);
+		}
+		if (f->payload_len < 0)
+		{
+			f->payload_len = 0;
 		}
-		linestart = next_nl + 1;
 	}
+
+	int detected = 0;
+	int i;
+	for (i = 0; i < h->n; ++i)
+	{
+		const struct detector* d = detectors + h->d[i];
+		if (d->port == ANY_PORT || d->port == f->dport)
+		{
+			detected |= d->frame(f);
+		}
+	}
+	return detected;
+}
+
+static int analyse_ipv4(struct frame* f)
+{
+	if (f->len < ETH_HLEN + 20)
+	{
+		return 0;
+	}
+	/* BEGIN IP DATA */
+	const struct ip *ipv4_header = (const struct ip*) (f->data + ETH_HLEN);
+	f->proto = ipv4_header->ip_p;
+	f->src = ntohl(ipv4_header->ip_src.s_addr);
+	f->dst = ntohl(ipv4_header->ip_dst.s_addr);
+	if (show_ipv4 || f->run->verbose)
+	{
+		printf("IP Ver: %hhu\n", ipv4_header->ip_v);
+		printf("IP Header Len: %hhu (32 bit words)\n", ipv4_header->ip_hl);
+		printf("IP Type of Service: %hhu\n", ipv4_header->ip_tos);
+		printf("IP Len: %hu\n", ntohs(ipv4_header->ip_len));
+		printf("IP Protocol: %hhu\n", ipv4_header->ip_p);
+		printf("IP Src Addr: "); print_inet_addr(f->src); puts("");
+		printf("IP Dst Addr: "); print_inet_addr(f->dst); puts("");
+	}
+	const int ihl = ipv4_header->ip_hl * 4;
+	if (ihl < 20 || f->len < ETH_HLEN + ihl)
+	{
+		/* Refused by decode_batch too, both paths must agree */
+		return 0;
+	}
+	/* END IP DATA */
+	return analyse_l4(f, ETH_HLEN + ihl, ntohs(ipv4_header->ip_len) - ihl);
+}
+
+/* Extension headers are skipped */
+static int analyse_ipv6(struct frame* f)
+{
+	const unsigned char* eth_payload = f->data + ETH_HLEN;
+	/* BEGIN IPV6 DATA */
+	int l4 = decode_ipv6(eth_payload, f->len - ETH_HLEN, &f->proto);
+	if (l4 < 0)
+	{
+		/* Headers not captured, or a later fragment */
+		return 0;
+	}
+	f->v6 = 1;
+	struct addr6 dst6;
+	addr6_load(&f->src6, eth_payload + 8);
+	addr6_load(&dst6, eth_payload + 24);
+	int ip_payload_len = 40 + (eth_payload[4] << 8 | eth_payload[5]) - l4;
+	if (show_ipv6 || f->run->verbose)
+	{
+		printf("IPv6 Payload Len: %d\n", ip_payload_len);
+		printf("IPv6 Next Header: %hhu\n", f->proto);
+		printf("IPv6 Src Addr: "); print_inet6_addr(&f->src6); puts("");
+		printf("IPv6 Dst Addr: "); print_inet6_addr(&dst6); puts("");
+	}
+	/* Flow keys hold digests of IPv6 addresses */
+	f->src = addr6_digest(&f->src6);
+	f->dst = addr6_digest(&dst6);
+	/* END IPV6 DATA */
+	return analyse_l4(f, ETH_HLEN + l4, ip_payload_len);
+}
+
+static int analyse_arp(struct frame* f)
+{
+	/* BEGIN ARP DATA */
+	const struct ether_arp *arp_data = (const struct ether_arp*) (f->data + ETH_HLEN);
+	if ((show_arp || f->run->verbose) && f->len >= ETH_HLEN + (int) sizeof(struct arphdr))
+	{
+		printf("ARP HTYPE: 0x%hx\n", ntohs(arp_data->ea_hdr.ar_hrd));
+		printf("ARP PTYPE: 0x%hx\n", ntohs(arp_data->ea_hdr.ar_pro));
+		printf("ARP HLEN: %hhu\n", arp_data->ea_hdr.ar_hln);
+		printf("ARP PLEN: %hhu\n", arp_data->ea_hdr.ar_pln);
+		printf("ARP OPER: %hx\n", ntohs(arp_data->ea_hdr.ar_op));
+	}
+	/* END ARP DATA */
 	return 0;
 }
 
-void analyse(const unsigned char *packet, int verbose)
+/* Layers above Ethernet: decode prints the headers asked for and runs
+ * the detectors registered above IP */
+static const struct
+{
+	uint16_t ethertype;
+	int (*decode)(struct frame* f);
+} layers[] = {
+	{0x0800, analyse_ipv4},
+	{0x86DD, analyse_ipv6},
+	{0x0806, analyse_arp},
+};
+#define LAYERS ((int) (sizeof(layers) / sizeof(layers[0])))
+
+/* Detectors registered for the EtherType of each layer */
+static struct hooks ether_hooks[LAYERS];
+/* Whether an enabled detector needs a layer decoded */
+static int layer_used[LAYERS];
+
+static int layer_index(uint16_t ethertype)
 {
+	int i;
+	for (i = 0; i < LAYERS; ++i)
+	{
+		if (layers[i].ethertype == ethertype)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+int analyse(const unsigned char *packet, int len, long long ts, int verbose)
+{
+	if (len < ETH_HLEN)
+	{
+		/* Replayed files may have any snaplen */
+		return 0;
+	}
 	/* BEGIN ETHERNET DATA */
 	struct ether_header *edata = (struct ether_header*) packet;
-	if (showether)
+	if (show_ether)
 	{
 		printf("Ether Src MAC: "); print_mac(edata->ether_shost); printf("\n");
 		printf("Ether Dest MAC: ");	print_mac(edata->ether_dhost); printf("\n");
 		printf("Ether Type: 0x%hx\n", ntohs(edata->ether_type));
 	}
 	unsigned short ethertype = ntohs(edata->ether_type);
-	const unsigned char* eth_payload = packet + ETH_HLEN;
 	/* END ETHERNET DATA */
 
 	if (ethertype < 1536)
 	{
-		/* Only EtherType >= 1536 is Ethernet II */
-		fprintf(stderr, "%s\n", "[ERROR] Received frame with unsupported Ethernet protocol (Ethernet II suppored only)\n");
-		exit(1);
+		/* Only EtherType >= 1536 is Ethernet II, the others are 802.3
+		 * frames of their length (STP, LLC), normal on a live network */
+		struct stats* st = stats_acquire();
+		atomic_fetch_add(&st->non_ethernet_frames, 1);
+		stats_release(st);
+		return 0;
 	}
-	
-	/* EtherTypes
-	 * 0x0800 IPv4
-	 * 0x0806 ARP
-	 * 0x86DD IPv6
-	 */
-	if (ethertype == 0x0800) /* IPv4 */
-	{
-		/* BEGIN IP DATA */
-		struct ip *ipv4_header = (struct ip*) eth_payload;
-		uint32_t src_ipa = ntohl(ipv4_header->ip_src.s_addr);
-		if (showipv4 || verbose)
-		{
-			printf("IP Ver: %hhu\n", ipv4_header->ip_v);
-			printf("IP Header Len: %hhu (32 bit words)\n", ipv4_header->ip_hl);
-			printf("IP Type of Service: %hhu\n", ipv4_header->ip_tos);
-			printf("IP Len: %hu\n", ntohs(ipv4_header->ip_len));
-			printf("IP Protocol: %hu\n", ntohs(ipv4_header->ip_p));
-			printf("IP Src Addr: "); print_inet_addr(src_ipa); puts("");
-			printf("IP Dst Addr: "); print_inet_addr(ntohl(ipv4_header->ip_dst.s_addr)); puts("");
-		}
-		const unsigned char *ip_payload = eth_payload + (ipv4_header->ip_hl * 4);
-		/* END IP DATA */
-
-		/* IP protool legend
-		 * 0x01 ICMP
-		 * 0x06 TCP
-		 * 0x11 UDP
-		 */
-		if (ipv4_header->ip_p == 0x06) /* TCP */
-		{
-			/* BEGIN TCP DATA */
-			struct tcphdr* tcp_header = (struct tcphdr*) ip_payload;
-			const int
-				tcp_src = ntohs(tcp_header->source),
-				tcp_dest = ntohs(tcp_header->dest);
-			if (showtcp || verbose)
+	int layer = layer_index(ethertype);
+	if (layer < 0)
+	{
+		if (verbose)
+		{
+			fprintf(stderr, "[WARNING] Packet received with unknown EtherType: 0x%hx", ethertype);
+		}
+		return 0;
+	}
+	if (!layer_used[layer] && !debugging && !verbose)
+	{
+		/* No detector wants it */
+		return 0;
+	}
+
+	struct run run = {stats_acquire(), {sampling_shift(), 0, 0}, {0, 0, 0, 0}, 0, verbose};
+	struct frame f = {&run, packet, len, ts};
+	int detected = layers[layer].decode(&f);
+	const struct hooks* h = &ether_hooks[layer];
+	int i;
+	for (i = 0; i < h->n; ++i)
+	{
+		detected |= detectors[h->d[i]].frame(&f);
+	}
+	sample_tally_add(run.st, &run.tally);
+	flood_tally_add(run.st, &run.floods);
+	stats_release(run.st);
+	return detected;
+}
+
+/**
+ * Take the frames of allowlisted sources out of the SYN lanes, before
+ * any SYN detector runs.
+ */
+static void allowlist_filter(struct decoded_batch* b, const unsigned char* const* frames, struct stats* st)
+{
+	int allowed = 0;
+	int k, w;
+	for (k = w = 0; k < b->nlane[LANE_SYN]; ++k)
+	{
+		int i = b->lane[LANE_SYN][k];
+		if (allowlist_has(b->src[i]))
+		{
+			++allowed;
+			continue;
+		}
+		b->lane[LANE_SYN][w++] = i;
+	}
+	b->nlane[LANE_SYN] = w;
+	for (k = w = 0; k < b->nlane[LANE_SYN6]; ++k)
+	{
+		int i = b->lane[LANE_SYN6][k];
+		struct addr6 src;
+		addr6_load(&src, frames[i] + ETH_HLEN + 8);
+		if (allowlist_has6(&src))
+		{
+			++allowed;
+			continue;
+		}
+		b->lane[LANE_SYN6][w++] = i;
+	}
+	b->nlane[LANE_SYN6] = w;
+	if (allowed)
+	{
+		atomic_fetch_add(&st->allowed_syn_packets, allowed);
+	}
+}
+
+void analyse_batch(const unsigned char* const* frames, const int* lens, const long long* ts, int n, int* detected)
+{
+	struct decoded_batch b;
+	prof_stage(PROF_DECODE);
+	decode_batch(frames, lens, n, &b);
+	prof_stage(PROF_DETECT);
+	memset(detected, 0, n * sizeof(int));
+
+	struct run run = {stats_acquire(), {sampling_shift(), 0, 0}, {0, 0, 0, 0}, 0, 0};
+	if (b.nlane[LANE_BAD])
+	{
+		/* Same as analyse, in no other lane */
+		atomic_fetch_add(&run.st->non_ethernet_frames, b.nlane[LANE_BAD]);
+	}
+	if (allowlist_active() && (b.nlane[LANE_SYN] || b.nlane[LANE_SYN6]))
+	{
+		allowlist_filter(&b, frames, run.st);
+	}
+	struct batch c = {&run, frames, ts, &b, detected};
+	int i;
+	for (i = 0; i < nenabled; ++i)
+	{
+		detectors[enabled[i]].batch(&c);
+	}
+	sample_tally_add(run.st, &run.tally);
+	flood_tally_add(run.st, &run.floods);
+	stats_release(run.st);
+}
+
+/**
+ * Call fn on each name of a comma separated list.
+ * @return
+ *		0 on success
+ *		-1 as soon as fn returns -1
+ */
+static int for_each_name(const char* list, int (*fn)(const char* name, int n))
+{
+	while (*list)
+	{
+		int n = strcspn(list, ",");
+		if (n && fn(list, n) != 0)
+		{
+			return -1;
+		}
+		list += n;
+		if (*list == ',')
+		{
+			++list;
+		}
+	}
+	return 0;
+}
+
+static int disabled[DETECTORS];
+
+static int disable_detector(const char* name, int n)
+{
+	int i;
+	for (i = 0; i < DETECTORS; ++i)
+	{
+		if ((int) strlen(detectors[i].name) == n && strncmp(detectors[i].name, name, n) == 0)
+		{
+			disabled[i] = 1;
+			return 0;
+		}
+	}
+	fprintf(stderr, "[ERROR] Unknown detector %.*s (-x list to list them)\n", n, name);
+	return -1;
+}
+
+/* Destination port of the TCP segments that go through reassembly, 0
+ * if the detector reassembling them is disabled */
+static int reassembled_port = 0;
+
+int analysis_reassembled_port(void)
+{
+	return reassembled_port;
+}
+
+int analysis_init(const char* disable)
+{
+	if (disable && for_each_name(disable, disable_detector) != 0)
+	{
+		return -1;
+	}
+	int i;
+	for (i = 0; i < DETECTORS; ++i)
+	{
+		const struct detector* d = detectors + i;
+		if (disabled[i])
+		{
+			continue;
+		}
+		if (d->ethertype)
+		{
+			int layer = layer_index(d->ethertype);
+			hooks_add(&ether_hooks[layer], i);
+			layer_used[layer] = 1;
+		}
+		else
+		{
+			if (d->families & FAMILY_IPV4)
 			{
-				printf("TCP Src Port: %hu\n", tcp_src);
-				printf("TCP Dest Port: %hu\n", tcp_dest);
-				printf("TCP Flags: ");
-				if (tcp_header->syn)
-				{
-					printf("SYN ");
-				}
-				if (tcp_header->fin)
-				{
-					printf("FIN ");
-				}
-				if (tcp_header->rst)
-				{
-					printf("RST ");
-				}
-				if (tcp_header->psh)
-				{
-					printf("PSH ");
-				}
-				if (tcp_header->ack)
-				{
-					printf("ACK ");
-				}
-				if (tcp_header->urg)
-				{
-					printf("URG");
-				}
-				puts("");
+				hooks_add(&ip_hooks[0][d->proto], i);
+				layer_used[layer_index(0x0800)] = 1;
 			}
-			const int
-				tcp_hdr_len = tcp_header->doff * 4,
-				tcp_payload_len = ntohs(ipv4_header->ip_len) - (ipv4_header->ip_hl * 4) - tcp_hdr_len;
-			const unsigned char *tcp_payload = ip_payload + tcp_hdr_len;
-			/* END TCP DATA */
-
-			/* SYN FLOODING DETECT */
-			if (is_syn_packet(tcp_header))
+			if (d->families & FAMILY_IPV6)
 			{
-				if (show_detections || verbose)
-				{
-					puts("SYN PACKET RECEIVED");
-				}
-				pthread_mutex_lock(&syn_mutex);
-				last_syn_time = get_time();
-				if (!total_syn_packets)
-				{
-					first_syn_time = last_syn_time;
-				}
-				++total_syn_packets;
-				if (ip_set_add(&unique_ips, src_ipa) && (show_detections || verbose))
-				{
-					printf("/!\\ New SYN Src IP: "); print_inet_addr(src_ipa); puts("");
-				}
-				pthread_mutex_unlock(&syn_mutex);
+				hooks_add(&ip_hooks[1][d->proto], i);
+				layer_used[layer_index(0x86DD)] = 1;
 			}
-
-			/* BLACKLISTED URL DETECTION */
-			if (tcp_dest == 80 && is_blacklist_req((char*) tcp_payload, tcp_payload_len))
+		}
+		int lane;
+		for (lane = 0; lane < DECODE_LANES; ++lane)
+		{
+			if (d->lanes & LANE(lane))
 			{
-				if (show_detections || verbose)
-				{
-					puts("BLACKLISTED DOMAIN DETECTED");
-				}
-				pthread_mutex_lock(&blacklist_mutex);
-				++total_blacklist_viol;
-				pthread_mutex_unlock(&blacklist_mutex);
+				decode_route(lane, d->port);
 			}
 		}
-		else if (verbose)
+		if (d->lanes & LANE(LANE_HTTP))
 		{
-			fprintf(stderr, "=== UNKNOWN/UNIMPLEMENTED IP Protocol 0x%hhx ===\n", ipv4_header->ip_p);
+			reassembled_port = d->port;
 		}
+		enabled[nenabled++] = i;
 	}
-	else if (ethertype == 0x0806) /* ARP */
+	return 0;
+}
+
+void analysis_list_detectors(FILE* f)
+{
+	int i;
+	for (i = 0; i < DETECTORS; ++i)
 	{
-		/* BEGIN ARP DATA */
-		struct ether_arp *arp_data = (struct ether_arp*) eth_payload;
-		if (showarp || verbose)
-		{
-			printf("ARP HTYPE: 0x%hx\n", ntohs(arp_data->ea_hdr.ar_hrd));
-			printf("ARP PTYPE: 0x%hx\n", ntohs(arp_data->ea_hdr.ar_pro));
-			printf("ARP HLEN: %hhu\n", arp_data->ea_hdr.ar_hln);
-			printf("ARP PLEN: %hhu\n", arp_data->ea_hdr.ar_pln);
-			printf("ARP OPER: %hx\n", ntohs(arp_data->ea_hdr.ar_op));
-		}
-		/* END ARP DATA */
+		fprintf(f, "%-12s%s\n", detectors[i].name, detectors[i].what);
+	}
+}
+
+/* Layers whose headers -D prints */
+static const struct
+{
+	const char* name;
+	int* show;
+} debug_layers[] = {
+	{"ether", &show_ether},
+	{"arp", &show_arp},
+	{"ipv4", &show_ipv4},
+	{"ipv6", &show_ipv6},
+	{"tcp", &show_tcp},
+	{"udp", &show_udp},
+};
 
-		if (show_detections || verbose)
+static int debug_layer(const char* name, int n)
+{
+	int i;
+	for (i = 0; i < (int) (sizeof(debug_layers) / sizeof(debug_layers[0])); ++i)
+	{
+		if ((int) strlen(debug_layers[i].name) == n && strncmp(debug_layers[i].name, name, n) == 0)
 		{
-			puts("ARP packet detected");
+			*debug_layers[i].show = 1;
+			debugging = 1;
+			return 0;
 		}
-		pthread_mutex_lock(&arp_mutex);
-		++total_arp_packets;
-		pthread_mutex_unlock(&arp_mutex);
-	}
-	else if (verbose)
-	{
-		fprintf(stderr, "[WARNING] Packet received with unknown EtherType: 0x%hx", ethertype);
 	}
+	fprintf(stderr, "[ERROR] Unknown layer %.*s\n", n, name);
+	return -1;
+}
 
-/*
-	puts("\nDUMP FOLLOWS\n----------------------");
-	dump(packet, header->caplen);
-	puts("DUMP END\n");
-*/
-	/*puts("\n");*/
+int analysis_debug(const char* list)
+{
+	return for_each_name(list, debug_layer);
+}
+
+int analysis_debugging(void)
+{
+	return debugging;
 }
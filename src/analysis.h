@@ -7,12 +7,26 @@
 #include <netinet/tcp.h>		/* tcphdr */
 #include <netinet/udp.h>		/* udphdr */
 #include <netinet/in.h>			/* net to host byte order (ntohs and friends) */
+#include <arpa/inet.h>			/* inet_ntop */
 #include <pcap.h>
 #include <string.h>				/* strcasestr, memcpy */
 #include <ctype.h> /* tolower */
 #include <pthread.h>			/* pthread_mutex_t */
 
-#include "ip_set.h"				/* struct ip_set */
+#include "stats.h"				/* struct stats */
+#include "src_table.h"			/* struct src_table */
+#include "scan_table.h"			/* struct scan_table */
+#include "rate_table.h"			/* struct rate_table */
+#include "reassembly.h"			/* reasm_segment */
+#include "flow_cache.h"			/* fcache_lookup */
+#include "blacklist.h"			/* is_blacklisted_domain */
+#include "tls.h"				/* tls_client_hello_sni */
+#include "dns.h"				/* dns_query_qname */
+#include "decode.h"				/* decode_batch */
+#include "sampling.h"			/* sampling_keep */
+#include "addr6.h"				/* struct addr6 */
+#include "allowlist.h"			/* allowlist_has */
+#include "profile.h"				/* prof_lock */
 
 /** 
  * In: 32 bit (uint32_t) int (host byte ordering)
@@ -20,6 +34,11 @@
  */
 void print_inet_addr(uint32_t);
 
+/**
+ * Print an IPv6 address in its compressed text form.
+ */
+void print_inet6_addr(const struct addr6*);
+
 /**
  *	In: Takes an array of 6 bytes (unsigned char)
  *	Out: Prints MAC address in hexadecimal, no new line, colon (:) as byte separator.
@@ -33,6 +52,89 @@ void print_mac(const unsigned char*);
  */
 int is_syn_packet(struct tcphdr* tcp_h);
 
-void analyse(const unsigned char*, int);
+/* Detections a frame can trigger, as returned by analyse. SYN packets
+ * are only counted, a flood is judged over the whole epoch. */
+#define DETECT_BLACKLIST 0x1 /* HTTP Host or TLS server name */
+#define DETECT_DNS 0x2
+#define DETECT_ARP 0x4
+#define DETECT_SCAN 0x8 /* First SYN past a port or host scan threshold */
+#define DETECT_FLOOD 0x10 /* First UDP or ICMP packet over its destination's rate */
+
+/**
+ * Set up the detector registry: frames are dispatched on EtherType, IP
+ * protocol and destination port to the detectors registered for them,
+ * disabled detectors are left out of every table. Must be called before
+ * any frame is analysed.
+ * @arg disable
+ *		Comma separated names of the detectors to disable, or NULL
+ * @return
+ *		0 on success
+ *		-1 if a name is not a detector, after printing why
+ */
+int analysis_init(const char* disable);
+
+/**
+ * @return
+ *		Destination port of the TCP segments the enabled detectors
+ *		reassemble, whose order matters (see DISPATCH_RR)
+ *		0 if none are.
+ */
+int analysis_reassembled_port(void);
+
+/**
+ * Print the name and purpose of every detector, one per line.
+ */
+void analysis_list_detectors(FILE* f);
+
+/**
+ * Print decoded headers of the given layers for every frame.
+ * @arg layers
+ *		Comma separated, of ether, arp, ipv4, ipv6, tcp and udp
+ * @return
+ *		0 on success
+ *		-1 if a name is not a layer, after printing why
+ */
+int analysis_debug(const char* layers);
+
+/**
+ * @return
+ *		1 if headers of some layer are printed (analysis_debug), which
+ *		only analyse does
+ *		0 otherwise.
+ */
+int analysis_debugging(void);
+
+/**
+ * Run the enabled detectors over one captured frame.
+ * @arg packet
+ *		The frame, starting at the Ethernet header
+ * @arg len
+ *		Number of captured bytes (caplen), nothing past it is read
+ * @arg ts
+ *		Capture time (micro seconds)
+ * @arg verbose
+ *		Non-zero to print every decoded header
+ * @return
+ *		The DETECT_ flags of the detections the frame triggered, 0 if none
+ */
+int analyse(const unsigned char* packet, int len, long long ts, int verbose);
+
+/**
+ * Run the enabled detectors over a batch of frames. The headers of the
+ * whole batch are decoded first (decode_batch), then each detector runs
+ * over the frames of its lanes only. Detects the same as calling analyse
+ * on each frame, without printing decoded headers.
+ * @arg frames
+ *		The frames, starting at the Ethernet header
+ * @arg lens
+ *		Captured length of each frame
+ * @arg ts
+ *		Capture time of each frame (micro seconds)
+ * @arg n
+ *		Number of frames, at most DECODE_BATCH_MAX
+ * @arg detected
+ *		Set to the DETECT_ flags of each frame
+ */
+void analyse_batch(const unsigned char* const* frames, const int* lens, const long long* ts, int n, int* detected);
 
 #endif
@@ -0,0 +1,427 @@
+#include "blacklist.h"
+/* Includes are in header file */
+
+/* Used without an index file (-b) */
+static const char* builtin_domains[] = {
+	"www.telegraph.co.uk",
+};
+#define BUILTIN_COUNT ((int) (sizeof(builtin_domains) / sizeof(builtin_domains[0])))
+
+/* Maximum labels in a wire format name (255 bytes, 2 per label) */
+#define MAX_LABELS 128
+
+/**
+ * One loaded index. Readers hold it between blacklist_acquire and
+ * blacklist_release; a reload makes a new one current and frees the old
+ * one once the readers that may have seen it are gone.
+ */
+struct blacklist
+{
+	struct dindex index;
+	void* base;
+	size_t size;
+	int mapped; /* base is mapped from a file, else allocated */
+	atomic_ulong* queries; /* DNS queries per domain id */
+};
+
+static struct blacklist* _Atomic current;
+/* Readers are counted in readers[phase] before they load current, a
+ * count kept in the index itself would be reached through a pointer
+ * that may be freed already. A reload flips the phase and waits for the
+ * readers of the previous one, the only ones that may hold the old
+ * index; new readers count in the other phase so they cannot keep the
+ * reload waiting. */
+static atomic_int readers[2];
+static atomic_int phase;
+/* Resources mutexed: reloads of current */
+static pthread_mutex_t reload_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t reloader;
+static int reloader_started = 0;
+static atomic_int reloader_stop;
+static const char* reloader_path;
+
+static void blacklist_free(struct blacklist* bl)
+{
+	/* The header is gone with the mapping */
+	mem_free(MEM_BLACKLIST, bl->queries, (bl->index.h->ndomains + 1) * sizeof(atomic_ulong));
+	if (bl->mapped)
+	{
+		munmap(bl->base, bl->size);
+	}
+	else
+	{
+		free(bl->base);
+	}
+	free(bl);
+}
+
+/**
+ * Load an index, from path or the built in list if path is NULL.
+ * @return
+ *		The index, not yet current
+ *		NULL if it cannot be used, after printing why
+ */
+static struct blacklist* blacklist_load(const char* path)
+{
+	struct blacklist* bl = calloc(1, sizeof(*bl));
+	if (!bl)
+	{
+		fprintf(stderr, "%s\n", "[WARNING] Failed to load blacklist (memory allocation error)");
+		return NULL;
+	}
+	if (!path)
+	{
+		bl->base = dindex_build(builtin_domains, BUILTIN_COUNT, &bl->size);
+		if (!bl->base)
+		{
+			fprintf(stderr, "%s\n", "[WARNING] Failed to load blacklist (memory allocation error)");
+			free(bl);
+			return NULL;
+		}
+	}
+	else
+	{
+		int fd = open(path, O_RDONLY);
+		struct stat sb;
+		if (fd < 0 || fstat(fd, &sb) != 0)
+		{
+			fprintf(stderr, "[WARNING] Cannot open domain index %s: %s\n", path, strerror(errno));
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+			free(bl);
+			return NULL;
+		}
+		bl->size = sb.st_size;
+		int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+		/* Fault it in now rather than on the first packets after the
+		 * swap */
+		flags |= MAP_POPULATE;
+#endif
+		bl->base = bl->size ? mmap(NULL, bl->size, PROT_READ, flags, fd, 0) : MAP_FAILED;
+		close(fd);
+		if (bl->base == MAP_FAILED)
+		{
+			fprintf(stderr, "[WARNING] Cannot map domain index %s: %s\n", path, strerror(errno));
+			free(bl);
+			return NULL;
+		}
+		bl->mapped = 1;
+	}
+	if (dindex_open(&bl->index, bl->base, bl->size, path ? path : "built in") != 0)
+	{
+		bl->mapped ? munmap(bl->base, bl->size) : free(bl->base);
+		free(bl);
+		return NULL;
+	}
+	/* One more so that an empty index allocates too */
+	size_t counts = (bl->index.h->ndomains + 1) * sizeof(atomic_ulong);
+	bl->queries = mem_try_alloc(MEM_BLACKLIST, counts);
+	if (!bl->queries)
+	{
+		fprintf(stderr, "%s\n", "[WARNING] Failed to load blacklist (memory budget or allocation error)");
+		bl->mapped ? munmap(bl->base, bl->size) : free(bl->base);
+		free(bl);
+		return NULL;
+	}
+	memset(bl->queries, 0, counts);
+	return bl;
+}
+
+/**
+ * Get the current index, valid until blacklist_release.
+ * @arg p
+ *		Set to the phase the reader is counted in, for blacklist_release
+ */
+static struct blacklist* blacklist_acquire(int* p)
+{
+	for (;;)
+	{
+		*p = atomic_load(&phase);
+		atomic_fetch_add(&readers[*p], 1);
+		if (*p == atomic_load(&phase))
+		{
+			/* Any reload from now on waits for this reader */
+			return atomic_load(&current);
+		}
+		/* Counted after a reload waited for the phase, retry in the
+		 * new one */
+		atomic_fetch_sub(&readers[*p], 1);
+	}
+}
+
+static void blacklist_release(int p)
+{
+	atomic_fetch_sub(&readers[p], 1);
+}
+
+int blacklist_init(const char* path)
+{
+	struct blacklist* bl = blacklist_load(path);
+	if (!bl)
+	{
+		return -1;
+	}
+	atomic_init(&current, bl);
+	return 0;
+}
+
+void blacklist_destroy(void)
+{
+	blacklist_free(atomic_load(&current));
+}
+
+/**
+ * Exact lookup of a normalized domain.
+ */
+static const struct dindex_slot* blacklist_lookup(const struct blacklist* bl, const char* domain)
+{
+	int n = strlen(domain);
+	const struct dindex_slot* s = dindex_find(&bl->index, dindex_hash(domain, n));
+	return s && strcmp(bl->index.names + s->name, domain) == 0 ? s : NULL;
+}
+
+int blacklist_reload(const char* path)
+{
+	pthread_mutex_lock(&reload_mutex);
+	struct blacklist* fresh = blacklist_load(path);
+	if (!fresh)
+	{
+		pthread_mutex_unlock(&reload_mutex);
+		fprintf(stderr, "%s\n", "[WARNING] Blacklist not reloaded, the previous one stays in use");
+		return -1;
+	}
+	struct blacklist* old = atomic_load(&current);
+	atomic_store(&current, fresh);
+	/* Readers counted from here on load fresh */
+	int p = atomic_fetch_xor(&phase, 1);
+	while (atomic_load(&readers[p]) > 0)
+	{
+		sched_yield();
+	}
+	/* Counts of the old index are final now */
+	uint32_t i;
+	for (i = 0; i < old->index.h->nslots; ++i)
+	{
+		const struct dindex_slot* s = old->index.slots + i;
+		unsigned long n = s->hash ? atomic_load(&old->queries[s->id]) : 0;
+		const struct dindex_slot* t = n ? blacklist_lookup(fresh, old->index.names + s->name) : NULL;
+		if (t)
+		{
+			atomic_fetch_add(&fresh->queries[t->id], n);
+		}
+	}
+	printf("Blacklist reloaded: %u domains, was %u\n", fresh->index.h->ndomains, old->index.h->ndomains);
+	blacklist_free(old);
+	pthread_mutex_unlock(&reload_mutex);
+	return 0;
+}
+
+/* Loop executed by the reloader thread */
+static void* reloader_loop(void* arg)
+{
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGHUP);
+	int sig;
+	while (!atomic_load(&reloader_stop))
+	{
+		if (sigwait(&set, &sig) == 0 && !atomic_load(&reloader_stop))
+		{
+			blacklist_reload(reloader_path);
+		}
+	}
+	return NULL;
+}
+
+void blacklist_start_reloader(const char* path)
+{
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGHUP);
+	/* Threads started from here on inherit the mask, only the
+	 * reloader takes SIGHUP out of sigwait */
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	reloader_path = path;
+	atomic_init(&reloader_stop, 0);
+	if (pthread_create(&reloader, NULL, &reloader_loop, NULL) != 0)
+	{
+		fprintf(stderr, "%s\n", "[ERROR] Failed to start blacklist reloader thread");
+		exit(1);
+	}
+	reloader_started = 1;
+}
+
+void blacklist_stop_reloader(void)
+{
+	if (!reloader_started)
+	{
+		return;
+	}
+	atomic_store(&reloader_stop, 1);
+	pthread_kill(reloader, SIGHUP);
+	pthread_join(reloader, NULL);
+	reloader_started = 0;
+}
+
+/**
+ * Whether the stored domain (lower case) is name, ignoring case.
+ */
+static int name_equals(const char* domain, const char* name, int n)
+{
+	int i;
+	for (i = 0; i < n; ++i)
+	{
+		if (domain[i] != dindex_lower(name[i]))
+		{
+			return 0;
+		}
+	}
+	return domain[n] == '\0';
+}
+
+int is_blacklisted_domain(const char* name, int n)
+{
+	/* Drop port and root label */
+	const char* colon = memchr(name, ':', n);
+	if (colon)
+	{
+		n = colon - name;
+	}
+	while (n > 0 && (name[n - 1] == '.' || name[n - 1] == ' ' || name[n - 1] == '\t'))
+	{
+		--n;
+	}
+
+	int p;
+	struct blacklist* bl = blacklist_acquire(&p);
+	int found = 0;
+	/* Every suffix starting a label, shortest first */
+	uint64_t h = DINDEX_HASH_INIT;
+	int i;
+	for (i = n - 1; i >= 0 && !found; --i)
+	{
+		h = dindex_step(h, name[i]);
+		if (i > 0 && name[i - 1] != '.')
+		{
+			continue;
+		}
+		uint64_t f = dindex_final(h);
+		const struct dindex_slot* s = dindex_maybe(&bl->index, f) ? dindex_find(&bl->index, f) : NULL;
+		found = s && name_equals(bl->index.names + s->name, name + i, n - i);
+	}
+	blacklist_release(p);
+	return found;
+}
+
+/**
+ * Whether the stored domain (lower case) is the wire format name made
+ * of the given labels, ignoring case.
+ */
+static int qname_equals(const char* domain, const unsigned char* qname, const int* labels, int nlabels)
+{
+	int l;
+	for (l = 0; l < nlabels; ++l)
+	{
+		if (l > 0 && *domain++ != '.')
+		{
+			return 0;
+		}
+		int len = qname[labels[l]];
+		int i;
+		for (i = 0; i < len; ++i)
+		{
+			if (domain[i] != dindex_lower(qname[labels[l] + 1 + i]))
+			{
+				return 0;
+			}
+		}
+		domain += len;
+	}
+	return *domain == '\0';
+}
+
+int blacklist_count_qname(const unsigned char* qname, int qlen, char* domain, int size)
+{
+	int labels[MAX_LABELS];
+	int nlabels = 0;
+	int i = 0;
+	while (i < qlen && qname[i] != 0 && nlabels < MAX_LABELS)
+	{
+		labels[nlabels++] = i;
+		i += 1 + qname[i];
+	}
+
+	int p;
+	struct blacklist* bl = blacklist_acquire(&p);
+	const struct dindex_slot* found = NULL;
+	/* Hashed as the dotted name would be, right to left */
+	uint64_t h = DINDEX_HASH_INIT;
+	int l;
+	for (l = nlabels - 1; l >= 0 && !found; --l)
+	{
+		if (l < nlabels - 1)
+		{
+			h = dindex_step(h, '.');
+		}
+		const unsigned char* label = qname + labels[l] + 1;
+		for (i = qname[labels[l]] - 1; i >= 0; --i)
+		{
+			h = dindex_step(h, label[i]);
+		}
+		uint64_t f = dindex_final(h);
+		const struct dindex_slot* s = dindex_maybe(&bl->index, f) ? dindex_find(&bl->index, f) : NULL;
+		if (s && qname_equals(bl->index.names + s->name, qname, labels + l, nlabels - l))
+		{
+			found = s;
+		}
+	}
+	if (found)
+	{
+		atomic_fetch_add_explicit(&bl->queries[found->id], 1, memory_order_relaxed);
+		snprintf(domain, size, "%s", bl->index.names + found->name);
+	}
+	blacklist_release(p);
+	return found != NULL;
+}
+
+void blacklist_restore_queries(const char* domain, unsigned long n)
+{
+	int p;
+	struct blacklist* bl = blacklist_acquire(&p);
+	const struct dindex_slot* s = blacklist_lookup(bl, domain);
+	if (s)
+	{
+		atomic_fetch_add(&bl->queries[s->id], n);
+	}
+	blacklist_release(p);
+}
+
+int blacklist_size(void)
+{
+	int p;
+	struct blacklist* bl = blacklist_acquire(&p);
+	int n = bl->index.h->ndomains;
+	blacklist_release(p);
+	return n;
+}
+
+void blacklist_query_counts(blacklist_count_fn fn, void* arg)
+{
+	int p;
+	struct blacklist* bl = blacklist_acquire(&p);
+	uint32_t i;
+	for (i = 0; i < bl->index.h->nslots; ++i)
+	{
+		const struct dindex_slot* s = bl->index.slots + i;
+		unsigned long n = s->hash ? atomic_load_explicit(&bl->queries[s->id], memory_order_relaxed) : 0;
+		if (n)
+		{
+			fn(bl->index.names + s->name, n, arg);
+		}
+	}
+	blacklist_release(p);
+}
@@ -0,0 +1,114 @@
+#ifndef CS241_BLACKLIST_H
+#define CS241_BLACKLIST_H
+
+#include <stdio.h> /* fprintf */
+#include <string.h> /* strlen, memchr */
+#include <strings.h> /* strncasecmp */
+#include <pthread.h> /* pthread_t */
+#include <signal.h> /* sigwait */
+#include <sched.h> /* sched_yield */
+#include <stdatomic.h> /* atomic_int */
+#include <fcntl.h> /* open */
+#include <unistd.h> /* close */
+#include <sys/mman.h> /* mmap */
+#include <sys/stat.h> /* fstat */
+#include "domain_index.h"
+#include "mem.h" /* mem_try_alloc */
+
+/**
+ * Load the blacklist. Must be called before any other blacklist_
+ * function.
+ * @arg path
+ *		Domain index built by idsindex, mapped in place; NULL for the
+ *		built in list
+ * @return
+ *		0 on success
+ *		-1 if the index cannot be used, after printing why
+ */
+int blacklist_init(const char* path);
+
+/**
+ * Free all resources of the blacklist.
+ */
+void blacklist_destroy(void);
+
+/**
+ * Replace the blacklist with the index at path. Lookups in progress
+ * finish on the old index and new ones use the new index at once, no
+ * lookup waits and none sees a partly loaded index. The old index is
+ * released once no lookup uses it anymore, its DNS query counts are
+ * carried over to the domains still listed.
+ * @return
+ *		0 on success
+ *		-1 if the index cannot be used, the old one is kept
+ */
+int blacklist_reload(const char* path);
+
+/**
+ * Start a thread that reloads the index at path on SIGHUP. SIGHUP is
+ * blocked in the calling thread, so call this before starting any other
+ * thread for them all to leave the signal to the reloader.
+ */
+void blacklist_start_reloader(const char* path);
+
+/**
+ * Stop the reloader thread, if started.
+ */
+void blacklist_stop_reloader(void);
+
+/**
+ * Checks a domain name against the blacklist. The name is matched
+ * ignoring case, a blacklisted domain also matches its subdomains.
+ * A trailing port (":80") or root dot is ignored.
+ * @arg name
+ *		The domain name, not null terminated
+ * @arg n
+ *		Length of name
+ * @return
+ *		1 iff the domain is blacklisted
+ *		0 otherwise.
+ */
+int is_blacklisted_domain(const char* name, int n);
+
+/**
+ * Checks a domain name in DNS wire format (length prefixed labels, as
+ * found in a QNAME) against the blacklist, hashing label by label in
+ * place rather than building a dotted string, and counts the query for
+ * the domain that matched. Matching rules are the same as
+ * is_blacklisted_domain.
+ * @arg qname
+ *		The name, must be well formed (see dns_query_qname)
+ * @arg qlen
+ *		Length of qname including the final zero byte
+ * @arg domain
+ *		Set to the blacklisted domain that matched, null terminated
+ * @arg size
+ *		Capacity of domain
+ * @return
+ *		1 iff the domain is blacklisted
+ *		0 otherwise.
+ */
+int blacklist_count_qname(const unsigned char* qname, int qlen, char* domain, int size);
+
+/**
+ * Add n DNS queries counted before a restart to a domain, if it is
+ * still blacklisted.
+ */
+void blacklist_restore_queries(const char* domain, unsigned long n);
+
+/**
+ * @return
+ *		Number of domains in the blacklist
+ */
+int blacklist_size(void);
+
+/* Called by blacklist_query_counts for each domain */
+typedef void (*blacklist_count_fn)(const char* domain, unsigned long queries, void* arg);
+
+/**
+ * Call fn for every domain DNS queries were counted for. A reload waits
+ * for the walk to end before releasing the old index.
+ */
+void blacklist_query_counts(blacklist_count_fn fn, void* arg);
+
+#endif
@@ -0,0 +1,299 @@
+#include "checkpoint.h"
+/* Includes are in header file */
+
+extern long long get_time(void);
+
+static pthread_t saver;
+static int saver_started = 0;
+static int saver_stop = 0;
+static int saver_seconds;
+static const char* saver_path;
+static struct src_table* saver_sources;
+/* Resources mutexed: saver_stop */
+static pthread_mutex_t saver_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled to stop the saver before its next deadline */
+static pthread_cond_t saver_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Copy the counters of the live epoch, each group under its mutex.
+ */
+static void ckpt_stats_read(struct ckpt_stats* out)
+{
+	struct stats* st = stats_acquire();
+	pthread_mutex_lock(&st->syn_mutex);
+	out->syn_packets = st->total_syn_packets;
+	out->first_syn_time = st->first_syn_time;
+	out->last_syn_time = st->last_syn_time;
+	pthread_mutex_unlock(&st->syn_mutex);
+	pthread_mutex_lock(&st->arp_mutex);
+	out->arp_packets = st->total_arp_packets;
+	pthread_mutex_unlock(&st->arp_mutex);
+	pthread_mutex_lock(&st->blacklist_mutex);
+	out->blacklist_viol = st->total_blacklist_viol;
+	out->dns_viol = st->total_dns_viol;
+	pthread_mutex_unlock(&st->blacklist_mutex);
+	out->epoch_start = st->epoch_start;
+	stats_release(st);
+}
+
+/* Domains with DNS queries, as collected by ckpt_add_domain */
+struct ckpt_domains
+{
+	struct ckpt_domain* d;
+	uint32_t n, capacity;
+	int failed;
+};
+
+static void ckpt_add_domain(const char* domain, unsigned long queries, void* arg)
+{
+	struct ckpt_domains* all = arg;
+	if (all->n == all->capacity)
+	{
+		uint32_t capacity = all->capacity ? all->capacity * 2 : 64;
+		struct ckpt_domain* d = realloc(all->d, capacity * sizeof(struct ckpt_domain));
+		if (!d)
+		{
+			all->failed = 1;
+			return;
+		}
+		all->d = d;
+		all->capacity = capacity;
+	}
+	struct ckpt_domain* d = all->d + all->n++;
+	memset(d, 0, sizeof(*d));
+	d->queries = queries;
+	strncpy(d->name, domain, CKPT_NAME_MAX - 1);
+}
+
+int checkpoint_save(const char* path, struct src_table* sources)
+{
+	int capacity = sources->nbuckets * SRC_WAYS;
+	struct src_entry* entries = malloc(capacity * sizeof(struct src_entry));
+	struct ckpt_source* saved = malloc(capacity * sizeof(struct ckpt_source));
+	struct src6_entry* entries6 = malloc(capacity * sizeof(struct src6_entry));
+	struct ckpt_source6* saved6 = malloc(capacity * sizeof(struct ckpt_source6));
+	/* Only domains queried, the blacklist may have millions */
+	struct ckpt_domains domains = {NULL, 0, 0, 0};
+	blacklist_query_counts(ckpt_add_domain, &domains);
+	if (!entries || !saved || !entries6 || !saved6 || domains.failed)
+	{
+		fprintf(stderr, "%s\n", "[WARNING] Checkpoint skipped (memory allocation error)");
+		free(entries);
+		free(saved);
+		free(entries6);
+		free(saved6);
+		free(domains.d);
+		return -1;
+	}
+
+	struct ckpt_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CKPT_MAGIC, sizeof(h.magic));
+	h.version = CKPT_VERSION;
+	h.byte_order = CKPT_BYTE_ORDER;
+	h.saved_at = get_time();
+	ckpt_stats_read(&h.stats);
+	h.evictions = src_table_evictions(sources);
+	h.nsources = src_table_export(sources, entries, capacity);
+	h.nsources6 = src_table_export6(sources, entries6, capacity);
+	h.ndomains = domains.n;
+	h.sources_off = sizeof(h);
+	h.domains_off = h.sources_off + h.nsources * sizeof(struct ckpt_source);
+	h.sources6_off = h.domains_off + h.ndomains * sizeof(struct ckpt_domain);
+	h.size = h.sources6_off + h.nsources6 * sizeof(struct ckpt_source6);
+
+	uint32_t i;
+	for (i = 0; i < h.nsources; ++i)
+	{
+		saved[i].ip = entries[i].ip;
+		saved[i].syns = entries[i].syns;
+		saved[i].last_seen = entries[i].last_seen;
+	}
+	free(entries);
+	memset(saved6, 0, h.nsources6 * sizeof(struct ckpt_source6));
+	for (i = 0; i < h.nsources6; ++i)
+	{
+		memcpy(saved6[i].ip, entries6[i].ip.b, sizeof(saved6[i].ip));
+		saved6[i].syns = entries6[i].syns;
+		saved6[i].last_seen = entries6[i].last_seen;
+	}
+	free(entries6);
+
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE* f = fopen(tmp, "wb");
+	int ok = f != NULL;
+	ok = ok && fwrite(&h, sizeof(h), 1, f) == 1;
+	ok = ok && fwrite(saved, sizeof(struct ckpt_source), h.nsources, f) == h.nsources;
+	ok = ok && fwrite(domains.d, sizeof(struct ckpt_domain), h.ndomains, f) == h.ndomains;
+	ok = ok && fwrite(saved6, sizeof(struct ckpt_source6), h.nsources6, f) == h.nsources6;
+	free(saved);
+	free(saved6);
+	free(domains.d);
+	/* Make sure the data is on disk before the rename makes it current */
+	ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+	if (f && fclose(f) != 0)
+	{
+		ok = 0;
+	}
+	if (!ok || rename(tmp, path) != 0)
+	{
+		fprintf(stderr, "[WARNING] Failed to write checkpoint %s: %s\n", path, strerror(errno));
+		remove(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Whether len bytes at off lie within a file of size bytes. Both come
+ * from the file, so off + len could wrap.
+ */
+static int in_file(uint64_t off, uint64_t len, size_t size)
+{
+	return off <= size && len <= size - off;
+}
+
+int checkpoint_restore(const char* path, struct src_table* sources)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "[WARNING] Cannot open checkpoint %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) != 0 || sb.st_size < (off_t) sizeof(struct ckpt_header))
+	{
+		fprintf(stderr, "[WARNING] Checkpoint %s is truncated\n", path);
+		close(fd);
+		return -1;
+	}
+	const unsigned char* base = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		fprintf(stderr, "[WARNING] Cannot map checkpoint %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	const struct ckpt_header* h = (const struct ckpt_header*) base;
+	const char* problem = NULL;
+	if (memcmp(h->magic, CKPT_MAGIC, sizeof(h->magic)) != 0)
+	{
+		problem = "is not a checkpoint";
+	}
+	else if (h->version != CKPT_VERSION || h->byte_order != CKPT_BYTE_ORDER)
+	{
+		problem = "was written by another version or host";
+	}
+	else if (h->size != (uint64_t) sb.st_size)
+	{
+		problem = "is truncated";
+	}
+	else if (h->sources_off % 8 || h->domains_off % 8 || h->sources6_off % 8
+	    || !in_file(h->sources_off, (uint64_t) h->nsources * sizeof(struct ckpt_source), sb.st_size)
+	    || !in_file(h->domains_off, (uint64_t) h->ndomains * sizeof(struct ckpt_domain), sb.st_size)
+	    || !in_file(h->sources6_off, (uint64_t) h->nsources6 * sizeof(struct ckpt_source6), sb.st_size))
+	{
+		problem = "is corrupt";
+	}
+	if (problem)
+	{
+		fprintf(stderr, "[WARNING] Checkpoint %s %s\n", path, problem);
+		munmap((void*) base, sb.st_size);
+		return -1;
+	}
+
+	/* The epoch carries on where the previous run left it */
+	struct stats* st = stats_live();
+	st->total_syn_packets = h->stats.syn_packets;
+	st->total_arp_packets = h->stats.arp_packets;
+	st->total_blacklist_viol = h->stats.blacklist_viol;
+	st->total_dns_viol = h->stats.dns_viol;
+	st->first_syn_time = h->stats.first_syn_time;
+	st->last_syn_time = h->stats.last_syn_time;
+	st->epoch_start = h->stats.epoch_start;
+
+	const struct ckpt_source* saved = (const struct ckpt_source*) (base + h->sources_off);
+	uint32_t i;
+	for (i = 0; i < h->nsources; ++i)
+	{
+		src_table_restore(sources, saved[i].ip, saved[i].syns, saved[i].last_seen);
+	}
+	const struct ckpt_source6* saved6 = (const struct ckpt_source6*) (base + h->sources6_off);
+	for (i = 0; i < h->nsources6; ++i)
+	{
+		struct addr6 ip;
+		addr6_load(&ip, saved6[i].ip);
+		src_table_restore6(sources, &ip, saved6[i].syns, saved6[i].last_seen);
+	}
+	src_table_restore_evictions(sources, h->evictions);
+
+	const struct ckpt_domain* domains = (const struct ckpt_domain*) (base + h->domains_off);
+	for (i = 0; i < h->ndomains; ++i)
+	{
+		char name[CKPT_NAME_MAX];
+		snprintf(name, sizeof(name), "%.*s", CKPT_NAME_MAX - 1, domains[i].name);
+		blacklist_restore_queries(name, domains[i].queries);
+	}
+
+	printf("Restored %u SYN sources from checkpoint of %6f seconds ago\n",
+	    h->nsources + h->nsources6, ((double) (get_time() - h->saved_at)) / ((double) 1000000));
+	munmap((void*) base, sb.st_size);
+	return 0;
+}
+
+/* Loop executed by the checkpoint thread */
+static void* saver_loop(void* arg)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	pthread_mutex_lock(&saver_mutex);
+	while (!saver_stop)
+	{
+		deadline.tv_sec += saver_seconds;
+		while (!saver_stop
+		    && pthread_cond_timedwait(&saver_cond, &saver_mutex, &deadline) != ETIMEDOUT)
+		{
+			/* spurious wake up or stop request */
+		}
+		if (saver_stop)
+		{
+			break;
+		}
+		pthread_mutex_unlock(&saver_mutex);
+		checkpoint_save(saver_path, saver_sources);
+		pthread_mutex_lock(&saver_mutex);
+	}
+	pthread_mutex_unlock(&saver_mutex);
+	return NULL;
+}
+
+void checkpoint_start(const char* path, int seconds, struct src_table* sources)
+{
+	saver_path = path;
+	saver_seconds = seconds;
+	saver_sources = sources;
+	if (pthread_create(&saver, NULL, &saver_loop, NULL) != 0)
+	{
+		fprintf(stderr, "%s\n", "[ERROR] Failed to start checkpoint thread");
+		exit(1);
+	}
+	saver_started = 1;
+}
+
+void checkpoint_stop(void)
+{
+	if (!saver_started)
+	{
+		return;
+	}
+	pthread_mutex_lock(&saver_mutex);
+	saver_stop = 1;
+	pthread_cond_signal(&saver_cond);
+	pthread_mutex_unlock(&saver_mutex);
+	pthread_join(saver, NULL);
+	saver_started = 0;
+	checkpoint_save(saver_path, saver_sources);
+}
@@ -0,0 +1,126 @@
+#ifndef CS241_CHECKPOINT_H
+#define CS241_CHECKPOINT_H
+
+#include <stdio.h> /* fopen, fwrite, rename */
+#include <stdlib.h> /* malloc */
+#include <string.h> /* memcmp, strncpy */
+#include <stdint.h> /* uint32_t, int64_t */
+#include <errno.h> /* ETIMEDOUT */
+#include <pthread.h> /* pthread_t */
+#include <time.h> /* clock_gettime */
+#include <fcntl.h> /* open */
+#include <unistd.h> /* close, fsync */
+#include <sys/mman.h> /* mmap */
+#include <sys/stat.h> /* fstat */
+#include "stats.h"
+#include "src_table.h"
+#include "blacklist.h"
+
+/*
+ * Checkpoint file layout, all integers in host byte order and every
+ * section 8 byte aligned so that the file can be used in place once
+ * mapped:
+ *
+ *	struct ckpt_header
+ *	struct ckpt_source[nsources]	at sources_off
+ *	struct ckpt_domain[ndomains]	at domains_off
+ *	struct ckpt_source6[nsources6]	at sources6_off
+ *
+ * Only state that takes time to build up is saved: the counters of the
+ * live epoch, the SYN source table and the DNS query counts. The HTTP
+ * reassembly and verdict caches refill from the next packets.
+ */
+#define CKPT_MAGIC "IDSCKPT"
+/* Bump whenever the layout changes, older files are then refused */
+#define CKPT_VERSION 2
+/* Written as is, reads back differently on a host of other endianness */
+#define CKPT_BYTE_ORDER 0x01020304u
+/* Longest domain name, including the terminating null */
+#define CKPT_NAME_MAX 256
+
+/* Counters of the live epoch */
+struct ckpt_stats
+{
+	int64_t syn_packets;
+	int64_t arp_packets;
+	int64_t blacklist_viol;
+	int64_t dns_viol;
+	int64_t first_syn_time, last_syn_time;
+	int64_t epoch_start;
+};
+
+struct ckpt_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	int64_t saved_at; /* Time of the snapshot (micro seconds) */
+	uint64_t size; /* Of the whole file, catches truncated files */
+	struct ckpt_stats stats;
+	uint64_t evictions; /* Of the source table */
+	uint64_t sources_off;
+	uint32_t nsources;
+	uint32_t ndomains;
+	uint64_t domains_off;
+	uint64_t sources6_off;
+	uint32_t nsources6;
+	uint32_t pad;
+};
+
+/* A SYN source in the window when the snapshot was taken */
+struct ckpt_source
+{
+	uint32_t ip;
+	uint32_t syns;
+	int64_t last_seen;
+};
+
+/* An IPv6 SYN source, as struct ckpt_source */
+struct ckpt_source6
+{
+	unsigned char ip[16]; /* Network byte order */
+	uint32_t syns;
+	uint32_t pad;
+	int64_t last_seen;
+};
+
+/* DNS query count of a blacklisted domain, matched by name on restore
+ * so that the blacklist may change between runs. Only domains that
+ * were queried are saved. */
+struct ckpt_domain
+{
+	uint64_t queries;
+	char name[CKPT_NAME_MAX];
+};
+
+/**
+ * Write a snapshot of the detector state. The file is written next to
+ * path and renamed over it, so path always holds a complete snapshot.
+ * @return
+ *		0 on success
+ *		-1 on failure, with a message printed
+ */
+int checkpoint_save(const char* path, struct src_table* sources);
+
+/**
+ * Load a snapshot written by checkpoint_save into the (freshly
+ * initialised) detector state. Must be called before workers start.
+ * @return
+ *		0 on success
+ *		-1 if the file is missing, truncated or of another version, with a
+ *		message printed; the state is then left untouched
+ */
+int checkpoint_restore(const char* path, struct src_table* sources);
+
+/**
+ * Start a thread saving a snapshot to path every given number of
+ * seconds.
+ */
+void checkpoint_start(const char* path, int seconds, struct src_table* sources);
+
+/**
+ * Stop the checkpoint thread, if started, and save a last snapshot.
+ */
+void checkpoint_stop(void);
+
+#endif
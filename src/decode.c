@@ -0,0 +1,228 @@
+#include "decode.h"
+/* Includes are in header file */
+
+#define ETH_LEN 14
+#define IPV6_LEN 40
+/* Extension headers skipped before giving up on an IPv6 packet */
+#define IPV6_MAX_EXT 8
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+
+/* Lanes decode_batch fills, and the destination port of the frames of
+ * the lanes of a port (decode_route) */
+static unsigned routed = 1u << LANE_BAD;
+static int lane_port[DECODE_LANES];
+
+void decode_route(int lane, int port)
+{
+	routed |= 1u << lane;
+	lane_port[lane] = port;
+}
+
+/* Big endian loads, frames have no particular alignment */
+static inline uint16_t load16(const unsigned char* p)
+{
+	return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static inline uint32_t load32(const unsigned char* p)
+{
+	return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+/* Put frame i in a lane, if routed */
+static inline void lane_add(struct decoded_batch* b, int lane, int i)
+{
+	if (routed & (1u << lane))
+	{
+		b->lane[lane][b->nlane[lane]++] = i;
+	}
+}
+
+/**
+ * Payload of a TCP or UDP header at l4 whose length field says plen,
+ * clamped to what was captured.
+ */
+static inline void set_payload(struct decoded_batch* b, int i, int off, int plen, int len)
+{
+	if (plen > len - off)
+	{
+		plen = len - off;
+	}
+	b->payload_off[i] = off;
+	b->payload_len[i] = plen > 0 ? plen : 0;
+}
+
+int decode_ipv6(const unsigned char* ip, int len, uint8_t* proto)
+{
+	if (len < IPV6_LEN)
+	{
+		return -1;
+	}
+	uint8_t next = ip[6];
+	int off = IPV6_LEN;
+	int n;
+	for (n = 0; n < IPV6_MAX_EXT; ++n)
+	{
+		switch (next)
+		{
+			case 0: /* Hop-by-Hop Options */
+			case 43: /* Routing */
+			case 60: /* Destination Options */
+			case 135: /* Mobility */
+			case 139: /* HIP */
+			case 140: /* Shim6 */
+				if (len < off + 8)
+				{
+					return -1;
+				}
+				next = ip[off];
+				off += (ip[off + 1] + 1) * 8;
+				break;
+			case 51: /* Authentication Header, length in 4 byte words */
+				if (len < off + 8)
+				{
+					return -1;
+				}
+				next = ip[off];
+				off += (ip[off + 1] + 2) * 4;
+				break;
+			case 44: /* Fragment */
+				if (len < off + 8 || (load16(ip + off + 2) & 0xfff8))
+				{
+					/* Only the first fragment has the upper header */
+					return -1;
+				}
+				next = ip[off];
+				off += 8;
+				break;
+			default:
+				*proto = next;
+				return off;
+		}
+	}
+	return -1;
+}
+
+void decode_batch(const unsigned char* const* frames, const int* lens, int n, struct decoded_batch* b)
+{
+	int i;
+	/* Ethernet, IPv4 or IPv6 without extension headers and the start
+	 * of TCP/UDP fit in the first two cache lines */
+	for (i = 0; i < n; ++i)
+	{
+		__builtin_prefetch(frames[i]);
+		__builtin_prefetch(frames[i] + 64);
+	}
+	b->n = n;
+	memset(b->nlane, 0, sizeof(b->nlane));
+	for (i = 0; i < n; ++i)
+	{
+		const unsigned char* p = frames[i];
+		int len = lens[i];
+		b->ethertype[i] = len >= ETH_LEN ? load16(p + 12) : 0;
+		b->proto[i] = 0;
+		b->tcp_flags[i] = 0;
+		b->src[i] = b->dst[i] = 0;
+		b->sport[i] = b->dport[i] = 0;
+		b->seq[i] = 0;
+		b->payload_off[i] = b->payload_len[i] = 0;
+
+		if (len < ETH_LEN)
+		{
+			continue;
+		}
+		if (b->ethertype[i] < 1536)
+		{
+			lane_add(b, LANE_BAD, i);
+			continue;
+		}
+		if (b->ethertype[i] == 0x0806)
+		{
+			lane_add(b, LANE_ARP, i);
+			continue;
+		}
+
+		const unsigned char* ip = p + ETH_LEN;
+		/* Start of the upper layer header and its length with payload,
+		 * from the IP header */
+		int l4, l4_len;
+		int v6 = b->ethertype[i] == 0x86dd;
+		if (v6)
+		{
+			int off = decode_ipv6(ip, len - ETH_LEN, &b->proto[i]);
+			if (off < 0)
+			{
+				continue;
+			}
+			struct addr6 a;
+			addr6_load(&a, ip + 8);
+			b->src[i] = addr6_digest(&a);
+			addr6_load(&a, ip + 24);
+			b->dst[i] = addr6_digest(&a);
+			l4 = ETH_LEN + off;
+			l4_len = IPV6_LEN + load16(ip + 4) - off;
+		}
+		else if (b->ethertype[i] == 0x0800 && len >= ETH_LEN + 20)
+		{
+			int ihl = (ip[0] & 0x0f) * 4;
+			b->proto[i] = ip[9];
+			b->src[i] = load32(ip + 12);
+			b->dst[i] = load32(ip + 16);
+			if (ihl < 20)
+			{
+				continue;
+			}
+			l4 = ETH_LEN + ihl;
+			l4_len = load16(ip + 2) - ihl;
+		}
+		else
+		{
+			continue;
+		}
+
+		if (b->proto[i] == 0x06 && len >= l4 + 20)
+		{
+			const unsigned char* tcp = p + l4;
+			int doff = (tcp[12] >> 4) * 4;
+			b->sport[i] = load16(tcp);
+			b->dport[i] = load16(tcp + 2);
+			b->seq[i] = load32(tcp + 4);
+			b->tcp_flags[i] = tcp[13];
+			set_payload(b, i, l4 + doff, l4_len - doff, len);
+			if (b->tcp_flags[i] == TCP_SYN)
+			{
+				lane_add(b, v6 ? LANE_SYN6 : LANE_SYN, i);
+			}
+			int has_data = b->payload_len[i] > 0 || (b->tcp_flags[i] & (TCP_FIN | TCP_RST));
+			if (b->dport[i] == lane_port[LANE_HTTP] && has_data)
+			{
+				lane_add(b, LANE_HTTP, i);
+			}
+			else if (b->dport[i] == lane_port[LANE_TLS] && has_data)
+			{
+				lane_add(b, LANE_TLS, i);
+			}
+		}
+		else if (b->proto[i] == 0x11 && len >= l4 + 8)
+		{
+			const unsigned char* udp = p + l4;
+			b->sport[i] = load16(udp);
+			b->dport[i] = load16(udp + 2);
+			set_payload(b, i, l4 + 8, load16(udp + 4) - 8, len);
+			if (!v6)
+			{
+				lane_add(b, LANE_UDP, i);
+			}
+			if (b->dport[i] == lane_port[LANE_DNS])
+			{
+				lane_add(b, LANE_DNS, i);
+			}
+		}
+		else if (b->proto[i] == 0x01 && !v6)
+		{
+			lane_add(b, LANE_ICMP, i);
+		}
+	}
+}
@@ -0,0 +1,88 @@
+#ifndef CS241_DECODE_H
+#define CS241_DECODE_H
+
+#include <stdint.h> /* uint32_t */
+#include <string.h> /* memset */
+#include "addr6.h" /* addr6_digest */
+
+/* Most frames decoded at once */
+#define DECODE_BATCH_MAX 64
+
+/* Lanes, the frames of a batch a detector has to look at */
+#define LANE_SYN 0 /* TCP over IPv4 with only SYN set */
+#define LANE_HTTP 1 /* TCP to port 80 with payload, FIN or RST */
+#define LANE_TLS 2 /* TCP to port 443 with payload, FIN or RST */
+#define LANE_DNS 3 /* UDP to port 53 */
+#define LANE_ARP 4
+#define LANE_BAD 5 /* Not Ethernet II */
+#define LANE_UDP 6 /* All UDP over IPv4 */
+#define LANE_ICMP 7 /* ICMP (not ICMPv6) */
+#define LANE_SYN6 8 /* As LANE_SYN, over IPv6 */
+#define DECODE_LANES 9
+
+/**
+ * Headers of a batch of frames in structure of arrays form: field[i]
+ * belongs to frame i. Fields a frame does not have (ports of an ARP
+ * frame) are 0. Addresses, ports and seq are in host byte order; the
+ * addresses of an IPv6 frame are their addr6_digest, which is what its
+ * flow_key holds, the full addresses stay in the frame.
+ */
+struct decoded_batch
+{
+	int n;
+	uint16_t ethertype[DECODE_BATCH_MAX];
+	uint8_t proto[DECODE_BATCH_MAX];
+	uint8_t tcp_flags[DECODE_BATCH_MAX];
+	uint32_t src[DECODE_BATCH_MAX], dst[DECODE_BATCH_MAX];
+	uint16_t sport[DECODE_BATCH_MAX], dport[DECODE_BATCH_MAX];
+	uint32_t seq[DECODE_BATCH_MAX];
+	/* TCP or UDP payload, offset from the start of the frame and length
+	 * within the captured bytes */
+	uint16_t payload_off[DECODE_BATCH_MAX], payload_len[DECODE_BATCH_MAX];
+	/* Indices of the frames of each lane, in batch order */
+	uint8_t lane[DECODE_LANES][DECODE_BATCH_MAX];
+	int nlane[DECODE_LANES];
+};
+
+/**
+ * Find the upper layer header of an IPv6 packet, skipping extension
+ * headers.
+ * @arg ip
+ *		The IPv6 header
+ * @arg len
+ *		Bytes captured from ip on, nothing past it is read
+ * @arg proto
+ *		Set to the upper layer protocol
+ * @return
+ *		Offset of the upper layer header from ip
+ *		-1 if the headers were not all captured, the packet is a
+ *		fragment other than the first or has too many extension headers
+ */
+int decode_ipv6(const unsigned char* ip, int len, uint8_t* proto);
+
+/**
+ * Have decode_batch fill a lane, for the detector reading it. Lanes
+ * nothing is routed to stay empty, except LANE_BAD.
+ * @arg port
+ *		Destination port of the frames of LANE_HTTP, LANE_TLS and
+ *		LANE_DNS; ignored for other lanes
+ */
+void decode_route(int lane, int port);
+
+/**
+ * Decode the headers of a batch of frames. All headers are prefetched
+ * first so that the cache misses of the frames overlap instead of being
+ * taken one after the other. Nothing past lens[i] is read; truncated
+ * headers leave the frame out of every lane.
+ * @arg frames
+ *		The frames, starting at the Ethernet header
+ * @arg lens
+ *		Captured length of each frame
+ * @arg n
+ *		Number of frames, at most DECODE_BATCH_MAX
+ * @arg b
+ *		Filled with the decoded headers and lanes
+ */
+void decode_batch(const unsigned char* const* frames, const int* lens, int n, struct decoded_batch* b);
+
+#endif
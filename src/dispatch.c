@@ -1,53 +1,654 @@
+#define _GNU_SOURCE /* pthread_setaffinity_np, CPU_SET */
 #include "dispatch.h"
 /* Includes are in header file */
 
-extern int should_exit;
+extern long long get_time(void);
 
-pthread_t tpool[THREAD_COUNT];
-struct queue task_q;
-pthread_mutex_t q_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t task_cond = PTHREAD_COND_INITIALIZER;
+/* Per worker state, allocated by the worker itself */
+struct worker
+{
+	pthread_t thread;
+	int id;
+	int cpu; /* CPU pinned to, -1 if not pinned */
+	/* Resources mutexed: q (items and free list) */
+	pthread_mutex_t mutex;
+	/* Signalled when work arrives for a sleeping worker or on stop */
+	pthread_cond_t cond;
+	/* Set while waiting on cond, read without the mutex by wake_idle */
+	atomic_int sleeping;
+	struct queue q;
+	/* Items taken from other workers, only written by this worker */
+	unsigned long long steals;
+	/* Last analysed items, referenced, written out with the next
+	 * detection when the pcap writer is enabled. Oldest at
+	 * recent_next once full. */
+	struct queueitem* recent[PCAPW_PRE_TRIGGER];
+	int nrecent, recent_next;
+	/* Stage timing, only written by this worker */
+	unsigned long long analysed;
+	long long queue_wait_us, analyse_us;
+};
+
+/* Arguments of a worker thread */
+struct worker_start
+{
+	int id;
+	int cpu;
+};
+
+/* Packets the capture thread has prepared for one worker. Free items are
+ * taken from the worker's pool in bulk as well, so the capture thread
+ * takes each worker's mutex about twice per DISPATCH_BATCH packets. Only
+ * ever touched by the capture thread. */
+struct staging
+{
+	struct queueitem* items[DISPATCH_BATCH];
+	int n;
+	struct queueitem* free;
+};
+
+static struct worker* workers[MAX_THREADS];
+static struct staging staged[MAX_THREADS];
+static int nworkers = 0;
+static int dispatch_mode = DISPATCH_RR;
+static int decode_mode = DECODE_BATCH;
+/* Worker receiving the current batch in DISPATCH_RR mode */
+static int rr_next = 0;
+/* Port of the segments that go by flow in DISPATCH_RR mode too, or 0 */
+static int ordered_port = 0;
+/* Packets not queued because the memory budget refused an item */
+static atomic_ulong mem_dropped;
+/* Set by tpool_destroy to stop the workers */
+static atomic_int stopping;
+/* Packets dispatched but not analysed yet */
+static atomic_long pending;
+/* Number of workers waiting for work */
+static atomic_int nsleeping;
+
+/* Resources mutexed: ready */
+static pthread_mutex_t ready_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+/* Number of workers that have published their state */
+static int ready = 0;
+
+/* Signalled when pending drops to 0 */
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drain_cond = PTHREAD_COND_INITIALIZER;
+
+int pin_thread(const int* cpus, int ncpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	int i;
+	for (i = 0; i < ncpus; ++i)
+	{
+		if (cpus[i] >= CPU_SETSIZE)
+		{
+			return 0;
+		}
+		CPU_SET(cpus[i], &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+int tpool_default_size(int capture_threads)
+{
+	cpu_set_t set;
+	int n = 1;
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+	{
+		n = CPU_COUNT(&set) - capture_threads;
+	}
+	if (n < 1)
+	{
+		n = 1;
+	}
+	return n > MAX_THREADS ? MAX_THREADS : n;
+}
+
+/**
+ * First thing run by a worker thread: pin, then allocate and publish its
+ * state so that all of it is first touched on the worker's node.
+ */
+static struct worker* worker_setup(struct worker_start* start)
+{
+	if (start->cpu >= 0 && !pin_thread(&start->cpu, 1))
+	{
+		fprintf(stderr, "[WARNING] Failed to pin worker %d to CPU %d\n", start->id, start->cpu);
+	}
+	struct worker* w = mem_alloc(MEM_WORKERS, sizeof(struct worker), 0);
+	w->thread = pthread_self();
+	w->id = start->id;
+	w->cpu = start->cpu;
+	w->steals = 0;
+	w->nrecent = 0;
+	w->recent_next = 0;
+	w->analysed = 0;
+	w->queue_wait_us = 0;
+	w->analyse_us = 0;
+	atomic_init(&w->sleeping, 0);
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	queue_init(&w->q, w->id, QUEUE_POOL_ITEMS);
+	mem_free(MEM_WORKERS, start, sizeof(struct worker_start));
+
+	pthread_mutex_lock(&ready_mutex);
+	workers[w->id] = w;
+	++ready;
+	pthread_cond_signal(&ready_cond);
+	pthread_mutex_unlock(&ready_mutex);
+	return w;
+}
+
+/**
+ * Take up to WORKER_BATCH items from the first other worker that has
+ * any, starting with the next one. Busy victims (mutex held) are
+ * skipped rather than waited for.
+ * @return
+ *		Number of items stolen into items
+ */
+static int steal(struct worker* w, struct queueitem** items)
+{
+	int i;
+	for (i = 1; i < nworkers; ++i)
+	{
+		struct worker* victim = workers[(w->id + i) % nworkers];
+		if (pthread_mutex_trylock(&victim->mutex) != 0)
+		{
+			continue;
+		}
+		int n = queue_steal(&victim->q, items, WORKER_BATCH);
+		pthread_mutex_unlock(&victim->mutex);
+		if (n)
+		{
+			w->steals += n;
+			return n;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Drop a reference to each item and give the ones no longer referenced
+ * back to the pools they came from, taking each owner's mutex once per
+ * run of items with the same owner.
+ */
+static void release_batch(struct queueitem** items, int n)
+{
+	int i = 0;
+	while (i < n)
+	{
+		if (atomic_fetch_sub(&items[i]->refs, 1) != 1)
+		{
+			++i;
+			continue;
+		}
+		struct worker* owner = workers[items[i]->owner];
+		prof_lock(&owner->mutex, PROF_LOCK_QUEUE);
+		queue_recycle(&owner->q, items[i++]);
+		while (i < n && items[i]->owner == owner->id)
+		{
+			if (atomic_fetch_sub(&items[i]->refs, 1) == 1)
+			{
+				queue_recycle(&owner->q, items[i]);
+			}
+			++i;
+		}
+		pthread_mutex_unlock(&owner->mutex);
+	}
+}
+
+void dispatch_release(struct queueitem* item)
+{
+	release_batch(&item, 1);
+}
+
+/**
+ * Keep an analysed item for the pcap writer. On a detection the recent
+ * items and this one are submitted, otherwise this one replaces the
+ * oldest recent item, which is stored in dropped.
+ * @return
+ *		Number of items stored in dropped, 0 or 1
+ */
+static int keep_recent(struct worker* w, struct queueitem* item, int detected, struct queueitem** dropped)
+{
+	if (detected)
+	{
+		int i;
+		int first = w->nrecent < PCAPW_PRE_TRIGGER ? 0 : w->recent_next;
+		for (i = 0; i < w->nrecent; ++i)
+		{
+			struct queueitem* old = w->recent[(first + i) % PCAPW_PRE_TRIGGER];
+			pcapw_submit(old);
+			/* The writer has its own reference now */
+			dispatch_release(old);
+		}
+		w->nrecent = 0;
+		w->recent_next = 0;
+		pcapw_submit(item);
+		return 0;
+	}
+	atomic_fetch_add(&item->refs, 1);
+	int n = 0;
+	if (w->nrecent == PCAPW_PRE_TRIGGER)
+	{
+		dropped[n++] = w->recent[w->recent_next];
+	}
+	else
+	{
+		++w->nrecent;
+	}
+	w->recent[w->recent_next] = item;
+	w->recent_next = (w->recent_next + 1) % PCAPW_PRE_TRIGGER;
+	return n;
+}
 
 /* Loop to be executed by worker threads */
 void* thread_loop(void *arg)
 {
-	while (!should_exit)
+	struct worker* w = worker_setup(arg);
+	prof_thread_start("worker", w->id);
+	/* Room for the items dropped from recent as well */
+	struct queueitem* batch[2 * WORKER_BATCH];
+	for (;;)
 	{
-		struct queueitem* item;
-		pthread_mutex_lock(&q_mutex);
-		while (!(item = dequeue(&task_q)) && !should_exit)
+		int n = 0;
+		prof_stage(PROF_DEQUEUE);
+		prof_lock(&w->mutex, PROF_LOCK_QUEUE);
+		while (n < WORKER_BATCH && (batch[n] = dequeue(&w->q)))
 		{
-			pthread_cond_wait(&task_cond, &q_mutex);
+			++n;
+		}
+		pthread_mutex_unlock(&w->mutex);
+
+		if (!n && dispatch_mode == DISPATCH_RR)
+		{
+			n = steal(w, batch);
+		}
+		if (!n)
+		{
+			/* Nothing anywhere, wait for the capture thread. Only
+			 * stop once the queue is empty so no packet goes unseen */
+			prof_stage(PROF_IDLE);
+			pthread_mutex_lock(&w->mutex);
+			if (!queue_size(&w->q) && atomic_load(&stopping))
+			{
+				pthread_mutex_unlock(&w->mutex);
+				break;
+			}
+			if (!queue_size(&w->q))
+			{
+				atomic_store(&w->sleeping, 1);
+				atomic_fetch_add(&nsleeping, 1);
+				pthread_cond_wait(&w->cond, &w->mutex);
+				atomic_fetch_sub(&nsleeping, 1);
+				atomic_store(&w->sleeping, 0);
+			}
+			pthread_mutex_unlock(&w->mutex);
+			continue;
 		}
-		pthread_mutex_unlock(&q_mutex);
 
-		if (item)
+		int i, nrelease = n;
+		long long picked = get_time();
+		for (i = 0; i < n; ++i)
+		{
+			w->queue_wait_us += picked - batch[i]->queued_at;
+		}
+		int detected[WORKER_BATCH];
+		if (decode_mode == DECODE_BATCH && !batch[0]->verbose && !analysis_debugging())
+		{
+			const unsigned char* frames[WORKER_BATCH];
+			int lens[WORKER_BATCH];
+			long long ts[WORKER_BATCH];
+			for (i = 0; i < n; ++i)
+			{
+				frames[i] = batch[i]->data;
+				lens[i] = batch[i]->len;
+				ts[i] = batch[i]->ts.tv_sec * 1000000LL + batch[i]->ts.tv_usec;
+			}
+			analyse_batch(frames, lens, ts, n, detected);
+		}
+		else
 		{
-			if (!should_exit)
+			/* Printed headers are decoded packet by packet */
+			prof_stage(PROF_DETECT);
+			for (i = 0; i < n; ++i)
 			{
-				analyse(item->data, item->verbose);
+				long long ts = batch[i]->ts.tv_sec * 1000000LL + batch[i]->ts.tv_usec;
+				detected[i] = analyse(batch[i]->data, batch[i]->len, ts, batch[i]->verbose);
 			}
-			free(item->data);
-			free(item);
+		}
+		prof_stage(PROF_RELEASE);
+		if (pcapw_enabled())
+		{
+			for (i = 0; i < n; ++i)
+			{
+				nrelease += keep_recent(w, batch[i], detected[i], batch + nrelease);
+			}
+		}
+		w->analysed += n;
+		w->analyse_us += get_time() - picked;
+		release_batch(batch, nrelease);
+		if (atomic_fetch_sub(&pending, n) == n)
+		{
+			/* Last pending packet, tpool_drain may be waiting */
+			pthread_mutex_lock(&drain_mutex);
+			pthread_cond_broadcast(&drain_cond);
+			pthread_mutex_unlock(&drain_mutex);
 		}
 	}
+	prof_thread_stop();
 	return NULL;
 }
 
 /* Called to create all threads */
-void tpool_init(void)
+void tpool_init(int nthreads, const int* cpus, int ncpus, int mode, int decode)
 {
+	assert(nthreads > 0 && nthreads <= MAX_THREADS);
+	atomic_init(&pending, 0);
+	atomic_init(&stopping, 0);
+	atomic_init(&nsleeping, 0);
+	dispatch_mode = mode;
+	decode_mode = decode;
+	ordered_port = analysis_reassembled_port();
 	int i;
-	for (i = 0; i < THREAD_COUNT; ++i)
+	for (i = 0; i < nthreads; ++i)
 	{
-		pthread_create(tpool + i, NULL, &thread_loop, NULL);
+		struct worker_start* start = mem_alloc(MEM_WORKERS, sizeof(struct worker_start), 0);
+		start->id = i;
+		start->cpu = cpus ? cpus[i % ncpus] : -1;
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, &thread_loop, start) != 0)
+		{
+			fprintf(stderr, "%s\n", "[ERROR] Failed to create worker thread");
+			exit(1);
+		}
 	}
+	pthread_mutex_lock(&ready_mutex);
+	while (ready < nthreads)
+	{
+		pthread_cond_wait(&ready_cond, &ready_mutex);
+	}
+	pthread_mutex_unlock(&ready_mutex);
+	nworkers = nthreads;
 }
 
-void dispatch(struct pcap_pkthdr *header, const unsigned char *packet, int verbose)
+void tpool_drain(void)
 {
-	pthread_mutex_lock(&q_mutex);
-	enqueue(&task_q, packet, header->caplen, verbose);
-	pthread_cond_signal(&task_cond);
-	pthread_mutex_unlock(&q_mutex);
+	dispatch_flush();
+	pthread_mutex_lock(&drain_mutex);
+	while (atomic_load(&pending) > 0)
+	{
+		pthread_cond_wait(&drain_cond, &drain_mutex);
+	}
+	pthread_mutex_unlock(&drain_mutex);
+}
+
+void tpool_destroy(void)
+{
+	int i;
+	/* Workers analyse everything queued before they stop */
+	dispatch_flush();
+	atomic_store(&stopping, 1);
+	for (i = 0; i < nworkers; ++i)
+	{
+		pthread_mutex_lock(&workers[i]->mutex);
+		pthread_cond_signal(&workers[i]->cond);
+		pthread_mutex_unlock(&workers[i]->mutex);
+	}
+	for (i = 0; i < nworkers; ++i)
+	{
+		pthread_join(workers[i]->thread, NULL);
+	}
+	/* Items held for the pcap writer go back before the pools are freed */
+	for (i = 0; i < nworkers; ++i)
+	{
+		struct worker* w = workers[i];
+		release_batch(w->recent, w->nrecent);
+		w->nrecent = 0;
+	}
+	pcapw_stop();
+	for (i = 0; i < nworkers; ++i)
+	{
+		struct worker* w = workers[i];
+		struct staging* s = staged + i;
+		while (s->free)
+		{
+			struct queueitem* item = s->free;
+			s->free = item->next;
+			queueitem_free(item);
+		}
+		queue_destroy(&w->q);
+		pthread_mutex_destroy(&w->mutex);
+		pthread_cond_destroy(&w->cond);
+		mem_free(MEM_WORKERS, w, sizeof(struct worker));
+		workers[i] = NULL;
+	}
+	nworkers = 0;
+}
+
+void tpool_timing(struct tpool_timing* t)
+{
+	t->analysed = 0;
+	t->queue_wait_us = 0;
+	t->analyse_us = 0;
+	int i;
+	for (i = 0; i < nworkers; ++i)
+	{
+		t->analysed += workers[i]->analysed;
+		t->queue_wait_us += workers[i]->queue_wait_us;
+		t->analyse_us += workers[i]->analyse_us;
+	}
+}
+
+unsigned long long tpool_steals(void)
+{
+	unsigned long long total = 0;
+	int i;
+	for (i = 0; i < nworkers; ++i)
+	{
+		total += workers[i]->steals;
+	}
+	return total;
+}
+
+unsigned long dispatch_mem_dropped(void)
+{
+	return atomic_load(&mem_dropped);
+}
+
+/**
+ * Wake up one sleeping worker other than busy so it can steal from it.
+ */
+static void wake_idle(int busy)
+{
+	int i;
+	for (i = 1; i < nworkers; ++i)
+	{
+		struct worker* w = workers[(busy + i) % nworkers];
+		if (atomic_load(&w->sleeping))
+		{
+			pthread_mutex_lock(&w->mutex);
+			pthread_cond_signal(&w->cond);
+			pthread_mutex_unlock(&w->mutex);
+			return;
+		}
+	}
+}
+
+/**
+ * Hand the staged packets of worker i over to it.
+ */
+static void staging_push(int i)
+{
+	struct staging* s = staged + i;
+	if (!s->n)
+	{
+		return;
+	}
+	struct worker* w = workers[i];
+	atomic_fetch_add(&pending, s->n);
+	long long now = get_time();
+	prof_lock(&w->mutex, PROF_LOCK_QUEUE);
+	int k;
+	for (k = 0; k < s->n; ++k)
+	{
+		s->items[k]->queued_at = now;
+		enqueue(&w->q, s->items[k]);
+	}
+	unsigned int backlog = queue_size(&w->q);
+	if (atomic_load(&w->sleeping))
+	{
+		pthread_cond_signal(&w->cond);
+	}
+	pthread_mutex_unlock(&w->mutex);
+	s->n = 0;
+
+	/* More queued than the worker will get through soon */
+	if (dispatch_mode == DISPATCH_RR && backlog > STEAL_THRESHOLD && atomic_load(&nsleeping) > 0)
+	{
+		wake_idle(i);
+	}
+}
+
+/**
+ * Get an empty item of worker i able to hold n bytes, refilling the
+ * staging free list from the worker's pool in bulk when it runs out.
+ * @return
+ *		The item, NULL if a new one was needed and the memory budget
+ *		refused it
+ */
+static struct queueitem* staging_item(int i, size_t n)
+{
+	struct staging* s = staged + i;
+	if (n > QUEUE_ITEM_CAP)
+	{
+		return queueitem_try_new(i, n);
+	}
+	if (!s->free)
+	{
+		struct worker* w = workers[i];
+		prof_lock(&w->mutex, PROF_LOCK_QUEUE);
+		int k;
+		for (k = 0; k < DISPATCH_BATCH && w->q.free; ++k)
+		{
+			struct queueitem* item = queue_item_get(&w->q, n);
+			item->next = s->free;
+			s->free = item;
+		}
+		pthread_mutex_unlock(&w->mutex);
+	}
+	if (!s->free)
+	{
+		/* Pool exhausted, the item joins the pool once recycled */
+		return queueitem_try_new(i, QUEUE_ITEM_CAP);
+	}
+	struct queueitem* item = s->free;
+	s->free = item->next;
+	return item;
+}
+
+/**
+ * Worker for a packet in DISPATCH_FLOW mode. The hash is symmetric so
+ * both directions of a TCP/UDP flow, over IPv4 or IPv6, go to the same
+ * worker; other frames go by EtherType.
+ */
+static int flow_worker(const unsigned char* packet, int len)
+{
+	struct flow_key key = {0, 0, 0, 0};
+	if (len >= ETH_HLEN + 20 && packet[12] == 0x08 && packet[13] == 0x00)
+	{
+		const unsigned char* ip = packet + ETH_HLEN;
+		key.src = ((uint32_t) ip[12] << 24 | ip[13] << 16 | ip[14] << 8 | ip[15])
+		    ^ ((uint32_t) ip[16] << 24 | ip[17] << 16 | ip[18] << 8 | ip[19]);
+		int ihl = (ip[0] & 0x0f) * 4;
+		if ((ip[9] == 0x06 || ip[9] == 0x11) && len >= ETH_HLEN + ihl + 4)
+		{
+			const unsigned char* l4 = ip + ihl;
+			key.sport = ((l4[0] << 8) | l4[1]) ^ ((l4[2] << 8) | l4[3]);
+		}
+	}
+	else if (len >= ETH_HLEN + 40 && packet[12] == 0x86 && packet[13] == 0xdd)
+	{
+		const unsigned char* ip = packet + ETH_HLEN;
+		struct addr6 src, dst;
+		addr6_load(&src, ip + 8);
+		addr6_load(&dst, ip + 24);
+		key.src = addr6_hash(&src) ^ addr6_hash(&dst);
+		/* Ports are past the extension headers */
+		uint8_t proto;
+		int off = decode_ipv6(ip, len - ETH_HLEN, &proto);
+		if (off >= 0 && (proto == 0x06 || proto == 0x11) && len >= ETH_HLEN + off + 4)
+		{
+			const unsigned char* l4 = ip + off;
+			key.sport = ((l4[0] << 8) | l4[1]) ^ ((l4[2] << 8) | l4[3]);
+		}
+	}
+	else if (len >= ETH_HLEN)
+	{
+		key.dport = (packet[12] << 8) | packet[13];
+	}
+	return flow_hash(&key) % nworkers;
+}
+
+/**
+ * Destination port of a TCP segment over IPv4 or IPv6.
+ * @return
+ *		The port, -1 if the frame is not a TCP segment
+ */
+static int tcp_dport(const unsigned char* packet, int len)
+{
+	const unsigned char* ip = packet + ETH_HLEN;
+	if (len >= ETH_HLEN + 20 && packet[12] == 0x08 && packet[13] == 0x00)
+	{
+		int ihl = (ip[0] & 0x0f) * 4;
+		return ip[9] == 0x06 && len >= ETH_HLEN + ihl + 4 ? (ip[ihl + 2] << 8) | ip[ihl + 3] : -1;
+	}
+	if (len >= ETH_HLEN + 40 && packet[12] == 0x86 && packet[13] == 0xdd)
+	{
+		uint8_t proto;
+		int off = decode_ipv6(ip, len - ETH_HLEN, &proto);
+		return off >= 0 && proto == 0x06 && len >= ETH_HLEN + off + 4 ? (ip[off + 2] << 8) | ip[off + 3] : -1;
+	}
+	return -1;
+}
+
+void dispatch(const struct pcap_pkthdr *header, const unsigned char *packet, int verbose)
+{
+	int i = dispatch_mode == DISPATCH_FLOW
+	    || (ordered_port && tcp_dport(packet, header->caplen) == ordered_port)
+	    ? flow_worker(packet, header->caplen)
+	    : rr_next;
+	struct queueitem* item = staging_item(i, header->caplen);
+	if (!item)
+	{
+		/* Over the memory budget, the backlog has to shrink first */
+		atomic_fetch_add_explicit(&mem_dropped, 1, memory_order_relaxed);
+		return;
+	}
+	memcpy(item->data, packet, header->caplen);
+	item->len = header->caplen;
+	item->wirelen = header->len;
+	item->ts = header->ts;
+	item->verbose = verbose;
+	atomic_init(&item->refs, 1);
+
+	struct staging* s = staged + i;
+	s->items[s->n++] = item;
+	if (s->n == DISPATCH_BATCH)
+	{
+		staging_push(i);
+		rr_next = (rr_next + 1) % nworkers;
+	}
+}
+
+void dispatch_flush(void)
+{
+	int i;
+	for (i = 0; i < nworkers; ++i)
+	{
+		staging_push(i);
+	}
+	rr_next = (rr_next + 1) % nworkers;
+	sampling_update(atomic_load(&pending), get_time());
 }
@@ -4,14 +4,119 @@
 #include <pthread.h>
 #include <pcap.h>
 #include <assert.h>
+#include <sched.h> /* cpu_set_t, sched_getaffinity */
+#include <stdatomic.h> /* atomic_long */
+#include <unistd.h> /* usleep */
 
 #include "analysis.h"
 #include "task_queue.h"
+#include "flow.h" /* flow_hash */
+#include "pcap_writer.h"
+#include "threads.h" /* MAX_THREADS */
 
-#define THREAD_COUNT 10
+/* Packets the capture thread collects for a worker before handing them
+ * over under a single lock */
+#define DISPATCH_BATCH 32
+/* Packets a worker takes from its queue (or steals) at once */
+#define WORKER_BATCH 32
+#if WORKER_BATCH > DECODE_BATCH_MAX
+#error "WORKER_BATCH must fit in a decoded batch"
+#endif
+/* Backlog above which a sleeping worker is woken up to steal */
+#define STEAL_THRESHOLD (2 * DISPATCH_BATCH)
+
+/* How the capture thread distributes packets to workers */
+/* Batches in turn to each worker. TCP segments reassembled by a detector
+ * (analysis_reassembled_port) still go by flow as in DISPATCH_FLOW, a
+ * worker lagging behind would otherwise analyse the end of a request
+ * long after the others saw its start. Only stealing reorders them,
+ * by a few batches at most, which reassembly holds segments for. */
+#define DISPATCH_RR 0
+/* Both directions of a flow to the same worker. Workers do not steal in
+ * this mode, a stolen segment could be analysed before the earlier ones
+ * of its flow and miss reassembly. */
+#define DISPATCH_FLOW 1
+
+/* How workers run the detectors over the packets they take */
+#define DECODE_BATCH 0 /* analyse_batch over up to WORKER_BATCH packets */
+#define DECODE_PACKET 1 /* analyse packet by packet */
+
+/**
+ * Hand a captured packet to a worker. Packets are staged per worker and
+ * only become visible to workers once a batch fills up or on
+ * dispatch_flush. Must only be called from the capture thread.
+ */
+void dispatch(const struct pcap_pkthdr *header, const unsigned char *packet, int verbose);
+
+/**
+ * Hand all staged packets to the workers. Called by the capture thread
+ * whenever it is about to wait for more packets.
+ */
+void dispatch_flush(void);
+
+/**
+ * Create all threads of thread pool. Each worker pins itself to its CPU
+ * (if any) before allocating its queue and packet buffers, so their
+ * memory is local to the NUMA node the worker runs on. Returns once all
+ * workers are ready.
+ * @arg nthreads
+ *		Number of workers, 1 to MAX_THREADS
+ * @arg cpus
+ *		Worker i is pinned to cpus[i % ncpus], NULL to not pin
+ * @arg ncpus
+ *		Number of entries in cpus
+ * @arg mode
+ *		DISPATCH_RR or DISPATCH_FLOW
+ * @arg decode
+ *		DECODE_BATCH or DECODE_PACKET
+ */
+void tpool_init(int nthreads, const int* cpus, int ncpus, int mode, int decode);
+
+/* Wait until every dispatched packet has been analysed */
+void tpool_drain(void);
+
+/* Analyse every packet still queued, then stop and join all worker
+ * threads and free their queues */
+void tpool_destroy(void);
+
+/* Number of packets workers took from another worker's queue */
+unsigned long long tpool_steals(void);
+
+/* Number of captured packets dropped because the memory budget (mem.h)
+ * refused to queue them */
+unsigned long dispatch_mem_dropped(void);
+
+/* Time packets spent in each stage after capture, summed over workers */
+struct tpool_timing
+{
+	unsigned long long analysed; /* Packets */
+	long long queue_wait_us; /* From hand-over to a worker picking it up */
+	long long analyse_us; /* In analyse, including the pcap writer hand-off */
+};
+
+/**
+ * Sum the stage timing of all workers. Only exact while no packet is
+ * pending (after tpool_drain).
+ */
+void tpool_timing(struct tpool_timing* t);
+
+/**
+ * Drop a reference to a dispatched item, giving it back to its pool
+ * when it was the last one. Used as the pcap writer's release function.
+ */
+void dispatch_release(struct queueitem* item);
 
-void dispatch(struct pcap_pkthdr *header, const unsigned char *packet, int verbose);
+/**
+ * Default number of workers: the CPUs this process may run on minus
+ * the given number of capture threads, at least 1.
+ */
+int tpool_default_size(int capture_threads);
 
-/* Create all threads of thread pool */
-void tpool_init(void);
+/**
+ * Pin the calling thread to a set of CPUs.
+ * @return
+ *		1 on success
+ *		0 otherwise.
+ */
+int pin_thread(const int* cpus, int ncpus);
 #endif
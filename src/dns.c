@@ -0,0 +1,46 @@
+#include "dns.h"
+
+/* Limits from RFC 1035 section 2.3.4 */
+#define DNS_MAX_LABEL 63
+#define DNS_MAX_NAME 255
+
+int dns_query_qname(const unsigned char* msg, int n, int* qlen)
+{
+	if (n < DNS_HDR_LEN)
+	{
+		return -1;
+	}
+	/* QR bit clear (query), OPCODE 0 (standard query) */
+	if (msg[2] & 0xf8)
+	{
+		return -1;
+	}
+	/* QDCOUNT */
+	if (((msg[4] << 8) | msg[5]) == 0)
+	{
+		return -1;
+	}
+
+	int i = DNS_HDR_LEN;
+	while (i < n && msg[i] != 0)
+	{
+		/* Labels are at most 63 bytes, larger values are compression
+		 * pointers (0xc0) or reserved, neither is expected in a query */
+		if (msg[i] > DNS_MAX_LABEL)
+		{
+			return -1;
+		}
+		i += 1 + msg[i];
+		if (i - DNS_HDR_LEN >= DNS_MAX_NAME)
+		{
+			return -1;
+		}
+	}
+	if (i >= n)
+	{
+		/* Truncated name */
+		return -1;
+	}
+	*qlen = i + 1 - DNS_HDR_LEN;
+	return DNS_HDR_LEN;
+}
@@ -0,0 +1,24 @@
+#ifndef CS241_DNS_H
+#define CS241_DNS_H
+
+/* Fixed size of the DNS message header */
+#define DNS_HDR_LEN 12
+
+/**
+ * Locates the QNAME of the first question of a DNS query, without
+ * copying it. The name is left in wire format (length prefixed labels
+ * ending with a zero length label). Responses, compressed or malformed
+ * names are rejected.
+ * @arg msg
+ *		UDP payload holding the DNS message
+ * @arg n
+ *		Length of msg
+ * @arg qlen
+ *		Set to the length of the QNAME including the final zero byte
+ * @return
+ *		Offset of the QNAME within msg
+ *		-1 if msg is not a well formed standard query
+ */
+int dns_query_qname(const unsigned char* msg, int n, int* qlen);
+
+#endif
@@ -0,0 +1,219 @@
+#include "domain_index.h"
+/* Includes are in header file */
+
+static int is_domain_char(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.';
+}
+
+int dindex_normalize(char* line)
+{
+	char* hash = strchr(line, '#');
+	if (hash)
+	{
+		*hash = '\0';
+	}
+	char* start = line;
+	while (*start == ' ' || *start == '\t')
+	{
+		++start;
+	}
+	int n = strlen(start);
+	while (n > 0 && (start[n - 1] == ' ' || start[n - 1] == '\t' || start[n - 1] == '\r'
+	    || start[n - 1] == '\n' || start[n - 1] == '.'))
+	{
+		--n;
+	}
+	if (n > DINDEX_NAME_MAX)
+	{
+		return -1;
+	}
+	int i;
+	for (i = 0; i < n; ++i)
+	{
+		line[i] = dindex_lower(start[i]);
+		if (!is_domain_char(line[i]))
+		{
+			return -1;
+		}
+	}
+	line[n] = '\0';
+	return n;
+}
+
+static uint64_t align64(uint64_t n)
+{
+	return (n + 63) & ~63ull;
+}
+
+void* dindex_build(const char* const* names, int n, size_t* size)
+{
+	uint32_t nslots = 16;
+	while (nslots < 2 * (uint64_t) n)
+	{
+		nslots *= 2;
+	}
+	uint32_t blocks = 1;
+	while ((uint64_t) blocks * 512 < (uint64_t) n * DINDEX_BLOOM_BITS)
+	{
+		blocks *= 2;
+	}
+	uint64_t names_size = 0;
+	int i;
+	for (i = 0; i < n; ++i)
+	{
+		names_size += strlen(names[i]) + 1;
+	}
+
+	uint64_t bloom_off = align64(sizeof(struct dindex_header));
+	uint64_t slots_off = bloom_off + (uint64_t) blocks * 64;
+	uint64_t names_off = align64(slots_off + (uint64_t) nslots * sizeof(struct dindex_slot));
+	unsigned char* base = calloc(1, names_off + names_size);
+	if (!base)
+	{
+		return NULL;
+	}
+	struct dindex_header* h = (struct dindex_header*) base;
+	memcpy(h->magic, DINDEX_MAGIC, sizeof(h->magic));
+	h->version = DINDEX_VERSION;
+	h->byte_order = DINDEX_BYTE_ORDER;
+	h->bloom_blocks = blocks;
+	h->nslots = nslots;
+	h->bloom_off = bloom_off;
+	h->slots_off = slots_off;
+	h->names_off = names_off;
+
+	uint64_t* bloom = (uint64_t*) (base + bloom_off);
+	struct dindex_slot* slots = (struct dindex_slot*) (base + slots_off);
+	char* out = (char*) base + names_off;
+	uint64_t used = 0;
+	for (i = 0; i < n; ++i)
+	{
+		int len = strlen(names[i]);
+		uint64_t hash = dindex_hash(names[i], len);
+		uint32_t s = (uint32_t) hash & (nslots - 1);
+		while (slots[s].hash && slots[s].hash != hash)
+		{
+			s = (s + 1) & (nslots - 1);
+		}
+		if (slots[s].hash)
+		{
+			if (strcmp(out + slots[s].name, names[i]) != 0)
+			{
+				/* Lookups go by hash alone until the final compare */
+				fprintf(stderr, "[WARNING] %s dropped, its hash is the one of %s\n",
+				    names[i], out + slots[s].name);
+			}
+			continue;
+		}
+		slots[s].hash = hash;
+		slots[s].name = used;
+		slots[s].id = h->ndomains++;
+		memcpy(out + used, names[i], len + 1);
+		used += len + 1;
+
+		uint64_t* block = bloom + ((hash >> 32) & (blocks - 1)) * 8;
+		uint64_t bits = hash * 0x9e3779b97f4a7c15ull;
+		int k;
+		for (k = 0; k < DINDEX_BLOOM_K; ++k)
+		{
+			int bit = (bits >> (9 * k)) & 511;
+			block[bit >> 6] |= 1ull << (bit & 63);
+		}
+	}
+	h->names_size = used;
+	h->size = names_off + used;
+	*size = h->size;
+	return base;
+}
+
+/**
+ * Whether len bytes at off lie within a file of size bytes. Both come
+ * from the file, so off + len could wrap.
+ */
+static int in_file(uint64_t off, uint64_t len, size_t size)
+{
+	return off <= size && len <= size - off;
+}
+
+int dindex_open(struct dindex* d, const void* base, size_t size, const char* what)
+{
+	const struct dindex_header* h = base;
+	const char* problem = NULL;
+	if (size < sizeof(*h) || memcmp(h->magic, DINDEX_MAGIC, sizeof(h->magic)) != 0)
+	{
+		problem = "is not a domain index";
+	}
+	else if (h->version != DINDEX_VERSION || h->byte_order != DINDEX_BYTE_ORDER)
+	{
+		problem = "was written by another version or host";
+	}
+	else if (h->size != size)
+	{
+		problem = "has the wrong size";
+	}
+	else if (!h->bloom_blocks || (h->bloom_blocks & (h->bloom_blocks - 1))
+	    || !h->nslots || (h->nslots & (h->nslots - 1))
+	    || h->ndomains >= h->nslots
+	    || h->bloom_off % 8 || h->slots_off % 8
+	    || !in_file(h->bloom_off, (uint64_t) h->bloom_blocks * 64, size)
+	    || !in_file(h->slots_off, (uint64_t) h->nslots * sizeof(struct dindex_slot), size)
+	    || !in_file(h->names_off, h->names_size, size) || h->names_size > UINT32_MAX)
+	{
+		problem = "is corrupt";
+	}
+	if (problem)
+	{
+		fprintf(stderr, "[WARNING] Domain index %s %s\n", what, problem);
+		return -1;
+	}
+	d->h = h;
+	d->bloom = (const uint64_t*) ((const char*) base + h->bloom_off);
+	d->slots = (const struct dindex_slot*) ((const char*) base + h->slots_off);
+	d->names = (const char*) base + h->names_off;
+
+	/* Lookups trust the slots: names must be in bounds and terminated,
+	 * and a free slot must end every probe */
+	uint32_t i, used = 0;
+	for (i = 0; i < h->nslots; ++i)
+	{
+		const struct dindex_slot* s = d->slots + i;
+		if (s->hash)
+		{
+			++used;
+			if (s->name >= h->names_size || s->id >= h->ndomains)
+			{
+				break;
+			}
+		}
+	}
+	if (i < h->nslots || used > h->ndomains
+	    || (h->names_size && d->names[h->names_size - 1] != '\0'))
+	{
+		fprintf(stderr, "[WARNING] Domain index %s is corrupt\n", what);
+		return -1;
+	}
+	return 0;
+}
+
+int dindex_write(const char* path, const void* index, size_t size)
+{
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE* f = fopen(tmp, "wb");
+	int ok = f != NULL;
+	ok = ok && fwrite(index, 1, size, f) == size;
+	/* On disk before the rename makes it the one sensors reload */
+	ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+	if (f && fclose(f) != 0)
+	{
+		ok = 0;
+	}
+	if (!ok || rename(tmp, path) != 0)
+	{
+		fprintf(stderr, "[WARNING] Failed to write domain index %s: %s\n", path, strerror(errno));
+		remove(tmp);
+		return -1;
+	}
+	return 0;
+}
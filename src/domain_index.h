@@ -0,0 +1,204 @@
+#ifndef CS241_DOMAIN_INDEX_H
+#define CS241_DOMAIN_INDEX_H
+
+#include <stdio.h> /* fopen, fwrite, rename */
+#include <stdlib.h> /* calloc, free */
+#include <string.h> /* memcmp, memcpy */
+#include <stdint.h> /* uint32_t, uint64_t */
+#include <errno.h> /* errno */
+#include <unistd.h> /* fsync */
+
+/*
+ * Domain index file, a blacklist compiled by idsindex and used in place
+ * once mapped. All integers in host byte order, sections 64 byte
+ * aligned:
+ *
+ *	struct dindex_header
+ *	uint64_t bloom[bloom_blocks * 8]	at bloom_off
+ *	struct dindex_slot[nslots]		at slots_off
+ *	char names[names_size]			at names_off
+ *
+ * Slots are an open addressing table (linear probing, at most half
+ * full) keyed by the hash of a domain. The Bloom filter is blocked, all
+ * bits of a domain are in one cache line, so that the suffixes of a
+ * name that are not in the index, almost all of them, cost one cache
+ * line each and never touch the table. Names are lower case and null
+ * terminated.
+ */
+#define DINDEX_MAGIC "IDSDIDX"
+/* Bump whenever the layout changes, older files are then refused */
+#define DINDEX_VERSION 1
+/* Written as is, reads back differently on a host of other endianness */
+#define DINDEX_BYTE_ORDER 0x01020304u
+/* Longest domain name */
+#define DINDEX_NAME_MAX 253
+/* Bloom filter bits per domain, about 0.2% false positives */
+#define DINDEX_BLOOM_BITS 16
+/* Bits set per domain, 9 bit positions within the 512 bit block */
+#define DINDEX_BLOOM_K 7
+
+struct dindex_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t size; /* Of the whole file, catches truncated files */
+	uint32_t ndomains;
+	uint32_t bloom_blocks; /* Power of two, 64 bytes each */
+	uint32_t nslots; /* Power of two */
+	uint32_t pad;
+	uint64_t bloom_off, slots_off, names_off, names_size;
+};
+
+struct dindex_slot
+{
+	uint64_t hash; /* 0 if the slot is free */
+	uint32_t name; /* Offset in names */
+	uint32_t id; /* Number of the domain, below ndomains */
+};
+
+/* An index in memory, mapped from a file or built */
+struct dindex
+{
+	const struct dindex_header* h;
+	const uint64_t* bloom;
+	const struct dindex_slot* slots;
+	const char* names;
+};
+
+/* ASCII lower case, names in packets are not locale dependent */
+static inline unsigned char dindex_lower(unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/*
+ * Names are hashed from their last character to their first, so that
+ * hashing a name gives the hash of each of its suffixes on the way:
+ * start from DINDEX_HASH_INIT, dindex_step every character right to
+ * left and dindex_final the state wherever a suffix starts.
+ */
+#define DINDEX_HASH_INIT 0xcbf29ce484222325ull
+
+/* FNV-1a step */
+static inline uint64_t dindex_step(uint64_t h, unsigned char c)
+{
+	return (h ^ dindex_lower(c)) * 0x100000001b3ull;
+}
+
+/* splitmix64 finaliser, FNV alone mixes the high bits poorly */
+static inline uint64_t dindex_final(uint64_t h)
+{
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+	h ^= h >> 31;
+	/* 0 marks free slots */
+	return h ? h : 1;
+}
+
+/**
+ * Hash of a whole name.
+ */
+static inline uint64_t dindex_hash(const char* name, int n)
+{
+	uint64_t h = DINDEX_HASH_INIT;
+	while (n > 0)
+	{
+		h = dindex_step(h, name[--n]);
+	}
+	return dindex_final(h);
+}
+
+/**
+ * Whether a domain of hash h may be in the index.
+ * @return
+ *		0 if it is certainly not
+ *		1 otherwise.
+ */
+static inline int dindex_maybe(const struct dindex* d, uint64_t h)
+{
+	const uint64_t* block = d->bloom + ((h >> 32) & (d->h->bloom_blocks - 1)) * 8;
+	uint64_t bits = h * 0x9e3779b97f4a7c15ull;
+	int k;
+	for (k = 0; k < DINDEX_BLOOM_K; ++k)
+	{
+		int bit = (bits >> (9 * k)) & 511;
+		if (!(block[bit >> 6] & (1ull << (bit & 63))))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Look up a domain by hash.
+ * @return
+ *		The slot of the domain, whose name the caller must compare
+ *		NULL if no domain has that hash
+ */
+static inline const struct dindex_slot* dindex_find(const struct dindex* d, uint64_t h)
+{
+	uint32_t mask = d->h->nslots - 1;
+	uint32_t i = (uint32_t) h & mask;
+	while (d->slots[i].hash)
+	{
+		if (d->slots[i].hash == h)
+		{
+			return d->slots + i;
+		}
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+/**
+ * Clean up a line of a domain list in place: drops leading and trailing
+ * white space, a trailing root dot and comments (#), lower cases.
+ * @return
+ *		Length of the domain
+ *		0 if the line has none
+ *		-1 if it is too long or has characters no domain has
+ */
+int dindex_normalize(char* line);
+
+/**
+ * Build an index in memory.
+ * @arg names
+ *		Domains, normalized (dindex_normalize); duplicates are dropped
+ * @arg n
+ *		Number of names
+ * @arg size
+ *		Set to the size of the index
+ * @return
+ *		The index, to be written to a file or used with dindex_open and
+ *		released with free
+ *		NULL if out of memory
+ */
+void* dindex_build(const char* const* names, int n, size_t* size);
+
+/**
+ * Check that an index is well formed and set up d to use it in place.
+ * Every offset is checked so that lookups never read past the index.
+ * @arg base
+ *		The index, mapped or as built, 8 byte aligned
+ * @arg size
+ *		Its size
+ * @arg what
+ *		Name of the index in messages
+ * @return
+ *		0 on success
+ *		-1 if the index is malformed, after printing why
+ */
+int dindex_open(struct dindex* d, const void* base, size_t size, const char* what);
+
+/**
+ * Write an index to path, through a temporary file renamed into place
+ * so that a sensor reloading the index never reads a partial file.
+ * @return
+ *		0 on success
+ *		-1 on failure, after printing why
+ */
+int dindex_write(const char* path, const void* index, size_t size);
+
+#endif
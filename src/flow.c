@@ -0,0 +1,37 @@
+#include "flow.h"
+
+/**
+ * Hash a flow key, suitable for indexing power of two sized tables.
+ * @arg key
+ *		The flow to hash
+ * @return
+ *		32 bit hash of the 4-tuple
+ */
+uint32_t flow_hash(const struct flow_key* key)
+{
+	/* Multiplicative mixing of each word followed by the murmur3
+	 * finaliser so that the low bits depend on the whole tuple */
+	uint32_t h = key->src * 0x9e3779b1u;
+	h ^= key->dst * 0x85ebca77u;
+	h ^= (((uint32_t) key->sport << 16) | key->dport) * 0xc2b2ae3du;
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+/**
+ * Compare two flow keys.
+ * @return
+ *		1 if both keys describe the same flow
+ *		0 otherwise.
+ */
+int flow_key_eq(const struct flow_key* a, const struct flow_key* b)
+{
+	return a->src == b->src
+	    && a->dst == b->dst
+	    && a->sport == b->sport
+	    && a->dport == b->dport;
+}
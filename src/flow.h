@@ -0,0 +1,37 @@
+#ifndef CS241_FLOW_H
+#define CS241_FLOW_H
+
+#include <stdint.h> /* uint32_t, uint16_t */
+
+/**
+ * Identifies one direction of a TCP/UDP conversation (the 4-tuple).
+ * Addresses and ports are stored in host byte order.
+ */
+struct flow_key
+{
+	uint32_t
+		src,	/* Source IP address */
+		dst;	/* Destination IP address */
+	uint16_t
+		sport,	/* Source port */
+		dport;	/* Destination port */
+};
+
+/**
+ * Hash a flow key, suitable for indexing power of two sized tables.
+ * @arg key
+ *		The flow to hash
+ * @return
+ *		32 bit hash of the 4-tuple
+ */
+uint32_t flow_hash(const struct flow_key* key);
+
+/**
+ * Compare two flow keys.
+ * @return
+ *		1 if both keys describe the same flow
+ *		0 otherwise.
+ */
+int flow_key_eq(const struct flow_key* a, const struct flow_key* b);
+
+#endif
@@ -0,0 +1,148 @@
+#include "flow_cache.h"
+/* Includes are in header file */
+
+struct fcache_entry
+{
+	struct flow_key key;
+	unsigned char
+		valid,		/* Entry holds a flow */
+		referenced,	/* CLOCK reference bit, set on every hit */
+		verdict;
+};
+
+/* One set of the cache. Counters are kept per bucket, under the bucket
+ * mutex, so counting adds no shared cache line to the packet path. */
+struct fcache_bucket
+{
+	pthread_mutex_t mutex;
+	struct fcache_entry entries[FCACHE_WAYS];
+	int hand; /* CLOCK hand, next way considered for eviction */
+	unsigned long long hits, misses, evictions;
+};
+
+static struct fcache_bucket* buckets;
+
+void fcache_init(void)
+{
+	buckets = mem_alloc(MEM_FCACHE, FCACHE_BUCKETS * sizeof(struct fcache_bucket), 1);
+	int b;
+	for (b = 0; b < FCACHE_BUCKETS; ++b)
+	{
+		pthread_mutex_init(&buckets[b].mutex, NULL);
+	}
+}
+
+void fcache_destroy(void)
+{
+	int b;
+	for (b = 0; b < FCACHE_BUCKETS; ++b)
+	{
+		pthread_mutex_destroy(&buckets[b].mutex);
+	}
+	mem_free(MEM_FCACHE, buckets, FCACHE_BUCKETS * sizeof(struct fcache_bucket));
+}
+
+static struct fcache_bucket* fcache_bucket_of(const struct flow_key* key)
+{
+	return buckets + (flow_hash(key) & (FCACHE_BUCKETS - 1));
+}
+
+/**
+ * Find a flow in a bucket. Bucket mutex must be held.
+ * @return
+ *		The entry or NULL if the flow is not cached
+ */
+static struct fcache_entry* fcache_find(struct fcache_bucket* b, const struct flow_key* key)
+{
+	int w;
+	for (w = 0; w < FCACHE_WAYS; ++w)
+	{
+		if (b->entries[w].valid && flow_key_eq(&b->entries[w].key, key))
+		{
+			return b->entries + w;
+		}
+	}
+	return NULL;
+}
+
+int fcache_lookup(const struct flow_key* key, int* verdict)
+{
+	struct fcache_bucket* b = fcache_bucket_of(key);
+	pthread_mutex_lock(&b->mutex);
+	struct fcache_entry* e = fcache_find(b, key);
+	if (e)
+	{
+		e->referenced = 1;
+		*verdict = e->verdict;
+		b->hits++;
+	}
+	else
+	{
+		b->misses++;
+	}
+	pthread_mutex_unlock(&b->mutex);
+	return e != NULL;
+}
+
+void fcache_insert(const struct flow_key* key, int verdict)
+{
+	struct fcache_bucket* b = fcache_bucket_of(key);
+	pthread_mutex_lock(&b->mutex);
+	struct fcache_entry* e = fcache_find(b, key);
+	int w;
+	for (w = 0; !e && w < FCACHE_WAYS; ++w)
+	{
+		if (!b->entries[w].valid)
+		{
+			e = b->entries + w;
+		}
+	}
+	/* Bucket full: sweep the CLOCK hand, giving referenced entries a
+	 * second chance. Terminates within two sweeps. */
+	while (!e)
+	{
+		struct fcache_entry* c = b->entries + b->hand;
+		b->hand = (b->hand + 1) % FCACHE_WAYS;
+		if (c->referenced)
+		{
+			c->referenced = 0;
+		}
+		else
+		{
+			e = c;
+			b->evictions++;
+		}
+	}
+	e->key = *key;
+	e->valid = 1;
+	e->referenced = 0;
+	e->verdict = verdict;
+	pthread_mutex_unlock(&b->mutex);
+}
+
+void fcache_remove(const struct flow_key* key)
+{
+	struct fcache_bucket* b = fcache_bucket_of(key);
+	pthread_mutex_lock(&b->mutex);
+	struct fcache_entry* e = fcache_find(b, key);
+	if (e)
+	{
+		e->valid = 0;
+	}
+	pthread_mutex_unlock(&b->mutex);
+}
+
+void fcache_counters(struct fcache_counters* c)
+{
+	c->hits = c->misses = c->evictions = 0;
+	int i;
+	for (i = 0; i < FCACHE_BUCKETS; ++i)
+	{
+		struct fcache_bucket* b = buckets + i;
+		pthread_mutex_lock(&b->mutex);
+		c->hits += b->hits;
+		c->misses += b->misses;
+		c->evictions += b->evictions;
+		pthread_mutex_unlock(&b->mutex);
+	}
+}
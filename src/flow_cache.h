@@ -0,0 +1,71 @@
+#ifndef CS241_FLOW_CACHE_H
+#define CS241_FLOW_CACHE_H
+
+#include <stdlib.h> /* calloc, free */
+#include <stdio.h> /* fprintf */
+#include <pthread.h> /* pthread_mutex_t */
+#include "mem.h" /* mem_alloc */
+
+#include "flow.h" /* struct flow_key */
+
+/* Cache geometry, FCACHE_BUCKETS * FCACHE_WAYS flows are remembered at
+ * most. FCACHE_BUCKETS must be a power of two. */
+#define FCACHE_BUCKETS 1024
+#define FCACHE_WAYS 8
+
+/* Totals over all buckets, see fcache_counters */
+struct fcache_counters
+{
+	unsigned long long
+		hits,		/* Lookups that found a verdict */
+		misses,		/* Lookups that found nothing */
+		evictions;	/* Verdicts dropped to make room for new flows */
+};
+
+/**
+ * Allocate the cache. Must be called before any other fcache_ function.
+ */
+void fcache_init(void);
+
+/**
+ * Free all resources of the cache.
+ */
+void fcache_destroy(void);
+
+/**
+ * Look up the verdict of an already classified flow.
+ * @arg key
+ *		The flow to look up
+ * @arg verdict
+ *		Set to the cached verdict on a hit
+ * @return
+ *		1 on a hit
+ *		0 on a miss
+ */
+int fcache_lookup(const struct flow_key* key, int* verdict);
+
+/**
+ * Remember the verdict of a flow, evicting another flow of the same
+ * bucket (CLOCK order) if the bucket is full.
+ * @arg key
+ *		The flow that was classified
+ * @arg verdict
+ *		The verdict to remember
+ */
+void fcache_insert(const struct flow_key* key, int verdict);
+
+/**
+ * Forget a flow, for instance once it has been closed.
+ * @arg key
+ *		The flow to forget
+ */
+void fcache_remove(const struct flow_key* key);
+
+/**
+ * Sum the hit/miss/eviction counters of all buckets.
+ * @arg c
+ *		Filled with the totals
+ */
+void fcache_counters(struct fcache_counters* c);
+
+#endif
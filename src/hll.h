@@ -0,0 +1,85 @@
+#ifndef CS241_HLL_H
+#define CS241_HLL_H
+
+#include <stdint.h> /* uint8_t, uint64_t */
+#include <stdatomic.h> /* atomic_uchar */
+#include <math.h> /* log */
+
+/* Register index bits, 2^HLL_BITS registers of one byte each; the
+ * standard error of the estimate is 1.04 / sqrt(2^HLL_BITS), 1.6% */
+#define HLL_BITS 12
+#define HLL_REGISTERS (1 << HLL_BITS)
+
+/**
+ * HyperLogLog sketch of distinct 32 bit values. Each register keeps the
+ * longest run of leading zeros seen among the values hashed to it, so
+ * that two sketches of the same size merge exactly by taking the
+ * register-wise maximum: the sketch of a union is the merge of the
+ * sketches of its parts, whichever sensor saw which value.
+ */
+
+/* splitmix64 finaliser, every input bit affects every output bit */
+static inline uint64_t hll_hash(uint32_t v)
+{
+	uint64_t h = v + 0x9e3779b97f4a7c15ull;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+	return h ^ (h >> 31);
+}
+
+/**
+ * Add a value. Safe to call from any number of threads at once, a
+ * register only ever grows.
+ */
+static inline void hll_add(atomic_uchar* regs, uint32_t v)
+{
+	uint64_t h = hll_hash(v);
+	atomic_uchar* r = regs + (h >> (64 - HLL_BITS));
+	/* Rank of the remaining bits, the sentinel bit bounds it */
+	uint64_t rest = (h << HLL_BITS) | (1ull << (HLL_BITS - 1));
+	unsigned char rank = __builtin_clzll(rest) + 1;
+	unsigned char cur = atomic_load_explicit(r, memory_order_relaxed);
+	while (rank > cur
+	    && !atomic_compare_exchange_weak_explicit(r, &cur, rank, memory_order_relaxed, memory_order_relaxed))
+	{
+		/* cur reloaded, retry while still larger */
+	}
+}
+
+/**
+ * Take the register-wise maximum of two sketches into the first.
+ */
+static inline void hll_merge(uint8_t* into, const uint8_t* regs)
+{
+	int i;
+	for (i = 0; i < HLL_REGISTERS; ++i)
+	{
+		into[i] = regs[i] > into[i] ? regs[i] : into[i];
+	}
+}
+
+/**
+ * @return
+ *		Estimated number of distinct values added, with linear counting
+ *		for small cardinalities where the raw estimate is biased
+ */
+static inline double hll_estimate(const uint8_t* regs)
+{
+	const double m = HLL_REGISTERS;
+	double sum = 0;
+	int zeros = 0;
+	int i;
+	for (i = 0; i < HLL_REGISTERS; ++i)
+	{
+		sum += 1.0 / (double) (1ull << regs[i]);
+		zeros += regs[i] == 0;
+	}
+	double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+	if (e <= 2.5 * m && zeros)
+	{
+		e = m * log(m / zeros);
+	}
+	return e;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "summary.h"
+
+/*
+ * Aggregator of sensor summaries (idsniff -s): merges any number of
+ * summary files and prints the combined report. With -o the merged
+ * summary is written too, so that aggregation can be done in stages.
+ */
+
+void print_usage(char *progname)
+{
+	fprintf(stderr, "Merges the summaries written by idsniff -s into one report\n");
+	fprintf(stderr, "Usage: %s [-o merged] SUMMARY...\n\n", progname);
+	fprintf(stderr, "\t-o [file]\tAlso write the merged summary to file\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char *out = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "o:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'o':
+				out = optarg;
+				break;
+			default:
+				print_usage(argv[0]);
+				exit(1);
+		}
+	}
+	if (optind == argc)
+	{
+		print_usage(argv[0]);
+		exit(1);
+	}
+
+	struct summary merged, s;
+	memset(&merged, 0, sizeof(merged));
+	int failed = 0;
+	int i;
+	for (i = optind; i < argc; ++i)
+	{
+		if (summary_read(argv[i], &s) != 0)
+		{
+			++failed;
+			continue;
+		}
+		summary_merge(&merged, &s);
+	}
+	if (!merged.sensors)
+	{
+		fprintf(stderr, "%s\n", "[ERROR] No summary could be read");
+		exit(1);
+	}
+	if (failed)
+	{
+		fprintf(stderr, "[WARNING] %d of %d summaries skipped\n", failed, argc - optind);
+	}
+	summary_report(&merged);
+	if (out && summary_write(out, &merged) != 0)
+	{
+		exit(1);
+	}
+	return 0;
+}
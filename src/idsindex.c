@@ -0,0 +1,124 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "domain_index.h"
+
+/*
+ * Compiler of domain lists into the index idsniff -b maps: one domain
+ * per line, # starts a comment. The index is written through a
+ * temporary file and renamed, so that it can replace the one a sensor
+ * uses and be followed by a SIGHUP.
+ */
+
+void print_usage(char *progname)
+{
+	fprintf(stderr, "Builds the domain index idsniff -b loads from domain lists\n");
+	fprintf(stderr, "Usage: %s -o index LIST...\n\n", progname);
+	fprintf(stderr, "\t-o [file]\tIndex to write\n");
+	fprintf(stderr, "\tLIST\t\tOne domain per line, - for standard input\n");
+}
+
+/* Domains read so far */
+static char **names = NULL;
+static int nnames = 0, capacity = 0;
+
+/**
+ * Read the domains of a list.
+ * @return
+ *		Number of lines skipped as malformed
+ *		-1 if the list cannot be read
+ */
+static int read_list(const char *path)
+{
+	FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	if (!f)
+	{
+		fprintf(stderr, "[ERROR] Cannot open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	char line[4096];
+	int lineno = 0, skipped = 0;
+	while (fgets(line, sizeof(line), f))
+	{
+		++lineno;
+		int n = dindex_normalize(line);
+		if (n < 0)
+		{
+			if (skipped++ < 10)
+			{
+				fprintf(stderr, "[WARNING] %s:%d is not a domain, skipped\n", path, lineno);
+			}
+			continue;
+		}
+		if (n == 0)
+		{
+			continue;
+		}
+		if (nnames == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 1024;
+			names = realloc(names, capacity * sizeof(char*));
+		}
+		if (!names || !(names[nnames++] = strdup(line)))
+		{
+			fprintf(stderr, "%s\n", "[ERROR] Out of memory");
+			exit(1);
+		}
+	}
+	if (f != stdin)
+	{
+		fclose(f);
+	}
+	return skipped;
+}
+
+int main(int argc, char *argv[])
+{
+	char *out = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "o:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'o':
+				out = optarg;
+				break;
+			default:
+				print_usage(argv[0]);
+				exit(1);
+		}
+	}
+	if (!out || optind == argc)
+	{
+		print_usage(argv[0]);
+		exit(1);
+	}
+
+	int skipped = 0;
+	int i;
+	for (i = optind; i < argc; ++i)
+	{
+		int s = read_list(argv[i]);
+		if (s < 0)
+		{
+			exit(1);
+		}
+		skipped += s;
+	}
+	size_t size;
+	void *index = dindex_build((const char* const*) names, nnames, &size);
+	if (!index)
+	{
+		fprintf(stderr, "%s\n", "[ERROR] Out of memory");
+		exit(1);
+	}
+	if (dindex_write(out, index, size) != 0)
+	{
+		exit(1);
+	}
+	const struct dindex_header *h = index;
+	printf("%s: %u domains (%d duplicates, %d malformed lines skipped), %zu bytes\n",
+	    out, h->ndomains, nnames - (int) h->ndomains, skipped, size);
+	return 0;
+}
@@ -109,13 +109,17 @@ int ip_set_remove(struct ip_set* ips, uint32_t a)
  */
 static int ip_set_realloc(struct ip_set* ips, int factor)
 {
-	ips->capacity *= factor;
-	ips->data = realloc(ips->data, ips->capacity * ips->unit_size);
-	if (!ips->data)
+	/* Refused once the memory budget is spent, the set stays as is */
+	void* data = mem_try_alloc(MEM_IPSET, ips->capacity * factor * ips->unit_size);
+	if (!data)
 	{
-		fprintf(stderr, "[ERROR] Failed to realloc set to capacity %d\n", ips->capacity);
+		fprintf(stderr, "[ERROR] Failed to realloc set to capacity %d\n", ips->capacity * factor);
 		return 0;
 	}
+	memcpy(data, ips->data, ips->size * ips->unit_size);
+	mem_free(MEM_IPSET, ips->data, ips->capacity * ips->unit_size);
+	ips->data = data;
+	ips->capacity *= factor;
 	return 1;
 }
 
@@ -153,7 +157,7 @@ void ip_set_init(struct ip_set* ips)
 	ips->size = 0;
 	ips->capacity = 8; /* Initial capacity of IP set */
 	ips->unit_size = sizeof(uint32_t); /* Size of uint32_t, 4 bytes per address */
-	ips->data = malloc(ips->capacity * ips->unit_size);
+	ips->data = mem_alloc(MEM_IPSET, ips->capacity * ips->unit_size, 0);
 	if (!ips->data)
 	{
 		fprintf(stderr, "%s\n", "[ERROR] Failed to initialise IP set (memory allocation error)");
@@ -196,7 +200,7 @@ int ip_set_has(struct ip_set* ips, uint32_t ip)
  */
 void ip_set_destroy(struct ip_set* ips)
 {
-	free(ips->data);
+	mem_free(MEM_IPSET, ips->data, ips->capacity * ips->unit_size);
 }
 
 /*
@@ -268,6 +272,229 @@ int ip_set_add(struct ip_set* ips, uint32_t a)
 	}
 }
 
+/* Batches up to this size are sorted on the stack */
+#define BULK_STACK 256
+/* Batches up to this size are insertion sorted, radix sort passes cost
+ * more below */
+#define BULK_INSERTION 32
+
+/**
+ * Sort a in ascending order, using tmp (n elements) as scratch space:
+ * least significant digit radix sort, a byte per pass. Passes where all
+ * elements have the same byte are skipped.
+ */
+static void radix_sort(uint32_t* a, uint32_t* tmp, int n)
+{
+	if (n <= BULK_INSERTION)
+	{
+		int i;
+		for (i = 1; i < n; ++i)
+		{
+			uint32_t x = a[i];
+			int j = i - 1;
+			while (j >= 0 && a[j] > x)
+			{
+				a[j + 1] = a[j];
+				--j;
+			}
+			a[j + 1] = x;
+		}
+		return;
+	}
+	uint32_t* from = a;
+	uint32_t* to = tmp;
+	int shift;
+	for (shift = 0; shift < 32; shift += 8)
+	{
+		int count[256] = {0};
+		int i;
+		for (i = 0; i < n; ++i)
+		{
+			++count[(from[i] >> shift) & 0xff];
+		}
+		if (count[(from[0] >> shift) & 0xff] == n)
+		{
+			continue;
+		}
+		int pos = 0;
+		for (i = 0; i < 256; ++i)
+		{
+			int c = count[i];
+			count[i] = pos;
+			pos += c;
+		}
+		for (i = 0; i < n; ++i)
+		{
+			to[count[(from[i] >> shift) & 0xff]++] = from[i];
+		}
+		uint32_t* t = from;
+		from = to;
+		to = t;
+	}
+	if (from != a)
+	{
+		memcpy(a, from, n * sizeof(uint32_t));
+	}
+}
+
+/**
+ * Merge sorted distinct elements into the set.
+ * @return
+ *		Number of elements that were not in the set already
+ *		-1 if the set could not grow
+ */
+static int ip_set_merge(struct ip_set* ips, const uint32_t* b, int m)
+{
+	if (m == 0)
+	{
+		return 0;
+	}
+	int factor = 1;
+	while ((long) ips->capacity * factor < (long) ips->size + m)
+	{
+		factor *= 2;
+	}
+	if (factor > 1 && !ip_set_realloc(ips, factor))
+	{
+		return -1;
+	}
+	/* From the end down, so that elements of the set are written past
+	 * the ones still to be read; elements in both are written once and
+	 * leave a gap at the front */
+	uint32_t* d = ips->data;
+	int i = ips->size - 1, j = m - 1, w = ips->size + m - 1;
+	while (j >= 0)
+	{
+		if (i >= 0 && d[i] > b[j])
+		{
+			d[w--] = d[i--];
+		}
+		else
+		{
+			if (i >= 0 && d[i] == b[j])
+			{
+				--i;
+			}
+			d[w--] = b[j--];
+		}
+	}
+	/* The remaining elements of the set are in place unless there was a
+	 * gap */
+	int gap = w - i;
+	if (gap > 0)
+	{
+		memmove(d + i + 1, d + w + 1, (ips->size + m - 1 - w) * sizeof(uint32_t));
+	}
+	int added = m - gap;
+	ips->size += added;
+	return added;
+}
+
+/**
+ * Insert a batch of elements in the set at once: the batch is sorted
+ * (radix sort) and rid of duplicates, then merged into the set in one
+ * pass from the end, each element of the set moving once at most.
+ * @arg ips
+ *		The set to be acted on
+ * @arg a
+ *		The elements, in any order and possibly repeated; left as is
+ * @arg n
+ *		Number of elements
+ * @return
+ *		Number of elements that were not in the set already
+ *		-1 if the insertion was unsuccessful, the set is then unchanged
+ */
+int ip_set_add_bulk(struct ip_set* ips, const uint32_t* a, int n)
+{
+	if (n <= 0)
+	{
+		return 0;
+	}
+	uint32_t stack[2 * BULK_STACK];
+	uint32_t* sorted = stack;
+	if (n > BULK_STACK)
+	{
+		sorted = mem_try_alloc(MEM_IPSET, 2 * n * sizeof(uint32_t));
+		if (!sorted)
+		{
+			fprintf(stderr, "[ERROR] Failed to sort a batch of %d elements\n", n);
+			return -1;
+		}
+	}
+	memcpy(sorted, a, n * sizeof(uint32_t));
+	radix_sort(sorted, sorted + n, n);
+	int m = 1, i;
+	for (i = 1; i < n; ++i)
+	{
+		if (sorted[i] != sorted[m - 1])
+		{
+			sorted[m++] = sorted[i];
+		}
+	}
+	int added = ip_set_merge(ips, sorted, m);
+	if (sorted != stack)
+	{
+		mem_free(MEM_IPSET, sorted, 2 * n * sizeof(uint32_t));
+	}
+	return added;
+}
+
+/**
+ * Insert every element of another set, for merging the sets of several
+ * threads.
+ * @arg ips
+ *		The set to be acted on
+ * @arg other
+ *		The set whose elements are inserted, left as is
+ * @return
+ *		Number of elements that were not in the set already
+ *		-1 if the insertion was unsuccessful, the set is then unchanged
+ */
+int ip_set_union(struct ip_set* ips, const struct ip_set* other)
+{
+	if (other == ips)
+	{
+		/* Nothing to add, and merging would free other->data when the
+		 * set grows, before reading it */
+		return 0;
+	}
+	/* Already sorted and distinct */
+	return ip_set_merge(ips, other->data, other->size);
+}
+
+/**
+ * Remove the elements not in another set, in one pass over both.
+ * @arg ips
+ *		The set to be acted on
+ * @arg other
+ *		The set to intersect with, left as is
+ * @return
+ *		Number of elements removed
+ */
+int ip_set_intersect(struct ip_set* ips, const struct ip_set* other)
+{
+	int i = 0, j = 0, w = 0;
+	while (i < ips->size && j < other->size)
+	{
+		if (ips->data[i] < other->data[j])
+		{
+			++i;
+		}
+		else if (ips->data[i] > other->data[j])
+		{
+			++j;
+		}
+		else
+		{
+			ips->data[w++] = ips->data[i++];
+			++j;
+		}
+	}
+	int removed = ips->size - w;
+	ips->size = w;
+	return removed;
+}
+
 /*
  * Output set in mathematical notation (elements in curly
  * brackets, separated by commas). No new line is printed.
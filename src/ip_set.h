@@ -4,6 +4,8 @@
 #include <stdio.h> /* printf, fprintf, puts */
 #include <stdint.h> /* uint32_t */
 #include <inttypes.h> /* PRIu32 */
+#include <string.h> /* memcpy */
+#include "mem.h" /* mem_alloc */
 
 /** Set implementated using a sorted array. */
 struct ip_set
@@ -86,6 +88,46 @@ int ip_set_has(struct ip_set* ips, uint32_t ip);
  */
 int ip_set_add(struct ip_set* ips, uint32_t a);
 
+/**
+ * Insert a batch of elements in the set at once: the batch is sorted
+ * (radix sort) and rid of duplicates, then merged into the set in one
+ * pass from the end, each element of the set moving once at most.
+ * @arg ips
+ *		The set to be acted on
+ * @arg a
+ *		The elements, in any order and possibly repeated; left as is
+ * @arg n
+ *		Number of elements
+ * @return
+ *		Number of elements that were not in the set already
+ *		-1 if the insertion was unsuccessful, the set is then unchanged
+ */
+int ip_set_add_bulk(struct ip_set* ips, const uint32_t* a, int n);
+
+/**
+ * Insert every element of another set, for merging the sets of several
+ * threads.
+ * @arg ips
+ *		The set to be acted on
+ * @arg other
+ *		The set whose elements are inserted, left as is
+ * @return
+ *		Number of elements that were not in the set already
+ *		-1 if the insertion was unsuccessful, the set is then unchanged
+ */
+int ip_set_union(struct ip_set* ips, const struct ip_set* other);
+
+/**
+ * Remove the elements not in another set, in one pass over both.
+ * @arg ips
+ *		The set to be acted on
+ * @arg other
+ *		The set to intersect with, left as is
+ * @return
+ *		Number of elements removed
+ */
+int ip_set_intersect(struct ip_set* ips, const struct ip_set* other);
+
 /*
  * Output set in mathematical notation (elements in curly
  * brackets, separated by commas). No new line is printed.
@@ -3,55 +3,152 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h> /* errno, ERANGE */
+#include <limits.h> /* INT_MAX */
 #include <sys/time.h> /* timeval, gettimeofday */
+#include <sys/resource.h> /* getrusage */
 #include <unistd.h> /* Signal handling */
 
 #include "sniff.h"
 #include "dispatch.h"
 #include "analysis.h"
+#include "checkpoint.h"
+#include "sampling.h"
+#include "summary.h"
+#include "mem.h"
 
 /* Comment out to stop exiting when receiving Ctrl+C 
  * Warning: May have problems terminating the program!
  * Do so at your own risk. */
 #define EXIT_ON_CTRLC
 
+/* Most flooded destinations listed in the report */
+#define FLOOD_TOP 5
+
 // Command line options
-#define OPTSTRING "vi:"
+#define OPTSTRING "vi:e:S:W:t:r:C:T:m:k:K:R:w:z:Z:j:d:O:s:B:n:o:IPM:b:x:D:A:p"
 static struct option long_opts[] = {
 	{"interface", optional_argument, NULL, 'i'},
-	{"verbose",   optional_argument, NULL, 'v'}
+	{"verbose",   optional_argument, NULL, 'v'},
+	{"epoch",     required_argument, NULL, 'e'},
+	{"sources",   required_argument, NULL, 'S'},
+	{"window",    required_argument, NULL, 'W'},
+	{"threads",   required_argument, NULL, 't'},
+	{"read",      required_argument, NULL, 'r'},
+	{"capture-cpus", required_argument, NULL, 'C'},
+	{"worker-cpus",  required_argument, NULL, 'T'},
+	{"sched",     required_argument, NULL, 'm'},
+	{"checkpoint", required_argument, NULL, 'k'},
+	{"checkpoint-interval", required_argument, NULL, 'K'},
+	{"restore",   required_argument, NULL, 'R'},
+	{"write-pcap", required_argument, NULL, 'w'},
+	{"pcap-size", required_argument, NULL, 'z'},
+	{"pcap-files", required_argument, NULL, 'Z'},
+	{"stats-json", required_argument, NULL, 'j'},
+	{"decode",    required_argument, NULL, 'd'},
+	{"overload",  required_argument, NULL, 'O'},
+	{"summary",   required_argument, NULL, 's'},
+	{"buffer",    required_argument, NULL, 'B'},
+	{"snaplen",   required_argument, NULL, 'n'},
+	{"timeout",   required_argument, NULL, 'o'},
+	{"immediate", no_argument,       NULL, 'I'},
+	{"no-promisc", no_argument,      NULL, 'P'},
+	{"mem-limit", required_argument, NULL, 'M'},
+	{"blacklist", required_argument, NULL, 'b'},
+	{"disable",   required_argument, NULL, 'x'},
+	{"debug",     required_argument, NULL, 'D'},
+	{"allowlist", required_argument, NULL, 'A'},
+	{"profile",   no_argument,       NULL, 'p'},
+	{NULL, 0, NULL, 0}
 };
 
 struct arguments {
 	char *interface;
 	int verbose;
+	int epoch; /* Seconds between reports, 0 to report on exit only */
+	int sources; /* Capacity of the SYN source table */
+	int window; /* Seconds a SYN source counts towards the unique ratio */
+	int threads; /* Worker threads, 0 for one per available CPU */
+	char *file; /* pcap file to replay instead of capturing, or NULL */
+	struct sniff_options capture; /* Set up of the live capture */
+	int capture_cpus[MAX_THREADS]; /* CPUs the capture thread may run on */
+	int ncapture_cpus; /* 0 to not pin */
+	int worker_cpus[MAX_THREADS]; /* Worker i runs on worker_cpus[i % nworker_cpus] */
+	int nworker_cpus; /* 0 to not pin */
+	int sched; /* DISPATCH_RR or DISPATCH_FLOW */
+	int decode; /* DECODE_BATCH or DECODE_PACKET */
+	int overload; /* Backlog (packets) above which payloads are sampled, 0 never */
+	char *checkpoint; /* File to save snapshots of the state to, or NULL */
+	int checkpoint_interval; /* Seconds between snapshots */
+	char *restore; /* Snapshot to start from, or NULL */
+	char *pcap_prefix; /* Prefix of the files detected packets go to, or NULL */
+	int pcap_size; /* MB per file */
+	int pcap_files; /* Files kept before the oldest is overwritten */
+	char *stats_json; /* File to write run measurements to, or NULL */
+	char *summary; /* File to write a mergeable summary of each epoch to, or NULL */
+	int mem_limit; /* Memory budget (MB), 0 for none */
+	char *blacklist; /* Domain index (idsindex) to map, or NULL for the built in list */
+	char *disable; /* Comma separated detectors to leave out, or NULL */
+	char *allowlist; /* Networks whose SYN packets are ignored, or NULL */
+	int profile; /* Count hardware events and mutex waits per stage */
 };
 
 /* GLOBAL VARS */
 
 /* Keeps main sniff loop running when set to 0 */
-char should_exit = 0;
-
-/* Set for IP addresses, stored to detect SYN flooding attack */
-struct ip_set unique_ips;
+volatile sig_atomic_t should_exit = 0;
 
-/* Count of TCP SYN packets received */
-int total_syn_packets = 0;
+/* Detector statistics live in struct stats (stats.h), one per epoch */
 
-/* Count of ARP packets received */
-int total_arp_packets = 0;
+/* SYN sources seen within the last window, to detect SYN flooding attack */
+struct src_table syn_sources;
 
-/* Count of packets to blacklisted URLs */
-int total_blacklist_viol = 0;
+/* Ports and hosts recently tried by each source, to detect port scans */
+struct scan_table scan_sources;
 
-long long first_syn_time, last_syn_time;
+/* Token buckets of UDP and ICMP destinations, to detect floods */
+struct rate_table flood_dests;
 
-/*pthread_mutex_t total_syn_packets_mutex;*/
+/* Summary of each reported epoch goes there (-s), or NULL */
+static char *summary_path = NULL;
 
 /* END GLOBAL VARS */
 
+long long get_time(void);
+
+/* Prints a line of the DNS section of the report */
+static void print_query_count(const char* domain, unsigned long queries, void* arg)
+{
+	printf("\t%lu queries for %s\n", queries, domain);
+}
 
-void output_report(void)
+/**
+ * Print use of the memory budget, per subsystem since start.
+ */
+static void output_memory(void)
+{
+	struct mem_usage use[MEM_SUBSYSTEMS];
+	size_t total = mem_usage(use);
+	if (mem_limit())
+	{
+		printf("Memory: %zu of %zu KB in use, %lu allocations refused, %lu packets dropped\n",
+		    total / 1024, mem_limit() / 1024, mem_refused(), dispatch_mem_dropped());
+	}
+	else
+	{
+		printf("Memory: %zu KB in use\n", total / 1024);
+	}
+	int i;
+	for (i = 0; i < MEM_SUBSYSTEMS; ++i)
+	{
+		if (use[i].peak)
+		{
+			printf("\t%s: %zu KB, peak %zu KB\n", use[i].name, use[i].current / 1024, use[i].peak / 1024);
+		}
+	}
+}
+
+void output_report(struct stats* st)
 {
 	/* EXAMPLE OUTPUT
 	 * Intrusion Detection Report:
@@ -62,22 +159,44 @@ void output_report(void)
 	 */
 
 	puts("Intrusion Detection Report:");
-	
+	/* Live epoch has no end yet */
+	long long epoch_end = st->epoch_end ? st->epoch_end : get_time();
+	printf("Epoch length: %6f seconds\n", ((double) (epoch_end - st->epoch_start)) / ((double) 1000000));
+	/* Kernel counters are kept since start */
+	struct sniff_drops drops;
+	if (sniff_drops(&drops))
+	{
+		printf("Capture: %u packets received, %u dropped by the kernel buffer, %u by the interface\n",
+		    drops.received, drops.dropped, drops.ifdropped);
+	}
+	unsigned long non_ethernet = atomic_load(&st->non_ethernet_frames);
+	if (non_ethernet)
+	{
+		printf("Skipped %lu frames that are not Ethernet II (802.3, such as STP)\n", non_ethernet);
+	}
+	output_memory();
+
 	/* SYN packet time in micro seconds */
-	long long syn_time_us = last_syn_time - first_syn_time;
+	long long syn_time_us = st->last_syn_time - st->first_syn_time;
 	/* and in seconds */
 	double syn_time_s = ((double) syn_time_us) / ((double) 1000000);
 
 	printf("SYN flood attack possible: ");
 
-	if (total_syn_packets)
+	if (st->total_syn_packets)
 	{
-		double syn_unique_ratio = ((double) (unique_ips.size)) / ((double) total_syn_packets);
-		double syn_rate = ((double) total_syn_packets) / syn_time_s;
+		/* Unique ratio over the sources of the recent window */
+		int window_sources;
+		unsigned long window_syns;
+		src_table_window(&syn_sources, epoch_end, &window_sources, &window_syns);
+		double syn_unique_ratio = window_syns ? ((double) window_sources) / ((double) window_syns) : 0;
+		double syn_rate = ((double) st->total_syn_packets) / syn_time_s;
 		int is_syn_flooding_possible = (syn_unique_ratio >= 0.9f) || (syn_rate > 100.0f);
 		puts(is_syn_flooding_possible?"TRUE":"FALSE");
-		printf("\t%d SYN packets detected from %d IP addresses in %6f seconds\n",
-		    total_syn_packets, unique_ips.size, syn_time_s);
+		printf("\t%d SYN packets detected in %6f seconds\n",
+		    st->total_syn_packets, syn_time_s);
+		printf("\t%lu SYN packets from %d IP addresses in the last %lld seconds\n",
+		    window_syns, window_sources, syn_sources.window / 1000000LL);
 		printf("\tSYN unique ratio: %f\n", syn_unique_ratio);
 		printf("\tSYN rate: %f SYN packets/sec\n", syn_rate);
 	}
@@ -85,11 +204,89 @@ void output_report(void)
 	{
 		puts("FALSE\n\tNo SYN packets received");
 	}
+	printf("\tSource table evictions: %llu\n", src_table_evictions(&syn_sources));
+	unsigned long allowed = atomic_load(&st->allowed_syn_packets);
+	if (allowed)
+	{
+		printf("\t%lu SYN packets from allowlisted networks ignored\n", allowed);
+	}
+
+	unsigned long vertical = atomic_load(&st->vertical_scans);
+	unsigned long horizontal = atomic_load(&st->horizontal_scans);
+	printf("Port scan possible: %s\n", vertical || horizontal ? "TRUE" : "FALSE");
+	printf("\t%lu sources tried %d or more ports, %lu sources %d or more hosts\n",
+	    vertical, SCAN_PORTS, horizontal, SCAN_HOSTS);
+
+	unsigned long udp_over = atomic_load(&st->udp_flood_packets);
+	unsigned long icmp_over = atomic_load(&st->icmp_flood_packets);
+	printf("UDP flood possible: %s\n", udp_over ? "TRUE" : "FALSE");
+	printf("\t%lu packets over %d packets/sec to one destination, %lu destinations newly flooded\n",
+	    udp_over, RATE_UDP_PPS, atomic_load(&st->udp_floods));
+	printf("ICMP flood possible: %s\n", icmp_over ? "TRUE" : "FALSE");
+	printf("\t%lu packets over %d packets/sec to one destination, %lu destinations newly flooded\n",
+	    icmp_over, RATE_ICMP_PPS, atomic_load(&st->icmp_floods));
+	/* Flooded destinations are kept since start */
+	struct rate_top top[FLOOD_TOP];
+	int ntop = rate_table_top(&flood_dests, top, FLOOD_TOP);
+	int i;
+	for (i = 0; i < ntop; ++i)
+	{
+		printf("\t%s flood to ", top[i].proto == 0x11 ? "UDP" : "ICMP"); print_inet_addr(top[i].ip);
+		printf(": %llu of %llu packets over the rate\n", top[i].over, top[i].packets);
+	}
+	unsigned long long untracked = atomic_load(&flood_dests.untracked);
+	if (untracked)
+	{
+		printf("\t%llu packets to destinations the rate table had no room for\n", untracked);
+	}
+
+	printf("ARP cache poisoning possible: %s\n", st->total_arp_packets?"TRUE":"FALSE");
+	printf("\t%d ARP packets received\n", st->total_arp_packets);
+
+	unsigned long inspected = atomic_load(&st->payload_inspected);
+	unsigned long skipped = atomic_load(&st->payload_skipped);
+	if (skipped)
+	{
+		/* Overloaded during the epoch, payload counts are sampled */
+		printf("Overload sampling: payload of %lu of %lu packets inspected (%.2f%%), now 1 in %d flows\n",
+		    inspected, inspected + skipped, 100.0 * inspected / (inspected + skipped), 1 << sampling_shift());
+	}
+	printf("URL Blacklist violations: %d\n", st->total_blacklist_viol);
+	if (st->est_blacklist_viol != (unsigned long) st->total_blacklist_viol)
+	{
+		printf("\tEstimated without sampling: %lu\n", st->est_blacklist_viol);
+	}
+	struct fcache_counters fc;
+	fcache_counters(&fc);
+	printf("\tFlow verdict cache: %llu hits, %llu misses, %llu evictions\n",
+	    fc.hits, fc.misses, fc.evictions);
 
-	printf("ARP cache poisoning possible: %s\n", total_arp_packets?"TRUE":"FALSE");
-	printf("\t%d ARP packets received\n", total_arp_packets);
+	printf("DNS Blacklist violations: %d\n", st->total_dns_viol);
+	if (st->est_dns_viol != (unsigned long) st->total_dns_viol)
+	{
+		printf("\tEstimated without sampling: %lu\n", st->est_dns_viol);
+	}
+	/* Per domain counts are kept since start */
+	blacklist_query_counts(print_query_count, NULL);
+	/* So are the profile counts */
+	if (prof_on)
+	{
+		prof_report(stdout);
+	}
+}
 
-	printf("URL Blacklist violations: %d\n", total_blacklist_viol);
+/**
+ * Report an epoch, and summarise it for aggregation if asked to.
+ */
+void report_epoch(struct stats* st)
+{
+	output_report(st);
+	if (summary_path)
+	{
+		struct summary s;
+		summary_collect(&s, st, &syn_sources, get_time());
+		summary_write(summary_path, &s);
+	}
 }
 
 /**
@@ -106,18 +303,17 @@ long long get_time(void)
 }
 
 /**
- * Signal handling function for Ctrl+C (^C).
+ * Signal handling function for Ctrl+C (^C) and SIGTERM. Only stops the
+ * capture, main reports once the queued packets have been analysed.
  */
 void sig_handler(int signo)
 {
-	if (signo == SIGINT)
+	if (signo == SIGINT || signo == SIGTERM)
 	{
-		puts("\nReceived Ctrl+C\n");
-		output_report();
 #ifdef EXIT_ON_CTRLC
-		/* Stop sniff loop, may have to wait for 1 more ETHERNET frame at pcap_next */
-		should_exit = 1;
-		puts("Program will exit after receiving another ETHERNET frame");
+		sniff_stop();
+#else
+		output_report(stats_live());
 #endif
 	}
 }
@@ -128,22 +324,194 @@ void print_usage(char *progname)
 	fprintf(stderr, "Usage: %s [OPTIONS]...\n\n", progname);
 	fprintf(stderr, "\t-i [interface]\tSpecify network interface to sniff\n");
 	fprintf(stderr, "\t-v\t\tEnable verbose mode. Useful for Debugging\n");
+	fprintf(stderr, "\t-e [seconds]\tReport and reset statistics every given seconds\n");
+	fprintf(stderr, "\t-S [count]\tMaximum SYN source addresses tracked, by the flood and scan detectors each (default 65536)\n");
+	fprintf(stderr, "\t-W [seconds]\tWindow of SYN sources for the unique ratio and port scans (default 60)\n");
+	fprintf(stderr, "\t-B [MB]\t\tKernel capture buffer, larger rides out longer bursts, up to %d (default: libpcap's)\n", SNIFF_MAX_BUFFER_MB);
+	fprintf(stderr, "\t-n [bytes]\tBytes captured of each packet, HTTP and DNS checks need the payload (default %d)\n", SNIFF_SNAPLEN);
+	fprintf(stderr, "\t-o [ms]\t\tLongest packets wait in the kernel buffer (default %d)\n", SNIFF_TIMEOUT_MS);
+	fprintf(stderr, "\t-I\t\tImmediate mode, deliver every packet as soon as it arrives\n");
+	fprintf(stderr, "\t-P\t\tDo not put the interface in promiscuous mode\n");
+	fprintf(stderr, "\t-t [count]\tNumber of worker threads (default: available CPUs - 1)\n");
+	fprintf(stderr, "\t-r [file]\tReplay a pcap file at full speed instead of capturing\n");
+	fprintf(stderr, "\t-C [cpus]\tPin the capture thread to a CPU list, e.g. 0 or 0-1\n");
+	fprintf(stderr, "\t-T [cpus]\tPin worker i to the i-th CPU of a list, e.g. 2-7,10\n");
+	fprintf(stderr, "\t-m [rr|flow]\tSpread batches round-robin or keep flows on one worker (default rr)\n");
+	fprintf(stderr, "\t-k [file]\tSave snapshots of the detector state to a file, and on exit\n");
+	fprintf(stderr, "\t-K [seconds]\tSeconds between snapshots (default 60)\n");
+	fprintf(stderr, "\t-R [file]\tRestore the detector state from a snapshot at startup\n");
+	fprintf(stderr, "\t-w [prefix]\tWrite packets triggering detections, and the ones just before, to prefix.N.pcap\n");
+	fprintf(stderr, "\t-z [MB]\t\tSize of each pcap file (default 64)\n");
+	fprintf(stderr, "\t-Z [count]\tNumber of pcap files kept, the oldest is overwritten (default 8)\n");
+	fprintf(stderr, "\t-d [batch|packet]\tDecode headers a worker batch at a time or per packet (default batch)\n");
+	fprintf(stderr, "\t-O [packets]\tSample payload inspection while more packets wait for analysis (default off)\n");
+	fprintf(stderr, "\t-M [MB]\t\tMemory budget, payload inspection is shed and then packets dropped near it (default none)\n");
+	fprintf(stderr, "\t-b [file]\tBlacklist domain index built by idsindex, reloaded on SIGHUP\n");
+	fprintf(stderr, "\t-A [file]\tTrusted networks, one CIDR per line, whose SYN packets are ignored\n");
+	fprintf(stderr, "\t-x [names]\tDisable detectors, comma separated (-x list lists them)\n");
+	fprintf(stderr, "\t-D [layers]\tPrint headers of ether,arp,ipv4,ipv6,tcp,udp for every packet\n");
+	fprintf(stderr, "\t-s [file]\tWrite a summary of each epoch for idsagg to merge with other sensors\n");
+	fprintf(stderr, "\t-j [file]\tWrite throughput, resource use, stage latency and detections as JSON on exit\n");
+	fprintf(stderr, "\t-p\t\tProfile cycles, instructions, cache and branch misses per stage and thread, and mutex waits\n");
+}
+
+/**
+ * Parse a CPU list such as "0-3,8,10-11".
+ * @arg s
+ *		The list, null terminated
+ * @arg cpus
+ *		Filled with the CPU numbers in the list
+ * @arg max
+ *		Capacity of cpus
+ * @return
+ *		Number of CPUs in the list
+ *		-1 if the list is malformed or too long
+ */
+static int parse_cpu_list(const char *s, int *cpus, int max)
+{
+	int n = 0;
+	while (*s)
+	{
+		char *end;
+		long first = strtol(s, &end, 10), last;
+		if (end == s || first < 0)
+		{
+			return -1;
+		}
+		last = first;
+		if (*end == '-')
+		{
+			s = end + 1;
+			last = strtol(s, &end, 10);
+			if (end == s || last < first)
+			{
+				return -1;
+			}
+		}
+		for (; first <= last; ++first)
+		{
+			if (n == max)
+			{
+				return -1;
+			}
+			cpus[n++] = first;
+		}
+		if (*end == ',')
+		{
+			++end;
+		}
+		else if (*end)
+		{
+			return -1;
+		}
+		s = end;
+	}
+	return n;
+}
+
+/**
+ * Parse an integer option argument within [min, max], exit with usage
+ * information if it is out of range or not a number.
+ */
+static int range_arg(char *progname, long min, long max)
+{
+	char *end;
+	errno = 0;
+	long v = strtol(optarg, &end, 10);
+	if (end == optarg || *end != '\0' || errno == ERANGE || v < min || v > max)
+	{
+		print_usage(progname);
+		exit(EXIT_FAILURE);
+	}
+	return (int) v;
+}
+
+/**
+ * Parse a strictly positive integer option argument, exit with usage
+ * information otherwise.
+ */
+static int positive_arg(char *progname)
+{
+	return range_arg(progname, 1, INT_MAX);
+}
+
+/**
+ * Write the measurements of a run as a single JSON object, for
+ * bench/regress.sh to check and compare between builds.
+ * @arg start, captured, drained
+ *		When capture started, when it ended and when the last packet
+ *		had been analysed (micro seconds)
+ */
+static void write_stats_json(const char *path, unsigned long packets,
+    long long start, long long captured, long long drained,
+    const struct tpool_timing *timing, struct stats *st)
+{
+	FILE *f = fopen(path, "w");
+	if (!f)
+	{
+		fprintf(stderr, "[WARNING] Cannot write %s\n", path);
+		return;
+	}
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	double seconds = ((double) (drained - start)) / ((double) 1000000);
+	double analysed = timing->analysed ? (double) timing->analysed : 1;
+	fprintf(f, "{\"packets\": %lu, \"seconds\": %f, \"pps\": %f, ",
+	    packets, seconds, seconds > 0 ? ((double) packets) / seconds : 0);
+	fprintf(f, "\"cpu_user\": %f, \"cpu_sys\": %f, \"peak_rss_kb\": %ld, ",
+	    ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+	    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6, ru.ru_maxrss);
+	/* Average per packet: capture includes the copy into the queue */
+	fprintf(f, "\"stage_us\": {\"capture\": %f, \"queue\": %f, \"analyse\": %f}, \"drain_us\": %lld, ",
+	    packets ? ((double) (captured - start)) / packets : 0,
+	    timing->queue_wait_us / analysed, timing->analyse_us / analysed, drained - captured);
+	fprintf(f, "\"detections\": {\"syn\": %d, \"arp\": %d, \"blacklist\": %d, \"dns\": %d, "
+	    "\"port_scans\": %lu, \"host_scans\": %lu, \"udp_floods\": %lu, \"icmp_floods\": %lu, "
+	    "\"allowed_syn\": %lu, \"non_ethernet\": %lu}, ",
+	    st->total_syn_packets, st->total_arp_packets, st->total_blacklist_viol, st->total_dns_viol,
+	    atomic_load(&st->vertical_scans), atomic_load(&st->horizontal_scans),
+	    atomic_load(&st->udp_floods), atomic_load(&st->icmp_floods),
+	    atomic_load(&st->allowed_syn_packets), atomic_load(&st->non_ethernet_frames));
+	struct sniff_drops drops;
+	if (sniff_drops(&drops))
+	{
+		fprintf(f, "\"kernel\": {\"received\": %u, \"dropped\": %u, \"ifdropped\": %u}, ",
+		    drops.received, drops.dropped, drops.ifdropped);
+	}
+	struct mem_usage use[MEM_SUBSYSTEMS];
+	size_t total = mem_usage(use);
+	fprintf(f, "\"memory\": {\"limit\": %zu, \"current\": %zu, \"refused\": %lu, \"dropped\": %lu, \"subsystems\": [",
+	    mem_limit(), total, mem_refused(), dispatch_mem_dropped());
+	int i;
+	for (i = 0; i < MEM_SUBSYSTEMS; ++i)
+	{
+		fprintf(f, "%s{\"name\": \"%s\", \"current\": %zu, \"peak\": %zu}",
+		    i ? ", " : "", use[i].name, use[i].current, use[i].peak);
+	}
+	fprintf(f, "]}, ");
+	if (prof_on)
+	{
+		fprintf(f, "\"profile\": {");
+		prof_json(f);
+		fprintf(f, "}, ");
+	}
+	fprintf(f, "\"sampling\": {\"inspected\": %lu, \"skipped\": %lu, \"est_blacklist\": %lu, \"est_dns\": %lu}}\n",
+	    atomic_load(&st->payload_inspected), atomic_load(&st->payload_skipped),
+	    st->est_blacklist_viol, st->est_dns_viol);
+	fclose(f);
 }
 
 int main(int argc, char *argv[])
 {
 	/* Register signal handler */
-	if (signal(SIGINT, sig_handler) == SIG_ERR)
+	if (signal(SIGINT, sig_handler) == SIG_ERR || signal(SIGTERM, sig_handler) == SIG_ERR)
 	{
 		fprintf(stderr, "%s", "\n[WARNING] Cannot catch SIGINT (Failed to register signal handler)\n");
 	}
 
-	/* Initialise list for storing unique IPs so that they can be later used to detect SYN Flooding attack */
-	ip_set_init(&unique_ips);
-	tpool_init();
-
 	// Parse command line arguments
-	struct arguments args = {"eth0", 0}; // Default values
+	struct arguments args = {"eth0", 0, 0, 65536, 60, 0, NULL}; // Default values
+	args.capture = (struct sniff_options) {SNIFF_SNAPLEN, 0, SNIFF_TIMEOUT_MS, 0, 1};
 	int optc;
 	while ((optc = getopt_long(argc, argv, OPTSTRING, long_opts, NULL)) != EOF)
 	{
@@ -155,6 +523,141 @@ int main(int argc, char *argv[])
 			case 'i':
 				args.interface = strdup(optarg);
 				break;
+			case 'e':
+				args.epoch = positive_arg(argv[0]);
+				break;
+			case 'S':
+				args.sources = positive_arg(argv[0]);
+				break;
+			case 'W':
+				args.window = positive_arg(argv[0]);
+				break;
+			case 't':
+				args.threads = positive_arg(argv[0]);
+				if (args.threads > MAX_THREADS)
+				{
+					print_usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'r':
+				args.file = strdup(optarg);
+				break;
+			case 'C':
+				args.ncapture_cpus = parse_cpu_list(optarg, args.capture_cpus, MAX_THREADS);
+				if (args.ncapture_cpus <= 0)
+				{
+					print_usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'T':
+				args.nworker_cpus = parse_cpu_list(optarg, args.worker_cpus, MAX_THREADS);
+				if (args.nworker_cpus <= 0)
+				{
+					print_usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'm':
+				if (strcmp(optarg, "rr") == 0)
+				{
+					args.sched = DISPATCH_RR;
+				}
+				else if (strcmp(optarg, "flow") == 0)
+				{
+					args.sched = DISPATCH_FLOW;
+				}
+				else
+				{
+					print_usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'k':
+				args.checkpoint = strdup(optarg);
+				break;
+			case 'K':
+				args.checkpoint_interval = positive_arg(argv[0]);
+				break;
+			case 'R':
+				args.restore = strdup(optarg);
+				break;
+			case 'B':
+				args.capture.buffer_mb = range_arg(argv[0], 1, SNIFF_MAX_BUFFER_MB);
+				break;
+			case 'n':
+				args.capture.snaplen = range_arg(argv[0], SNIFF_MIN_SNAPLEN, SNIFF_MAX_SNAPLEN);
+				break;
+			case 'o':
+				args.capture.timeout_ms = range_arg(argv[0], 0, INT_MAX);
+				break;
+			case 'I':
+				args.capture.immediate = 1;
+				break;
+			case 'P':
+				args.capture.promisc = 0;
+				break;
+			case 'w':
+				args.pcap_prefix = strdup(optarg);
+				break;
+			case 'z':
+				args.pcap_size = positive_arg(argv[0]);
+				break;
+			case 'Z':
+				args.pcap_files = positive_arg(argv[0]);
+				break;
+			case 'd':
+				if (strcmp(optarg, "batch") == 0)
+				{
+					args.decode = DECODE_BATCH;
+				}
+				else if (strcmp(optarg, "packet") == 0)
+				{
+					args.decode = DECODE_PACKET;
+				}
+				else
+				{
+					print_usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'O':
+				args.overload = positive_arg(argv[0]);
+				break;
+			case 'b':
+				args.blacklist = strdup(optarg);
+				break;
+			case 'A':
+				args.allowlist = strdup(optarg);
+				break;
+			case 'p':
+				args.profile = 1;
+				break;
+			case 'x':
+				if (strcmp(optarg, "list") == 0)
+				{
+					analysis_list_detectors(stdout);
+					exit(EXIT_SUCCESS);
+				}
+				args.disable = strdup(optarg);
+				break;
+			case 'D':
+				if (analysis_debug(optarg) != 0)
+				{
+					print_usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'M':
+				args.mem_limit = positive_arg(argv[0]);
+				break;
+			case 's':
+				args.summary = strdup(optarg);
+				break;
+			case 'j':
+				args.stats_json = strdup(optarg);
+				break;
 			default:
 				print_usage(argv[0]);
 				exit(EXIT_FAILURE);
@@ -163,10 +666,191 @@ int main(int argc, char *argv[])
 	// Print out settings
 	printf("%s invoked. Settings:\n", argv[0]);
 	printf("\tInterface: %s\n\tVerbose: %d\n", args.interface, args.verbose);
+	printf("\tEpoch: %d seconds\n", args.epoch);
+	printf("\tSYN sources: %d, window %d seconds\n", args.sources, args.window);
+	if (!args.threads)
+	{
+		args.threads = tpool_default_size(1);
+	}
+	printf("\tWorker threads: %d, scheduling %s, %s decode\n", args.threads,
+	    args.sched == DISPATCH_FLOW ? "flow" : "rr", args.decode == DECODE_PACKET ? "packet" : "batch");
+	if (args.file)
+	{
+		printf("\tReplaying: %s\n", args.file);
+	}
+	else
+	{
+		printf("\tCapture: snaplen %d, timeout %d ms, immediate %d, promiscuous %d, ",
+		    args.capture.snaplen, args.capture.timeout_ms, args.capture.immediate, args.capture.promisc);
+		if (args.capture.buffer_mb)
+		{
+			printf("buffer %d MB\n", args.capture.buffer_mb);
+		}
+		else
+		{
+			puts("default buffer");
+		}
+	}
+	if (!args.checkpoint_interval)
+	{
+		args.checkpoint_interval = 60;
+	}
+	if (args.checkpoint)
+	{
+		printf("\tCheckpoint: %s every %d seconds\n", args.checkpoint, args.checkpoint_interval);
+	}
+	if (!args.pcap_size)
+	{
+		args.pcap_size = 64;
+	}
+	if (!args.pcap_files)
+	{
+		args.pcap_files = 8;
+	}
+	if (args.summary)
+	{
+		printf("\tSummary: %s\n", args.summary);
+		summary_path = args.summary;
+	}
+	if (args.mem_limit)
+	{
+		printf("\tMemory budget: %d MB\n", args.mem_limit);
+		mem_set_limit(args.mem_limit * 1024UL * 1024UL);
+	}
+	if (args.pcap_prefix)
+	{
+		printf("\tDetected packets: %s.N.pcap, %d files of %d MB\n", args.pcap_prefix, args.pcap_files, args.pcap_size);
+	}
+
+	/* Pin capture first so that nothing it allocates from here on
+	 * lands on another node */
+	if (args.ncapture_cpus && !pin_thread(args.capture_cpus, args.ncapture_cpus))
+	{
+		fprintf(stderr, "%s\n", "[WARNING] Failed to pin capture thread");
+	}
+
+	/* Initialise statistics and the table of SYN sources so that they
+	 * can be later used to detect SYN Flooding attack */
+	stats_init();
+	/* Keys IPv6 flows by address digests from the first packet */
+	addr6_init();
+	/* Domains checked by the HTTP, TLS and DNS detectors */
+	if (blacklist_init(args.blacklist) != 0)
+	{
+		fprintf(stderr, "%s\n", "[ERROR] Failed to load the blacklist");
+		exit(1);
+	}
+	printf("\tBlacklist: %s, %d domains\n", args.blacklist ? args.blacklist : "built in", blacklist_size());
+	if (args.blacklist)
+	{
+		/* Before any other thread starts, so that they all leave SIGHUP
+		 * to the reloader */
+		blacklist_start_reloader(args.blacklist);
+	}
+	if (args.allowlist)
+	{
+		if (allowlist_load(args.allowlist) != 0)
+		{
+			exit(EXIT_FAILURE);
+		}
+		int v4, v6;
+		allowlist_size(&v4, &v6);
+		printf("\tAllowlist: %s, %d IPv4 and %d IPv6 networks\n", args.allowlist, v4, v6);
+	}
+	/* Dispatch tables of the enabled detectors */
+	if (analysis_init(args.disable) != 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+	printf("\tDisabled detectors: %s\n", args.disable ? args.disable : "none");
+	if (args.profile)
+	{
+		/* Before the workers start, each opens its own counters */
+		printf("\tProfile: %s\n", prof_init() ? "hardware counters and mutex waits" : "wall time and mutex waits");
+	}
+	src_table_init(&syn_sources, args.sources, args.window);
+	scan_table_init(&scan_sources, args.sources, args.window);
+	rate_table_init(&flood_dests);
+	/* Flow table for HTTP requests spanning several TCP segments */
+	reasm_init();
+	/* Verdicts of classified HTTP flows */
+	fcache_init();
+	/* Carry on from a previous run before any packet is analysed */
+	if (args.restore)
+	{
+		checkpoint_restore(args.restore, &syn_sources);
+	}
+	sampling_init(args.overload);
+	/* Written packets are handed back to the worker pools */
+	if (args.pcap_prefix)
+	{
+		pcapw_start(args.pcap_prefix, args.pcap_size * 1024LL * 1024LL, args.pcap_files, dispatch_release);
+	}
+	tpool_init(args.threads, args.nworker_cpus ? args.worker_cpus : NULL, args.nworker_cpus, args.sched, args.decode);
+
+	if (args.checkpoint)
+	{
+		checkpoint_start(args.checkpoint, args.checkpoint_interval, &syn_sources);
+	}
+	if (args.epoch)
+	{
+		stats_start_reporter(args.epoch, report_epoch);
+	}
 	// Invoke Intrusion Detection System
-	sniff(args.interface, args.verbose);
+	long long start = get_time();
+	prof_thread_start("capture", -1);
+	unsigned long packets = sniff(args.interface, args.file, &args.capture, args.verbose);
+	prof_thread_stop();
+	long long captured = get_time();
+	if (should_exit)
+	{
+		puts("\nStopping, analysing the packets already captured");
+	}
+	/* Report once every captured packet has been analysed */
+	tpool_drain();
+	long long drained = get_time();
+	struct tpool_timing timing;
+	tpool_timing(&timing);
+	if (args.file)
+	{
+		double elapsed = ((double) (drained - start)) / ((double) 1000000);
+		printf("Replayed %lu packets in %6f seconds (%f packets/sec)\n",
+		    packets, elapsed, ((double) packets) / elapsed);
+		printf("%llu packets stolen by idle workers\n", tpool_steals());
+	}
+	/* Also writes out the packets still waiting for the pcap writer */
+	tpool_destroy();
+	stats_stop_reporter();
+	if (args.pcap_prefix)
+	{
+		printf("Wrote %llu packets to %s.N.pcap, %llu dropped\n",
+		    pcapw_written(), args.pcap_prefix, pcapw_dropped());
+	}
+	/* Last snapshot has every captured packet in it */
+	checkpoint_stop();
+	blacklist_stop_reloader();
+	report_epoch(stats_live());
+	if (args.stats_json)
+	{
+		write_stats_json(args.stats_json, packets, start, captured, drained, &timing, stats_live());
+	}
+	if (sniff_stop_time())
+	{
+		long long stopped = sniff_stop_time();
+		printf("Shutdown latency: %6f seconds (capture stopped after %6f, drain %6f)\n",
+		    ((double) (get_time() - stopped)) / ((double) 1000000),
+		    ((double) (captured - stopped)) / ((double) 1000000),
+		    ((double) (drained - captured)) / ((double) 1000000));
+	}
 
-	/*pthread_mutex_destroy(&total_syn_packets_mutex);*/
-	ip_set_destroy(&unique_ips);
+	stats_destroy();
+	src_table_destroy(&syn_sources);
+	scan_table_destroy(&scan_sources);
+	rate_table_destroy(&flood_dests);
+	reasm_destroy();
+	fcache_destroy();
+	blacklist_destroy();
+	allowlist_destroy();
+	prof_destroy();
 	return 0;
 }
@@ -0,0 +1,97 @@
+#include "mem.h"
+/* Includes are in header file */
+
+static const char* names[MEM_SUBSYSTEMS] = {
+	"queue", "SYN sources", "scan table", "flood table", "reassembly",
+	"flow cache", "pcap writer", "IP sets", "workers", "blacklist", "allowlist"
+};
+
+static size_t limit = 0;
+static atomic_size_t total;
+static atomic_size_t current[MEM_SUBSYSTEMS];
+static atomic_size_t peak[MEM_SUBSYSTEMS];
+static atomic_ulong refused;
+
+void mem_set_limit(size_t bytes)
+{
+	limit = bytes;
+}
+
+size_t mem_limit(void)
+{
+	return limit;
+}
+
+/* Count n bytes allocated to a subsystem, the total is counted by the
+ * caller */
+static void mem_account(int subsys, size_t n)
+{
+	size_t now = atomic_fetch_add_explicit(&current[subsys], n, memory_order_relaxed) + n;
+	size_t p = atomic_load_explicit(&peak[subsys], memory_order_relaxed);
+	while (now > p
+	    && !atomic_compare_exchange_weak_explicit(&peak[subsys], &p, now, memory_order_relaxed, memory_order_relaxed))
+	{
+		/* p reloaded, retry while still larger */
+	}
+}
+
+void* mem_alloc(int subsys, size_t n, int zero)
+{
+	void* p = zero ? calloc(1, n) : malloc(n);
+	if (!p)
+	{
+		fprintf(stderr, "[ERROR] Failed to allocate %zu bytes for %s (memory allocation error)\n", n, names[subsys]);
+		exit(5);
+	}
+	atomic_fetch_add_explicit(&total, n, memory_order_relaxed);
+	mem_account(subsys, n);
+	return p;
+}
+
+void* mem_try_alloc(int subsys, size_t n)
+{
+	/* Reserve first so that racing allocations cannot both fit */
+	size_t before = atomic_fetch_add_explicit(&total, n, memory_order_relaxed);
+	void* p = limit && before + n > limit ? NULL : malloc(n);
+	if (!p)
+	{
+		atomic_fetch_sub_explicit(&total, n, memory_order_relaxed);
+		atomic_fetch_add_explicit(&refused, 1, memory_order_relaxed);
+		return NULL;
+	}
+	mem_account(subsys, n);
+	return p;
+}
+
+void mem_free(int subsys, void* p, size_t n)
+{
+	if (!p)
+	{
+		return;
+	}
+	free(p);
+	atomic_fetch_sub_explicit(&current[subsys], n, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&total, n, memory_order_relaxed);
+}
+
+int mem_pressure(void)
+{
+	return limit && atomic_load_explicit(&total, memory_order_relaxed) * 100 >= limit * MEM_SHED_PERCENT;
+}
+
+unsigned long mem_refused(void)
+{
+	return atomic_load(&refused);
+}
+
+size_t mem_usage(struct mem_usage* out)
+{
+	int i;
+	for (i = 0; i < MEM_SUBSYSTEMS; ++i)
+	{
+		out[i].name = names[i];
+		out[i].current = atomic_load(&current[i]);
+		out[i].peak = atomic_load(&peak[i]);
+	}
+	return atomic_load(&total);
+}
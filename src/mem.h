@@ -0,0 +1,92 @@
+#ifndef CS241_MEM_H
+#define CS241_MEM_H
+
+#include <stdio.h> /* fprintf */
+#include <stdlib.h> /* malloc, free */
+#include <string.h> /* memset */
+#include <stdatomic.h> /* atomic_size_t */
+
+/* Subsystems memory is accounted to */
+#define MEM_QUEUE 0 /* Captured packets waiting for or being analysed */
+#define MEM_SOURCES 1 /* SYN source table */
+#define MEM_SCANS 2 /* Port scan table */
+#define MEM_RATES 3 /* Flood token buckets */
+#define MEM_REASM 4 /* HTTP reassembly */
+#define MEM_FCACHE 5 /* Flow verdict cache */
+#define MEM_PCAPW 6 /* pcap writer */
+#define MEM_IPSET 7 /* IP address sets */
+#define MEM_WORKERS 8 /* Worker state */
+#define MEM_BLACKLIST 9 /* Per domain counts, the index itself is mapped */
+#define MEM_ALLOWLIST 10 /* Trusted networks */
+#define MEM_SUBSYSTEMS 11
+
+/* Share of the budget (percent) from which payload inspection is shed */
+#define MEM_SHED_PERCENT 75
+
+/* Current and peak use of a subsystem, as filled by mem_usage */
+struct mem_usage
+{
+	const char* name;
+	size_t current, peak;
+};
+
+/**
+ * Memory budget of the sensor. Every subsystem allocates through mem_
+ * functions so that use is known per subsystem. Tables sized at start
+ * are essential and always granted; what grows with the traffic asks
+ * with mem_try_alloc and is refused once the budget is spent, so the
+ * sensor degrades (sheds payload inspection, then drops packets at
+ * capture) instead of being killed.
+ * @arg bytes
+ *		The budget, 0 for none
+ */
+void mem_set_limit(size_t bytes);
+
+/**
+ * @return
+ *		The budget, 0 if none
+ */
+size_t mem_limit(void);
+
+/**
+ * Allocate essential memory, exits if the system is out of memory.
+ * @arg zero
+ *		Non-zero to zero the memory (calloc)
+ */
+void* mem_alloc(int subsys, size_t n, int zero);
+
+/**
+ * Allocate memory that may be refused.
+ * @return
+ *		The memory, NULL if it would exceed the budget or the system is
+ *		out of memory
+ */
+void* mem_try_alloc(int subsys, size_t n);
+
+/**
+ * Free memory of n bytes allocated by mem_alloc or mem_try_alloc.
+ */
+void mem_free(int subsys, void* p, size_t n);
+
+/**
+ * @return
+ *		Non-zero once use reaches MEM_SHED_PERCENT of the budget
+ */
+int mem_pressure(void);
+
+/**
+ * @return
+ *		Allocations refused since start
+ */
+unsigned long mem_refused(void);
+
+/**
+ * Current and peak use of every subsystem.
+ * @arg out
+ *		Filled with MEM_SUBSYSTEMS entries
+ * @return
+ *		Total current use
+ */
+size_t mem_usage(struct mem_usage* out);
+
+#endif
@@ -0,0 +1,189 @@
+#include "pcap_writer.h"
+/* Includes are in header file */
+
+static pthread_t writer;
+static int writer_started = 0;
+static int writer_stop = 0;
+static const char* file_prefix;
+static long long max_file_bytes;
+static int max_files;
+static pcapw_release_fn release_item;
+
+/* Items waiting to be written, a ring of PCAPW_QUEUE_MAX */
+static struct queueitem** waiting;
+static unsigned int waiting_head = 0, waiting_tail = 0;
+static unsigned long long written = 0, dropped = 0;
+/* Resources mutexed: waiting, waiting_head, waiting_tail, written,
+ * dropped, writer_stop */
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled when items are queued or on stop */
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+
+/* Only used by the writer thread */
+static pcap_t* dead;
+static pcap_dumper_t* dumper = NULL;
+static int file_index = -1;
+static long long file_bytes;
+
+/**
+ * Close the current file, if any, and open the next one in turn.
+ */
+static void pcapw_rotate(void)
+{
+	if (dumper)
+	{
+		pcap_dump_close(dumper);
+	}
+	file_index = (file_index + 1) % max_files;
+	char path[4096];
+	snprintf(path, sizeof(path), "%s.%d.pcap", file_prefix, file_index);
+	dumper = pcap_dump_open(dead, path);
+	if (!dumper)
+	{
+		fprintf(stderr, "[WARNING] Cannot write %s: %s\n", path, pcap_geterr(dead));
+	}
+	/* Global header of the pcap format */
+	file_bytes = 24;
+}
+
+static void pcapw_write(struct queueitem* item)
+{
+	/* Files are opened on the first packet, no detection no file */
+	if (!dumper || file_bytes + 16 + item->len > max_file_bytes)
+	{
+		pcapw_rotate();
+	}
+	if (dumper)
+	{
+		struct pcap_pkthdr header;
+		header.ts = item->ts;
+		header.caplen = item->len;
+		header.len = item->wirelen;
+		pcap_dump((unsigned char*) dumper, &header, item->data);
+		file_bytes += 16 + item->len;
+	}
+}
+
+/* Loop executed by the writer thread */
+static void* writer_loop(void* arg)
+{
+	struct queueitem* batch[PCAPW_QUEUE_MAX];
+	pthread_mutex_lock(&writer_mutex);
+	for (;;)
+	{
+		while (waiting_head == waiting_tail && !writer_stop)
+		{
+			pthread_cond_wait(&writer_cond, &writer_mutex);
+		}
+		if (waiting_head == waiting_tail)
+		{
+			/* Stopping and all written */
+			break;
+		}
+		int n = 0;
+		while (waiting_head != waiting_tail)
+		{
+			batch[n++] = waiting[waiting_head++ % PCAPW_QUEUE_MAX];
+		}
+		pthread_mutex_unlock(&writer_mutex);
+
+		/* Disk I/O outside the mutex, workers keep submitting */
+		int i;
+		for (i = 0; i < n; ++i)
+		{
+			pcapw_write(batch[i]);
+			release_item(batch[i]);
+		}
+		if (dumper)
+		{
+			pcap_dump_flush(dumper);
+		}
+
+		pthread_mutex_lock(&writer_mutex);
+		written += n;
+	}
+	pthread_mutex_unlock(&writer_mutex);
+	if (dumper)
+	{
+		pcap_dump_close(dumper);
+		dumper = NULL;
+	}
+	return NULL;
+}
+
+void pcapw_start(const char* prefix, long long bytes, int nfiles, pcapw_release_fn release)
+{
+	file_prefix = prefix;
+	max_file_bytes = bytes;
+	max_files = nfiles;
+	release_item = release;
+	waiting = mem_alloc(MEM_PCAPW, PCAPW_QUEUE_MAX * sizeof(struct queueitem*), 0);
+	dead = pcap_open_dead(DLT_EN10MB, 65535);
+	if (!dead)
+	{
+		fprintf(stderr, "%s\n", "[ERROR] Failed to initialise pcap writer (memory allocation error)");
+		exit(1);
+	}
+	if (pthread_create(&writer, NULL, &writer_loop, NULL) != 0)
+	{
+		fprintf(stderr, "%s\n", "[ERROR] Failed to start pcap writer thread");
+		exit(1);
+	}
+	writer_started = 1;
+}
+
+int pcapw_enabled(void)
+{
+	return writer_started;
+}
+
+int pcapw_submit(struct queueitem* item)
+{
+	int queued = 0;
+	pthread_mutex_lock(&writer_mutex);
+	if (waiting_tail - waiting_head < PCAPW_QUEUE_MAX)
+	{
+		atomic_fetch_add(&item->refs, 1);
+		waiting[waiting_tail++ % PCAPW_QUEUE_MAX] = item;
+		pthread_cond_signal(&writer_cond);
+		queued = 1;
+	}
+	else
+	{
+		++dropped;
+	}
+	pthread_mutex_unlock(&writer_mutex);
+	return queued;
+}
+
+void pcapw_stop(void)
+{
+	if (!writer_started)
+	{
+		return;
+	}
+	pthread_mutex_lock(&writer_mutex);
+	writer_stop = 1;
+	pthread_cond_signal(&writer_cond);
+	pthread_mutex_unlock(&writer_mutex);
+	pthread_join(writer, NULL);
+	writer_started = 0;
+	pcap_close(dead);
+	mem_free(MEM_PCAPW, waiting, PCAPW_QUEUE_MAX * sizeof(struct queueitem*));
+}
+
+unsigned long long pcapw_written(void)
+{
+	pthread_mutex_lock(&writer_mutex);
+	unsigned long long n = written;
+	pthread_mutex_unlock(&writer_mutex);
+	return n;
+}
+
+unsigned long long pcapw_dropped(void)
+{
+	pthread_mutex_lock(&writer_mutex);
+	unsigned long long n = dropped;
+	pthread_mutex_unlock(&writer_mutex);
+	return n;
+}
@@ -0,0 +1,66 @@
+#ifndef CS241_PCAP_WRITER_H
+#define CS241_PCAP_WRITER_H
+
+#include <stdio.h> /* fprintf, snprintf */
+#include <stdlib.h> /* malloc */
+#include <pthread.h> /* pthread_t */
+#include <pcap.h>
+#include "task_queue.h"
+
+/* Packets that may wait for the writer, more are dropped and counted so
+ * that workers never wait for the disk */
+#define PCAPW_QUEUE_MAX 4096
+/* Recent packets each worker keeps to write along with a detection */
+#define PCAPW_PRE_TRIGGER 16
+
+/* Gives back a reference to an item once it has been written */
+typedef void (*pcapw_release_fn)(struct queueitem*);
+
+/**
+ * Start the writer thread. Files are named prefix.N.pcap with N going
+ * from 0 to nfiles - 1 and back to 0, overwriting the oldest file.
+ * @arg prefix
+ *		Path prefix of the files
+ * @arg file_bytes
+ *		Size after which the writer moves on to the next file
+ * @arg nfiles
+ *		Number of files kept
+ * @arg release
+ *		Called from the writer thread with every written item
+ */
+void pcapw_start(const char* prefix, long long file_bytes, int nfiles, pcapw_release_fn release);
+
+/**
+ * @return
+ *		Non-zero if pcapw_start was called and pcapw_stop was not
+ */
+int pcapw_enabled(void);
+
+/**
+ * Queue an item for writing, taking a reference to it. Never blocks on
+ * I/O; if the writer is too far behind the item is dropped instead.
+ * @return
+ *		1 if queued
+ *		0 if dropped
+ */
+int pcapw_submit(struct queueitem* item);
+
+/**
+ * Write everything still queued, close the file and stop the writer
+ * thread. Nothing may be submitted anymore.
+ */
+void pcapw_stop(void);
+
+/**
+ * @return
+ *		Number of packets written so far
+ */
+unsigned long long pcapw_written(void);
+
+/**
+ * @return
+ *		Number of packets dropped because the writer was behind
+ */
+unsigned long long pcapw_dropped(void);
+
+#endif
@@ -0,0 +1,408 @@
+#include "profile.h"
+/* Includes are in header file */
+
+int prof_on = 0;
+
+static const char* stage_names[PROF_STAGES] = {"capture", "dequeue", "decode", "detect", "release"};
+static const char* lock_names[PROF_LOCKS] = {"queue", "syn", "arp", "blacklist"};
+static const char* event_names[PROF_EVENTS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+static const uint64_t event_configs[PROF_EVENTS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+/* Counts of a thread, only written by the thread, read by the report */
+struct prof_counts
+{
+	atomic_ullong ns;
+	atomic_ullong events[PROF_EVENTS];
+};
+
+struct prof_lock_counts
+{
+	atomic_ullong acquired, contended, wait_ns;
+};
+
+struct prof_thread
+{
+	char name[32];
+	const char* kind; /* name without the number, for the report order */
+	int id;
+	/* Group of counters led by the first one opened, -1 if not */
+	int fd[PROF_EVENTS];
+	int leader;
+	/* Position of each event in a group read, -1 if not counted */
+	int slot[PROF_EVENTS];
+	int nslots;
+	int stage; /* Accounted to since at, PROF_IDLE for none */
+	uint64_t at;
+	/* Counter values at the last read */
+	uint64_t last[PROF_EVENTS];
+	uint64_t last_enabled, last_running;
+	struct prof_counts stages[PROF_STAGES];
+	struct prof_lock_counts locks[PROF_LOCKS];
+};
+
+/* What a read of a group returns (PERF_FORMAT_GROUP) */
+struct prof_read
+{
+	uint64_t nr;
+	uint64_t enabled, running;
+	uint64_t values[PROF_EVENTS];
+};
+
+static _Thread_local struct prof_thread* self = NULL;
+
+/* Resources mutexed: threads, nthreads */
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct prof_thread* threads[PROF_THREADS];
+static int nthreads = 0;
+/* Events the kernel let prof_init count */
+static int available[PROF_EVENTS];
+static int hardware = 0;
+
+static uint64_t prof_clock(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+/* Add to a count only its own thread writes, no atomic add needed */
+static void count_add(atomic_ullong* c, uint64_t n)
+{
+	atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/**
+ * Open a counter of the calling thread, in user space only so that
+ * perf_event_paranoid 2, the usual default, allows it.
+ * @arg group
+ *		Leader of the group, -1 to lead one
+ * @return
+ *		The counter, -1 with errno set if refused
+ */
+static int event_open(int event, int group)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = event_configs[event];
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+int prof_init(void)
+{
+	int i, err = 0;
+	for (i = 0; i < PROF_EVENTS; ++i)
+	{
+		int fd = event_open(i, -1);
+		available[i] = fd >= 0;
+		if (fd >= 0)
+		{
+			close(fd);
+			hardware = 1;
+		}
+		else if (!err)
+		{
+			err = errno;
+		}
+	}
+	prof_on = 1;
+	if (!hardware)
+	{
+		const char* why = err == ENOENT || err == EOPNOTSUPP ? "no hardware events on this CPU or hypervisor"
+		    : strerror(err);
+		fprintf(stderr, "[WARNING] No hardware counters (%s%s), profiling wall time and mutex waits only\n",
+		    why, err == EACCES || err == EPERM ? ", see /proc/sys/kernel/perf_event_paranoid" : "");
+	}
+	return hardware;
+}
+
+void prof_destroy(void)
+{
+	pthread_mutex_lock(&threads_mutex);
+	int i;
+	for (i = 0; i < nthreads; ++i)
+	{
+		mem_free(MEM_WORKERS, threads[i], sizeof(struct prof_thread));
+		threads[i] = NULL;
+	}
+	nthreads = 0;
+	pthread_mutex_unlock(&threads_mutex);
+}
+
+void prof_thread_start(const char* name, int id)
+{
+	if (!prof_on)
+	{
+		return;
+	}
+	struct prof_thread* t = mem_alloc(MEM_WORKERS, sizeof(struct prof_thread), 1);
+	if (id >= 0)
+	{
+		snprintf(t->name, sizeof(t->name), "%s %d", name, id);
+	}
+	else
+	{
+		snprintf(t->name, sizeof(t->name), "%s", name);
+	}
+	t->kind = name;
+	t->id = id;
+	t->leader = -1;
+	int i;
+	for (i = 0; i < PROF_EVENTS; ++i)
+	{
+		t->fd[i] = available[i] ? event_open(i, t->leader) : -1;
+		t->slot[i] = t->fd[i] >= 0 ? t->nslots++ : -1;
+		if (t->fd[i] >= 0 && t->leader < 0)
+		{
+			t->leader = t->fd[i];
+		}
+	}
+	t->stage = PROF_IDLE;
+
+	pthread_mutex_lock(&threads_mutex);
+	if (nthreads == PROF_THREADS)
+	{
+		pthread_mutex_unlock(&threads_mutex);
+		for (i = 0; i < PROF_EVENTS; ++i)
+		{
+			if (t->fd[i] >= 0)
+			{
+				close(t->fd[i]);
+			}
+		}
+		mem_free(MEM_WORKERS, t, sizeof(struct prof_thread));
+		return;
+	}
+	threads[nthreads++] = t;
+	pthread_mutex_unlock(&threads_mutex);
+	self = t;
+}
+
+void prof_thread_stop(void)
+{
+	struct prof_thread* t = self;
+	if (!t)
+	{
+		return;
+	}
+	prof_switch(PROF_IDLE);
+	int i;
+	for (i = 0; i < PROF_EVENTS; ++i)
+	{
+		if (t->fd[i] >= 0)
+		{
+			close(t->fd[i]);
+			t->fd[i] = -1;
+		}
+	}
+	self = NULL;
+}
+
+void prof_switch(int stage)
+{
+	struct prof_thread* t = self;
+	if (!t || t->stage == stage)
+	{
+		return;
+	}
+	uint64_t now = prof_clock();
+	struct prof_read r;
+	int counted = t->leader >= 0 && read(t->leader, &r, sizeof(r)) > 0 && r.nr == (uint64_t) t->nslots;
+	if (t->stage != PROF_IDLE)
+	{
+		struct prof_counts* c = t->stages + t->stage;
+		count_add(&c->ns, now - t->at);
+		/* Multiplexed with other users of the PMU, the counters only
+		 * ran for part of the time */
+		uint64_t enabled = counted ? r.enabled - t->last_enabled : 0;
+		uint64_t running = counted ? r.running - t->last_running : 0;
+		int i;
+		for (i = 0; counted && running && i < PROF_EVENTS; ++i)
+		{
+			if (t->slot[i] >= 0)
+			{
+				uint64_t n = r.values[t->slot[i]] - t->last[i];
+				count_add(&c->events[i], running < enabled ? (uint64_t) ((double) n * enabled / running) : n);
+			}
+		}
+	}
+	if (counted)
+	{
+		int i;
+		for (i = 0; i < PROF_EVENTS; ++i)
+		{
+			t->last[i] = t->slot[i] >= 0 ? r.values[t->slot[i]] : 0;
+		}
+		t->last_enabled = r.enabled;
+		t->last_running = r.running;
+	}
+	t->stage = stage;
+	t->at = now;
+}
+
+void prof_lock_wait(pthread_mutex_t* m, int lock)
+{
+	struct prof_thread* t = self;
+	if (pthread_mutex_trylock(m) == 0)
+	{
+		if (t)
+		{
+			count_add(&t->locks[lock].acquired, 1);
+		}
+		return;
+	}
+	uint64_t start = prof_clock();
+	pthread_mutex_lock(m);
+	if (t)
+	{
+		struct prof_lock_counts* c = t->locks + lock;
+		count_add(&c->acquired, 1);
+		count_add(&c->contended, 1);
+		count_add(&c->wait_ns, prof_clock() - start);
+	}
+}
+
+/**
+ * Add the stages of a thread to totals.
+ */
+static void thread_stages(const struct prof_thread* t, struct prof_stage_totals* stages)
+{
+	int s, i;
+	for (s = 0; s < PROF_STAGES; ++s)
+	{
+		stages[s].ns += atomic_load_explicit(&t->stages[s].ns, memory_order_relaxed);
+		for (i = 0; i < PROF_EVENTS; ++i)
+		{
+			stages[s].events[i] += atomic_load_explicit(&t->stages[s].events[i], memory_order_relaxed);
+		}
+	}
+}
+
+void prof_totals(struct prof_stage_totals* stages, struct prof_lock_totals* locks)
+{
+	memset(stages, 0, PROF_STAGES * sizeof(*stages));
+	memset(locks, 0, PROF_LOCKS * sizeof(*locks));
+	pthread_mutex_lock(&threads_mutex);
+	int i, l;
+	for (i = 0; i < nthreads; ++i)
+	{
+		thread_stages(threads[i], stages);
+		for (l = 0; l < PROF_LOCKS; ++l)
+		{
+			const struct prof_lock_counts* c = threads[i]->locks + l;
+			locks[l].acquired += atomic_load_explicit(&c->acquired, memory_order_relaxed);
+			locks[l].contended += atomic_load_explicit(&c->contended, memory_order_relaxed);
+			locks[l].wait_ns += atomic_load_explicit(&c->wait_ns, memory_order_relaxed);
+		}
+	}
+	pthread_mutex_unlock(&threads_mutex);
+}
+
+/**
+ * Print one line of the report, time and events of a stage.
+ */
+static void print_stage(FILE* out, const char* indent, const char* name, const struct prof_stage_totals* s)
+{
+	fprintf(out, "%s%s: %.3f ms", indent, name, s->ns / 1e6);
+	if (hardware)
+	{
+		const unsigned long long* e = s->events;
+		if (available[PROF_CYCLES] && available[PROF_INSTRUCTIONS] && e[PROF_CYCLES])
+		{
+			fprintf(out, ", %.2f IPC", (double) e[PROF_INSTRUCTIONS] / e[PROF_CYCLES]);
+		}
+		int i;
+		for (i = 0; i < PROF_EVENTS; ++i)
+		{
+			if (available[i])
+			{
+				fprintf(out, ", %llu %s", e[i], event_names[i]);
+			}
+		}
+	}
+	fputc('\n', out);
+}
+
+void prof_report(FILE* out)
+{
+	struct prof_stage_totals stages[PROF_STAGES];
+	struct prof_lock_totals locks[PROF_LOCKS];
+	prof_totals(stages, locks);
+	fprintf(out, "Profile: %s, all threads\n", hardware ? "user space hardware counters" : "wall time");
+	int s, i;
+	for (s = 0; s < PROF_STAGES; ++s)
+	{
+		print_stage(out, "\t", stage_names[s], stages + s);
+	}
+	pthread_mutex_lock(&threads_mutex);
+	/* By kind then number, threads register in the order they start */
+	const struct prof_thread* sorted[PROF_THREADS];
+	for (i = 0; i < nthreads; ++i)
+	{
+		int k = i;
+		while (k > 0 && (strcmp(sorted[k - 1]->kind, threads[i]->kind) > 0
+		    || (strcmp(sorted[k - 1]->kind, threads[i]->kind) == 0 && sorted[k - 1]->id > threads[i]->id)))
+		{
+			sorted[k] = sorted[k - 1];
+			--k;
+		}
+		sorted[k] = threads[i];
+	}
+	for (i = 0; i < nthreads; ++i)
+	{
+		struct prof_stage_totals own[PROF_STAGES];
+		memset(own, 0, sizeof(own));
+		thread_stages(sorted[i], own);
+		fprintf(out, "\t%s\n", sorted[i]->name);
+		for (s = 0; s < PROF_STAGES; ++s)
+		{
+			if (own[s].ns)
+			{
+				print_stage(out, "\t\t", stage_names[s], own + s);
+			}
+		}
+	}
+	pthread_mutex_unlock(&threads_mutex);
+	for (i = 0; i < PROF_LOCKS; ++i)
+	{
+		fprintf(out, "\t%s mutex: %llu locked, %llu waited for, %.3f ms waiting\n",
+		    lock_names[i], locks[i].acquired, locks[i].contended, locks[i].wait_ns / 1e6);
+	}
+}
+
+void prof_json(FILE* out)
+{
+	struct prof_stage_totals stages[PROF_STAGES];
+	struct prof_lock_totals locks[PROF_LOCKS];
+	prof_totals(stages, locks);
+	fprintf(out, "\"hardware\": %d, \"stages\": {", hardware);
+	int s, i;
+	for (s = 0; s < PROF_STAGES; ++s)
+	{
+		fprintf(out, "%s\"%s\": {\"ns\": %llu", s ? ", " : "", stage_names[s], stages[s].ns);
+		for (i = 0; i < PROF_EVENTS; ++i)
+		{
+			if (available[i])
+			{
+				fprintf(out, ", \"%s\": %llu", event_names[i], stages[s].events[i]);
+			}
+		}
+		fputc('}', out);
+	}
+	fprintf(out, "}, \"locks\": {");
+	for (i = 0; i < PROF_LOCKS; ++i)
+	{
+		fprintf(out, "%s\"%s\": {\"acquired\": %llu, \"contended\": %llu, \"wait_ns\": %llu}",
+		    i ? ", " : "", lock_names[i], locks[i].acquired, locks[i].contended, locks[i].wait_ns);
+	}
+	fputc('}', out);
+}
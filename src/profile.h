@@ -0,0 +1,146 @@
+#ifndef CS241_PROFILE_H
+#define CS241_PROFILE_H
+
+#include <stdio.h> /* fprintf */
+#include <string.h> /* strerror */
+#include <stdint.h> /* uint64_t */
+#include <errno.h> /* errno */
+#include <pthread.h> /* pthread_mutex_t */
+#include <stdatomic.h> /* atomic_ullong */
+#include <time.h> /* clock_gettime */
+#include <unistd.h> /* syscall, read, close */
+#include <sys/syscall.h> /* SYS_perf_event_open */
+#include <linux/perf_event.h> /* perf_event_attr */
+#include "mem.h" /* mem_alloc */
+#include "threads.h" /* MAX_THREADS */
+
+/* Pipeline stages time and events are accounted to */
+#define PROF_IDLE -1 /* Waiting for packets, not accounted */
+#define PROF_CAPTURE 0 /* Reading from libpcap and queueing for workers */
+#define PROF_DEQUEUE 1 /* Taking packets from the queues, stealing */
+#define PROF_DECODE 2 /* Header decoding of a batch (decode_batch) */
+#define PROF_DETECT 3 /* Detectors, all of analyse when decoding per packet */
+#define PROF_RELEASE 4 /* pcap writer hand-off, recycling queue items */
+#define PROF_STAGES 5
+
+/* Mutexes whose wait is measured */
+#define PROF_LOCK_QUEUE 0 /* Worker queues */
+#define PROF_LOCK_SYN 1 /* syn_mutex */
+#define PROF_LOCK_ARP 2 /* arp_mutex */
+#define PROF_LOCK_BLACKLIST 3 /* blacklist_mutex */
+#define PROF_LOCKS 4
+
+/* Hardware events counted in user space, in the order of a group read */
+#define PROF_CYCLES 0
+#define PROF_INSTRUCTIONS 1
+#define PROF_CACHE_MISSES 2
+#define PROF_BRANCH_MISSES 3
+#define PROF_EVENTS 4
+
+/* Threads that may be profiled, the workers and the others */
+#define PROF_THREADS (MAX_THREADS + OTHER_THREADS)
+
+/* Non-zero once prof_init has been called */
+extern int prof_on;
+
+/* Totals of one stage, as filled by prof_totals */
+struct prof_stage_totals
+{
+	unsigned long long ns; /* Wall time */
+	unsigned long long events[PROF_EVENTS];
+};
+
+/* Totals of one mutex, as filled by prof_totals */
+struct prof_lock_totals
+{
+	unsigned long long acquired, contended, wait_ns;
+};
+
+/**
+ * Turn profiling on. Each thread that calls prof_thread_start from then
+ * on gets its own group of hardware counters (perf_event_open), read on
+ * every change of stage; when the kernel refuses them (no PMU,
+ * perf_event_paranoid) only wall time and mutex waits are measured.
+ * Reading the counters is a system call, about one per stage change,
+ * so a profiled sensor is slightly slower.
+ * @return
+ *		1 if hardware counters are available
+ *		0 otherwise, after printing why
+ */
+int prof_init(void);
+
+/**
+ * Free the state of all profiled threads.
+ */
+void prof_destroy(void);
+
+/**
+ * Start profiling the calling thread, idle until its first prof_stage.
+ * Does nothing unless profiling is on.
+ * @arg name
+ *		Name of the thread in the report, a constant string
+ * @arg id
+ *		Number of the thread after name, -1 for none
+ */
+void prof_thread_start(const char* name, int id);
+
+/**
+ * Stop profiling the calling thread and close its counters. What it
+ * counted stays in the report.
+ */
+void prof_thread_stop(void);
+
+/* Profiled versions of prof_stage and prof_lock */
+void prof_switch(int stage);
+void prof_lock_wait(pthread_mutex_t* m, int lock);
+
+/**
+ * Account the time and events of the calling thread from now on to a
+ * stage, or to nothing with PROF_IDLE.
+ */
+static inline void prof_stage(int stage)
+{
+	if (prof_on)
+	{
+		prof_switch(stage);
+	}
+}
+
+/**
+ * pthread_mutex_lock, measuring the wait when the mutex is held by
+ * another thread.
+ * @arg lock
+ *		PROF_LOCK_ the mutex is accounted to
+ */
+static inline void prof_lock(pthread_mutex_t* m, int lock)
+{
+	if (prof_on)
+	{
+		prof_lock_wait(m, lock);
+	}
+	else
+	{
+		pthread_mutex_lock(m);
+	}
+}
+
+/**
+ * Sum what all threads counted so far. May be called while they run.
+ * @arg stages
+ *		PROF_STAGES entries
+ * @arg locks
+ *		PROF_LOCKS entries
+ */
+void prof_totals(struct prof_stage_totals* stages, struct prof_lock_totals* locks);
+
+/**
+ * Print the breakdown per stage, per thread and per mutex.
+ */
+void prof_report(FILE* out);
+
+/**
+ * Write the totals as the members of a JSON object.
+ */
+void prof_json(FILE* out);
+
+#endif
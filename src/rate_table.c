@@ -0,0 +1,145 @@
+#include "rate_table.h"
+/* Includes are in header file */
+
+void rate_table_init(struct rate_table* t)
+{
+	/* All zero is a table of free slots */
+	t->slots = mem_alloc(MEM_RATES, RATE_SLOTS * sizeof(struct rate_slot), 1);
+	atomic_init(&t->untracked, 0);
+}
+
+void rate_table_destroy(struct rate_table* t)
+{
+	mem_free(MEM_RATES, t->slots, RATE_SLOTS * sizeof(struct rate_slot));
+}
+
+/**
+ * Find the slot of a destination, claiming a free one or one idle for
+ * RATE_IDLE_MS if it has none yet.
+ * @return
+ *		The slot, NULL if all probed slots belong to active destinations
+ */
+static struct rate_slot* rate_slot_of(struct rate_table* t, uint64_t key, uint32_t now_ms)
+{
+	uint32_t h = (uint32_t) ((key * 0x9e3779b97f4a7c15ull) >> 32);
+	struct rate_slot* idle = NULL;
+	int p;
+	for (p = 0; p < RATE_PROBES; ++p)
+	{
+		struct rate_slot* s = t->slots + ((h + p) & (RATE_SLOTS - 1));
+		uint64_t k = atomic_load_explicit(&s->key, memory_order_relaxed);
+		if (k == 0)
+		{
+			if (atomic_compare_exchange_strong(&s->key, &k, key))
+			{
+				return s;
+			}
+			/* Lost the race to another destination, or to this one */
+		}
+		if (k == key)
+		{
+			return s;
+		}
+		uint64_t b = atomic_load_explicit(&s->bucket, memory_order_relaxed);
+		if (!idle && b && (int32_t) (now_ms - (uint32_t) (b >> 32)) > RATE_IDLE_MS)
+		{
+			idle = s;
+		}
+	}
+	if (idle)
+	{
+		uint64_t k = atomic_load_explicit(&idle->key, memory_order_relaxed);
+		if (atomic_compare_exchange_strong(&idle->key, &k, key))
+		{
+			/* A packet of the previous destination racing with this
+			 * may still land in the new counts, which is harmless */
+			atomic_store(&idle->bucket, 0);
+			atomic_store(&idle->packets, 0);
+			atomic_store(&idle->over, 0);
+			atomic_store(&idle->flooded, 0);
+			return idle;
+		}
+	}
+	return NULL;
+}
+
+int rate_table_hit(struct rate_table* t, int proto, uint32_t dst, long long ts, int pps, int burst)
+{
+	uint32_t now_ms = (uint32_t) (ts / 1000);
+	struct rate_slot* s = rate_slot_of(t, (uint64_t) proto << 32 | dst, now_ms);
+	if (!s)
+	{
+		atomic_fetch_add_explicit(&t->untracked, 1, memory_order_relaxed);
+		return 0;
+	}
+
+	const uint64_t capacity = (uint64_t) burst * 1000;
+	uint64_t old = atomic_load_explicit(&s->bucket, memory_order_relaxed);
+	uint64_t next;
+	int over;
+	do
+	{
+		uint32_t last = (uint32_t) (old >> 32);
+		uint64_t tokens = (uint32_t) old;
+		if (!old)
+		{
+			/* New destination, starts with a full bucket */
+			last = now_ms;
+			tokens = capacity;
+		}
+		/* Packets of other workers may be a little older, time never
+		 * goes back */
+		int32_t elapsed = (int32_t) (now_ms - last);
+		if (elapsed > 0)
+		{
+			tokens += (uint64_t) elapsed * pps;
+			tokens = tokens > capacity ? capacity : tokens;
+			last = now_ms;
+		}
+		over = tokens < 1000;
+		tokens -= over ? 0 : 1000;
+		next = (uint64_t) last << 32 | tokens;
+	}
+	while (next != old
+	    && !atomic_compare_exchange_weak_explicit(&s->bucket, &old, next, memory_order_relaxed, memory_order_relaxed));
+
+	atomic_fetch_add_explicit(&s->packets, 1, memory_order_relaxed);
+	if (!over)
+	{
+		return 0;
+	}
+	atomic_fetch_add_explicit(&s->over, 1, memory_order_relaxed);
+	if (atomic_load_explicit(&s->flooded, memory_order_relaxed) || atomic_exchange(&s->flooded, 1))
+	{
+		return RATE_OVER;
+	}
+	return RATE_OVER | RATE_FIRST;
+}
+
+int rate_table_top(struct rate_table* t, struct rate_top* out, int max)
+{
+	int n = 0;
+	int i;
+	for (i = 0; i < RATE_SLOTS; ++i)
+	{
+		struct rate_slot* s = t->slots + i;
+		unsigned long long over = atomic_load_explicit(&s->over, memory_order_relaxed);
+		if (!over || (n == max && over <= out[max - 1].over))
+		{
+			continue;
+		}
+		/* Insertion into the sorted list */
+		int j = n < max ? n++ : max - 1;
+		while (j > 0 && out[j - 1].over < over)
+		{
+			out[j] = out[j - 1];
+			--j;
+		}
+		uint64_t key = atomic_load_explicit(&s->key, memory_order_relaxed);
+		out[j].ip = (uint32_t) key;
+		out[j].proto = (int) (key >> 32);
+		out[j].packets = atomic_load_explicit(&s->packets, memory_order_relaxed);
+		out[j].over = over;
+	}
+	return n;
+}
@@ -0,0 +1,100 @@
+#ifndef CS241_RATE_TABLE_H
+#define CS241_RATE_TABLE_H
+
+#include <stdlib.h> /* calloc, free */
+#include <stdio.h> /* fprintf */
+#include <stdint.h> /* uint32_t, uint64_t */
+#include <stdatomic.h> /* atomic_ullong */
+#include "mem.h" /* mem_alloc */
+
+/* Slots of the table, power of two */
+#define RATE_SLOTS 65536
+/* Slots probed for a destination before giving up on it */
+#define RATE_PROBES 8
+/* A destination silent that long (ms) gives up its slot to a new one */
+#define RATE_IDLE_MS 60000
+
+/* Sustained rate (packets/sec) and burst (packets) a destination may
+ * receive before its packets count as a flood */
+#define RATE_UDP_PPS 20000
+#define RATE_UDP_BURST 40000
+#define RATE_ICMP_PPS 1000
+#define RATE_ICMP_BURST 2000
+
+/* What rate_table_hit returns */
+#define RATE_OVER 0x1 /* The packet was over the rate */
+#define RATE_FIRST 0x2 /* and the first of its destination to be */
+
+/**
+ * A token bucket of one destination. The bucket is a single word, time
+ * of the last refill (ms, wrapping) in the high half and tokens
+ * (thousandths of a packet) in the low half, so that it is updated with
+ * one compare and swap.
+ */
+struct rate_slot
+{
+	atomic_ullong key; /* Protocol << 32 | address, 0 if free */
+	atomic_ullong bucket;
+	atomic_ullong packets, over;
+	atomic_int flooded; /* Set with the first packet over the rate */
+};
+
+/**
+ * Token buckets of the destinations of UDP and ICMP traffic in a fixed
+ * open addressing table. Updates are lock-free and never allocate, so
+ * that a flood of millions of packets per second costs a hash, a few
+ * probes and a compare and swap per packet. A destination that cannot
+ * find a slot among RATE_PROBES is counted as untracked.
+ */
+struct rate_table
+{
+	struct rate_slot* slots;
+	atomic_ullong untracked;
+};
+
+/* A flooded destination, as listed by rate_table_top */
+struct rate_top
+{
+	uint32_t ip;
+	int proto;
+	unsigned long long packets, over;
+};
+
+/**
+ * Initialise the table, exits if out of memory.
+ */
+void rate_table_init(struct rate_table* t);
+
+/**
+ * Free/deallocate resources of the table.
+ */
+void rate_table_destroy(struct rate_table* t);
+
+/**
+ * Account a packet to its destination.
+ * @arg proto
+ *		IP protocol, non zero
+ * @arg dst
+ *		Destination address (host byte order)
+ * @arg ts
+ *		Capture time (micro seconds)
+ * @arg pps
+ *		Refill rate of the bucket
+ * @arg burst
+ *		Capacity of the bucket
+ * @return
+ *		RATE_ flags, 0 if the packet was within the rate
+ */
+int rate_table_hit(struct rate_table* t, int proto, uint32_t dst, long long ts, int pps, int burst);
+
+/**
+ * The destinations that received the most packets over their rate
+ * since start.
+ * @arg out
+ *		Filled with up to max destinations, most over first
+ * @return
+ *		Number of destinations filled in
+ */
+int rate_table_top(struct rate_table* t, struct rate_top* out, int max);
+
+#endif
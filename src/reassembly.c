@@ -0,0 +1,428 @@
+#include "reassembly.h"
+/* Includes are in header file */
+
+/* Out of order segment already copied into the flow buffer */
+struct reasm_seg
+{
+	int off, len;
+	uint32_t seq; /* Of a held segment, placed once the start is known */
+};
+
+/* Reassembly state of one client to server flow */
+struct reasm_flow
+{
+	struct flow_key key;
+	int in_use;
+	/* Start of the request seen, otherwise segments are only held in
+	 * buf, one after the other, until it arrives */
+	int started;
+	int held;				/* Bytes of held segments */
+	int fin;				/* A held segment closed the flow */
+	/* Once free, the request checked last, from base_seq to base_seq +
+	 * contig, is remembered until the slot is reused */
+	int judged;
+	uint32_t base_seq;		/* Sequence number of the first request byte */
+	int contig;				/* Bytes buffered without holes from base_seq */
+	int nsegs;				/* Number of out of order segments in segs */
+	struct reasm_seg segs[REASM_MAX_SEGS];
+	long long last_seen;	/* Time of last segment (micro seconds) */
+	char* buf;				/* REASM_BUF_SIZE bytes, owned by the arena */
+};
+
+/* Set of flows sharing the same hash, guarded by one mutex so that
+ * workers only contend when touching flows of the same bucket */
+struct reasm_bucket
+{
+	pthread_mutex_t mutex;
+	struct reasm_flow flows[REASM_WAYS];
+};
+
+static struct reasm_bucket* buckets;
+
+/* A single allocation holding the buffers of every flow slot. Buffers
+ * are handed out by slot position so taking or releasing a flow never
+ * allocates, and pages of unused slots are never touched. */
+static char* arena;
+
+void reasm_init(void)
+{
+	buckets = mem_alloc(MEM_REASM, REASM_BUCKETS * sizeof(struct reasm_bucket), 1);
+	arena = mem_alloc(MEM_REASM, (size_t) REASM_BUCKETS * REASM_WAYS * REASM_BUF_SIZE, 0);
+	int b, w;
+	for (b = 0; b < REASM_BUCKETS; ++b)
+	{
+		pthread_mutex_init(&buckets[b].mutex, NULL);
+		for (w = 0; w < REASM_WAYS; ++w)
+		{
+			buckets[b].flows[w].buf = arena + ((size_t) b * REASM_WAYS + w) * REASM_BUF_SIZE;
+		}
+	}
+}
+
+void reasm_destroy(void)
+{
+	int b;
+	for (b = 0; b < REASM_BUCKETS; ++b)
+	{
+		pthread_mutex_destroy(&buckets[b].mutex);
+	}
+	mem_free(MEM_REASM, buckets, REASM_BUCKETS * sizeof(struct reasm_bucket));
+	mem_free(MEM_REASM, arena, (size_t) REASM_BUCKETS * REASM_WAYS * REASM_BUF_SIZE);
+}
+
+/* What request_start found at the start of a segment */
+#define START_NONE 0
+#define START_METHOD 1 /* An upper case method token followed by a space */
+#define START_PREFIX 2 /* Only upper case letters, the first ones of a method */
+
+/**
+ * Checks if the given bytes look like the start of an HTTP request. A
+ * client may split the request line anywhere, even within the method,
+ * so a segment that could be the first letters of a method starts a
+ * request too.
+ */
+static int request_start(const char* s, int n)
+{
+	int i;
+	for (i = 0; i < n && i < 8; ++i)
+	{
+		if (s[i] == ' ')
+		{
+			return i >= 3 ? START_METHOD : START_NONE;
+		}
+		if (s[i] < 'A' || s[i] > 'Z')
+		{
+			return START_NONE;
+		}
+	}
+	return i == n && n > 0 ? START_PREFIX : START_NONE;
+}
+
+/**
+ * Search for the empty line ending the request headers.
+ * @arg s
+ *		The request bytes
+ * @arg from
+ *		First index that may hold the newline ending the last header
+ * @arg to
+ *		Number of valid bytes in s
+ * @return
+ *		1 iff the end of the headers lies in s[from..to)
+ */
+static int has_headers_end(const char* s, int from, int to)
+{
+	int i;
+	for (i = from; i < to - 1; ++i)
+	{
+		if (s[i] == '\n'
+		    && (s[i + 1] == '\n' || (i + 2 < to && s[i + 1] == '\r' && s[i + 2] == '\n')))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Whether a flow may be evicted without losing a request in progress:
+ * idle for REASM_TIMEOUT_US, or holding segments for REASM_HOLD_US.
+ */
+static int reasm_idle(const struct reasm_flow* f, long long now)
+{
+	return now - f->last_seen > (f->started ? REASM_TIMEOUT_US : REASM_HOLD_US);
+}
+
+/**
+ * Find the slot of a flow in a bucket, possibly evicting another flow to
+ * make room. Idle flows are preferred as victims, then the least recently
+ * seen one. The returned slot is reset. Bucket mutex must be held.
+ */
+static struct reasm_flow* reasm_take(struct reasm_bucket* b, const struct flow_key* key, long long now)
+{
+	struct reasm_flow* victim = NULL;
+	int w;
+	for (w = 0; w < REASM_WAYS; ++w)
+	{
+		struct reasm_flow* f = b->flows + w;
+		if (f->in_use && flow_key_eq(&f->key, key))
+		{
+			victim = f;
+			break;
+		}
+		if (!f->in_use || reasm_idle(f, now))
+		{
+			victim = f;
+		}
+		else if (!victim || (victim->in_use && f->last_seen < victim->last_seen))
+		{
+			victim = f;
+		}
+	}
+	victim->key = *key;
+	victim->in_use = 1;
+	victim->started = 1;
+	victim->contig = 0;
+	victim->nsegs = 0;
+	return victim;
+}
+
+/**
+ * Find a slot to hold segments of a flow whose start was not seen, only
+ * among free and idle slots: a request in progress is worth more than
+ * segments that may never be completed. Bucket mutex must be held.
+ * @return
+ *		The reset slot, NULL if there is none
+ */
+static struct reasm_flow* reasm_hold_slot(struct reasm_bucket* b, const struct flow_key* key, long long now)
+{
+	int w;
+	for (w = 0; w < REASM_WAYS; ++w)
+	{
+		struct reasm_flow* f = b->flows + w;
+		if (!f->in_use || reasm_idle(f, now))
+		{
+			f->key = *key;
+			f->in_use = 1;
+			f->started = 0;
+			f->held = 0;
+			f->fin = 0;
+			f->contig = 0;
+			f->nsegs = 0;
+			return f;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Hold a segment of a flow not started yet. Segments past the buffer or
+ * the out of order limit are dropped.
+ */
+static void reasm_hold(struct reasm_flow* f, uint32_t seq, int fin, const char* data, int len)
+{
+	f->fin |= fin;
+	if (len > REASM_BUF_SIZE - f->held)
+	{
+		len = REASM_BUF_SIZE - f->held;
+	}
+	if (len <= 0 || f->nsegs == REASM_MAX_SEGS)
+	{
+		return;
+	}
+	memcpy(f->buf + f->held, data, len);
+	f->segs[f->nsegs].off = f->held;
+	f->segs[f->nsegs].len = len;
+	f->segs[f->nsegs].seq = seq;
+	f->nsegs++;
+	f->held += len;
+}
+
+/**
+ * Find a tracked flow in a bucket. Bucket mutex must be held.
+ * @return
+ *		The flow or NULL if it is not being tracked
+ */
+static struct reasm_flow* reasm_find(struct reasm_bucket* b, const struct flow_key* key)
+{
+	int w;
+	for (w = 0; w < REASM_WAYS; ++w)
+	{
+		if (b->flows[w].in_use && flow_key_eq(&b->flows[w].key, key))
+		{
+			return b->flows + w;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Whether a segment is a late one of a request already checked: a copy
+ * of one of its bytes, or a segment before it ("GE" analysed after "T"
+ * and the rest). Such a segment would otherwise take a slot for nothing
+ * until it times out. Bucket mutex must be held.
+ */
+static int reasm_judged(const struct reasm_bucket* b, const struct flow_key* key, uint32_t seq)
+{
+	int w;
+	for (w = 0; w < REASM_WAYS; ++w)
+	{
+		const struct reasm_flow* f = b->flows + w;
+		if (!f->in_use && f->judged && flow_key_eq(&f->key, key))
+		{
+			return (uint32_t) (seq - f->base_seq) < (uint32_t) f->contig
+			    || (uint32_t) (f->base_seq - seq) < REASM_BUF_SIZE;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Copy segment data into the flow buffer at the given offset and extend
+ * the contiguous prefix, pulling in out of order segments it now reaches.
+ * Segments past the buffer are truncated, segments that would exceed the
+ * out of order limit are dropped (the retransmission will fill the hole).
+ */
+static void reasm_place(struct reasm_flow* f, uint32_t off, const char* data, int len)
+{
+	if (off >= REASM_BUF_SIZE || len <= 0)
+	{
+		return;
+	}
+	if (len > REASM_BUF_SIZE - (int) off)
+	{
+		len = REASM_BUF_SIZE - off;
+	}
+	if ((int) off > f->contig)
+	{
+		if (f->nsegs < REASM_MAX_SEGS)
+		{
+			memcpy(f->buf + off, data, len);
+			f->segs[f->nsegs].off = off;
+			f->segs[f->nsegs].len = len;
+			f->nsegs++;
+		}
+		return;
+	}
+	memcpy(f->buf + off, data, len);
+	if ((int) off + len > f->contig)
+	{
+		f->contig = off + len;
+	}
+	/* Absorb out of order segments now adjacent to the prefix */
+	int i = 0;
+	while (i < f->nsegs)
+	{
+		struct reasm_seg* s = f->segs + i;
+		if (s->off <= f->contig)
+		{
+			if (s->off + s->len > f->contig)
+			{
+				f->contig = s->off + s->len;
+			}
+			*s = f->segs[--f->nsegs];
+			i = 0; /* contig moved, rescan */
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
+
+/**
+ * Start the request of a flow at seq, placing the start and then what
+ * the flow had where the sequence numbers say: its held segments, or,
+ * when a segment before the presumed start arrives (a "T" taken for a
+ * start before the "GE"), what was buffered from the old start.
+ */
+static void reasm_restart(struct reasm_flow* f, uint32_t seq, const char* data, int len)
+{
+	char old[REASM_BUF_SIZE];
+	struct reasm_seg segs[REASM_MAX_SEGS + 1];
+	int n = 0;
+	if (f->started)
+	{
+		memcpy(old, f->buf, REASM_BUF_SIZE);
+		if (f->contig)
+		{
+			segs[n].off = 0;
+			segs[n].len = f->contig;
+			segs[n++].seq = f->base_seq;
+		}
+		int i;
+		for (i = 0; i < f->nsegs; ++i)
+		{
+			segs[n] = f->segs[i];
+			segs[n++].seq = f->base_seq + f->segs[i].off;
+		}
+	}
+	else
+	{
+		memcpy(old, f->buf, f->held);
+		memcpy(segs, f->segs, f->nsegs * sizeof(struct reasm_seg));
+		n = f->nsegs;
+	}
+	f->started = 1;
+	f->base_seq = seq;
+	f->contig = 0;
+	f->nsegs = 0;
+	reasm_place(f, 0, data, len);
+	int i;
+	for (i = 0; i < n; ++i)
+	{
+		/* Segments from before the start wrap past the buffer */
+		reasm_place(f, segs[i].seq - seq, old + segs[i].off, segs[i].len);
+	}
+}
+
+int reasm_segment(const struct flow_key* key, uint32_t seq, int fin,
+    const char* data, int len, long long now, reasm_check_fn check, int* verdict)
+{
+	int starts = request_start(data, len);
+	if (starts == START_METHOD && has_headers_end(data, 0, len))
+	{
+		/* Whole request in one segment, no state needed */
+		*verdict = check(data, len);
+		return 1;
+	}
+
+	struct reasm_bucket* b = buckets + (flow_hash(key) & (REASM_BUCKETS - 1));
+	int done = 0;
+	pthread_mutex_lock(&b->mutex);
+	struct reasm_flow* f = reasm_find(b, key);
+	if (!f && reasm_judged(b, key, seq))
+	{
+		pthread_mutex_unlock(&b->mutex);
+		return 0;
+	}
+	/* Within a request already tracked, a segment is a continuation
+	 * whatever it looks like ("T" after "GE") */
+	if (f && f->started && (uint32_t) (seq - f->base_seq) < REASM_BUF_SIZE)
+	{
+		starts = START_NONE;
+	}
+	int old_contig = 0;
+	if (starts && f && (!f->started || (uint32_t) (f->base_seq - seq) < REASM_BUF_SIZE))
+	{
+		fin |= !f->started && f->fin;
+		reasm_restart(f, seq, data, len);
+	}
+	else if (starts)
+	{
+		f = reasm_take(b, key, now);
+		f->base_seq = seq;
+		reasm_place(f, 0, data, len);
+	}
+	else if (f && f->started)
+	{
+		old_contig = f->contig;
+		reasm_place(f, seq - f->base_seq, data, len);
+	}
+	else
+	{
+		/* Start not seen, maybe only analysed later */
+		struct reasm_flow* h = f ? f : reasm_hold_slot(b, key, now);
+		if (h)
+		{
+			reasm_hold(h, seq, fin, data, len);
+			h->last_seen = now;
+		}
+		f = NULL;
+	}
+	if (f)
+	{
+		f->last_seen = now;
+		if (fin
+		    || f->contig == REASM_BUF_SIZE
+		    || (f->contig > old_contig
+		        && has_headers_end(f->buf, old_contig > 2 ? old_contig - 2 : 0, f->contig)))
+		{
+			*verdict = check(f->buf, f->contig);
+			f->in_use = 0;
+			f->judged = 1;
+			done = 1;
+		}
+	}
+	pthread_mutex_unlock(&b->mutex);
+	return done;
+}
@@ -0,0 +1,78 @@
+#ifndef CS241_REASSEMBLY_H
+#define CS241_REASSEMBLY_H
+
+#include <stdlib.h> /* malloc, free */
+#include <stdio.h> /* fprintf */
+#include <string.h> /* memcpy, memset */
+#include <stdint.h> /* uint32_t */
+#include <pthread.h> /* pthread_mutex_t */
+#include "mem.h" /* mem_alloc */
+
+#include "flow.h" /* struct flow_key */
+
+/* Maximum bytes of request headers buffered per flow, anything past
+ * this is not buffered and the request is checked as is. */
+#define REASM_BUF_SIZE 2048
+/* Flow table geometry, REASM_BUCKETS * REASM_WAYS flows are tracked
+ * at most, held segments of flows not seen starting included.
+ * REASM_BUCKETS must be a power of two. */
+#define REASM_BUCKETS 1024
+#define REASM_WAYS 4
+/* Out of order segments remembered per flow */
+#define REASM_MAX_SEGS 8
+/* Flows idle for longer than this (micro seconds) are evicted first */
+#define REASM_TIMEOUT_US 5000000LL
+/* Segments of a flow whose request start was not seen yet are held
+ * this long (micro seconds) at least, in case the start was only
+ * reordered after them */
+#define REASM_HOLD_US 200000LL
+
+/* Checks a (possibly partial) HTTP request, returns its verdict */
+typedef int (*reasm_check_fn)(const char* req, int n);
+
+/**
+ * Allocate the flow table and the arena backing the per flow buffers.
+ * Must be called before any call to reasm_segment.
+ */
+void reasm_init(void);
+
+/**
+ * Free all resources of the reassembly stage.
+ */
+void reasm_destroy(void);
+
+/**
+ * Feed one TCP segment of a client to server HTTP flow. Segments that
+ * hold a complete request are checked in place without touching the
+ * flow table. Otherwise the segment is buffered until the end of the
+ * request headers is seen, the buffer fills up, or the flow is closed.
+ * A request starts with a segment holding an upper case method, or only
+ * the first letters of one when the client splits the method itself.
+ * Other segments of a flow not seen starting a request are held, up to
+ * REASM_MAX_SEGS of them: with several workers a later segment may be
+ * analysed before the start of its request. They join the request once
+ * its start arrives, and are dropped if it does not come within
+ * REASM_HOLD_US and the slot is needed. Segments of a request already
+ * checked that arrive late are ignored.
+ * @arg key
+ *		The flow the segment belongs to
+ * @arg seq
+ *		TCP sequence number of the first payload byte (host byte order)
+ * @arg fin
+ *		Non-zero if the segment closes the flow (FIN or RST)
+ * @arg data
+ *		Segment payload, length len
+ * @arg now
+ *		Current time in micro seconds, used for aging flows
+ * @arg check
+ *		Called on the request once complete
+ * @arg verdict
+ *		Set to the return value of check when a verdict is reached
+ * @return
+ *		1 if a verdict was reached for the request
+ *		0 if the request is still incomplete or the segment was ignored
+ */
+int reasm_segment(const struct flow_key* key, uint32_t seq, int fin,
+    const char* data, int len, long long now, reasm_check_fn check, int* verdict);
+
+#endif
@@ -0,0 +1,44 @@
+#include "sampling.h"
+/* Includes are in header file */
+
+static long high = 0;
+/* Only written by the capture thread, read by workers */
+static atomic_int shift;
+static long long last_change = 0;
+
+void sampling_init(long high_water)
+{
+	high = high_water;
+	atomic_init(&shift, 0);
+}
+
+void sampling_update(long pending, long long now)
+{
+	if ((!high && !mem_limit()) || now - last_change < SAMPLE_ADJUST_US)
+	{
+		return;
+	}
+	/* Packets waiting are what memory is spent on, shedding inspection
+	 * makes the workers drain them faster */
+	int pressure = mem_pressure();
+	int s = atomic_load_explicit(&shift, memory_order_relaxed);
+	if (((high && pending > high) || pressure) && s < SAMPLE_MAX_SHIFT)
+	{
+		++s;
+	}
+	else if ((!high || pending < high / 4) && !pressure && s > 0)
+	{
+		--s;
+	}
+	else
+	{
+		return;
+	}
+	atomic_store_explicit(&shift, s, memory_order_relaxed);
+	last_change = now;
+}
+
+int sampling_shift(void)
+{
+	return atomic_load_explicit(&shift, memory_order_relaxed);
+}
@@ -0,0 +1,56 @@
+#ifndef CS241_SAMPLING_H
+#define CS241_SAMPLING_H
+
+#include <stdint.h> /* uint32_t */
+#include <stdatomic.h> /* atomic_int */
+#include "mem.h" /* mem_pressure */
+
+/* Lowest sampling rate, 1 in 2^SAMPLE_MAX_SHIFT flows */
+#define SAMPLE_MAX_SHIFT 10
+/* Shortest time between two changes of the rate (micro seconds), so
+ * that the backlog has time to react */
+#define SAMPLE_ADJUST_US 10000
+
+/**
+ * Overload sampling of payload inspection. While more packets wait for
+ * the workers than a high water mark the share of flows whose payload
+ * is inspected is halved, down to 1 in 2^SAMPLE_MAX_SHIFT; once the
+ * backlog is under a quarter of the mark it is doubled again. The rate
+ * is halved the same way while the memory budget is under pressure
+ * (mem_pressure). Header only detections (SYN, ARP) are never sampled.
+ * @arg high_water
+ *		Pending packets above which sampling starts, 0 to never sample
+ */
+void sampling_init(long high_water);
+
+/**
+ * Adjust the rate to the backlog. Called by the capture thread only.
+ * @arg pending
+ *		Packets dispatched but not analysed yet
+ * @arg now
+ *		Current time (micro seconds)
+ */
+void sampling_update(long pending, long long now);
+
+/**
+ * @return
+ *		Current rate as a shift, 1 in 2^shift flows is inspected
+ */
+int sampling_shift(void);
+
+/**
+ * Whether to inspect the payload of a flow at the current rate. All
+ * packets of a flow get the same answer as long as the rate does not
+ * change, so reassembly sees every segment of the flows it keeps.
+ * @arg hash
+ *		flow_hash of the flow
+ * @arg shift
+ *		Rate to use, from sampling_shift
+ */
+static inline int sampling_keep(uint32_t hash, int shift)
+{
+	/* Top bits, the low ones pick the worker in DISPATCH_FLOW mode */
+	return shift == 0 || (hash >> (32 - shift)) == 0;
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include "scan_table.h"
+/* Includes are in header file */
+
+/**
+ * Bits expected to be set in a sketch after n distinct values, the
+ * inverse of the linear counting estimate -m ln(zeros / m).
+ */
+static int sketch_bits(int n)
+{
+	double m = SCAN_SKETCH_BITS;
+	return (int) (m * (1 - exp(-n / m)) + 0.5);
+}
+
+void scan_table_init(struct scan_table* t, int capacity, int window_s)
+{
+	t->nbuckets = 1;
+	while (t->nbuckets * SRC_WAYS < capacity)
+	{
+		t->nbuckets *= 2;
+	}
+	t->window = window_s * 1000000LL;
+	t->port_bits = sketch_bits(SCAN_PORTS);
+	t->host_bits = sketch_bits(SCAN_HOSTS);
+	t->buckets = mem_alloc(MEM_SCANS, t->nbuckets * sizeof(struct scan_bucket), 1);
+	int b;
+	for (b = 0; b < t->nbuckets; ++b)
+	{
+		pthread_mutex_init(&t->buckets[b].mutex, NULL);
+	}
+}
+
+void scan_table_destroy(struct scan_table* t)
+{
+	int b;
+	for (b = 0; b < t->nbuckets; ++b)
+	{
+		pthread_mutex_destroy(&t->buckets[b].mutex);
+	}
+	mem_free(MEM_SCANS, t->buckets, t->nbuckets * sizeof(struct scan_bucket));
+}
+
+/**
+ * Set bit h of a sketch.
+ * @return
+ *		1 if it was not set before
+ *		0 otherwise.
+ */
+static inline int sketch_set(uint64_t* sketch, uint32_t h)
+{
+	uint64_t* w = sketch + (h >> 6);
+	uint64_t bit = 1ull << (h & 63);
+	if (*w & bit)
+	{
+		return 0;
+	}
+	*w |= bit;
+	return 1;
+}
+
+/**
+ * Pick the entry a new source replaces: a free entry, else one whose
+ * window is over, else the first unreferenced entry under the CLOCK
+ * hand. Bucket mutex must be held.
+ */
+static struct scan_entry* scan_victim(struct scan_table* t, struct scan_bucket* b, long long now)
+{
+	int w;
+	for (w = 0; w < SRC_WAYS; ++w)
+	{
+		struct scan_entry* e = b->entries + w;
+		if (!e->valid || now - e->first_seen > t->window)
+		{
+			return e;
+		}
+	}
+	for (;;)
+	{
+		struct scan_entry* e = b->entries + b->hand;
+		b->hand = (b->hand + 1) % SRC_WAYS;
+		if (!e->referenced)
+		{
+			return e;
+		}
+		e->referenced = 0;
+	}
+}
+
+/* Start a new window for a source */
+static void scan_entry_reset(struct scan_entry* e, uint32_t ip, long long now)
+{
+	e->ip = ip;
+	e->valid = 1;
+	e->reported = 0;
+	e->first_seen = now;
+	e->port_bits = e->host_bits = 0;
+	memset(e->ports, 0, sizeof(e->ports));
+	memset(e->hosts, 0, sizeof(e->hosts));
+}
+
+int scan_table_touch(struct scan_table* t, uint32_t src, uint32_t dst, uint16_t dport, long long now)
+{
+	/* Fibonacci hashing as in the source table, with different bits so
+	 * that a source shares its bucket with other neighbours here */
+	struct scan_bucket* b = t->buckets + (((src * 0x9e3779b1u) >> 8) & (t->nbuckets - 1));
+	/* Linear counting assumes random bits: a multiplicative hash would
+	 * spread sequential ports or hosts without collisions and flag a
+	 * sweep early */
+	uint32_t port_bit = hll_hash(dport) >> (64 - 8);
+	uint32_t host_bit = hll_hash(dst) >> (64 - 8);
+	int crossed = 0;
+	pthread_mutex_lock(&b->mutex);
+	struct scan_entry* e = NULL;
+	int w;
+	for (w = 0; w < SRC_WAYS; ++w)
+	{
+		if (b->entries[w].valid && b->entries[w].ip == src)
+		{
+			e = b->entries + w;
+			break;
+		}
+	}
+	if (!e)
+	{
+		e = scan_victim(t, b, now);
+		scan_entry_reset(e, src, now);
+	}
+	else if (now - e->first_seen > t->window)
+	{
+		scan_entry_reset(e, src, now);
+	}
+	e->referenced = 1;
+	e->port_bits += sketch_set(e->ports, port_bit);
+	e->host_bits += sketch_set(e->hosts, host_bit);
+	if (e->port_bits >= t->port_bits && !(e->reported & SCAN_VERTICAL))
+	{
+		crossed |= SCAN_VERTICAL;
+	}
+	if (e->host_bits >= t->host_bits && !(e->reported & SCAN_HORIZONTAL))
+	{
+		crossed |= SCAN_HORIZONTAL;
+	}
+	e->reported |= crossed;
+	pthread_mutex_unlock(&b->mutex);
+	return crossed;
+}
@@ -0,0 +1,102 @@
+#ifndef CS241_SCAN_TABLE_H
+#define CS241_SCAN_TABLE_H
+
+#include <stdlib.h> /* calloc, free */
+#include <stdio.h> /* fprintf */
+#include <string.h> /* memset */
+#include <stdint.h> /* uint32_t, uint64_t */
+#include <math.h> /* exp */
+#include <pthread.h> /* pthread_mutex_t */
+#include "src_table.h" /* SRC_WAYS */
+#include "hll.h" /* hll_hash */
+
+/* Bits of the port and host sketches of a source */
+#define SCAN_SKETCH_BITS 256
+#define SCAN_SKETCH_WORDS (SCAN_SKETCH_BITS / 64)
+/* Distinct destination ports of a vertical scan */
+#define SCAN_PORTS 100
+/* Distinct destination hosts of a horizontal scan */
+#define SCAN_HOSTS 64
+
+/* Scans scan_table_touch reports */
+#define SCAN_VERTICAL 0x1 /* Many ports */
+#define SCAN_HORIZONTAL 0x2 /* Many hosts */
+
+/**
+ * Connection attempts of one source within its window. The ports and
+ * hosts it tried are hashed into bitmaps; the number of bits set
+ * estimates the number of distinct values (linear counting), without
+ * any allocation per source.
+ */
+struct scan_entry
+{
+	uint32_t ip;
+	uint16_t port_bits, host_bits; /* Bits set in ports and hosts */
+	long long first_seen;	/* Start of the window of the source (micro seconds) */
+	unsigned char
+		valid,
+		referenced,			/* CLOCK reference bit */
+		reported;			/* SCAN_ flags already returned this window */
+	uint64_t ports[SCAN_SKETCH_WORDS];
+	uint64_t hosts[SCAN_SKETCH_WORDS];
+};
+
+struct scan_bucket
+{
+	pthread_mutex_t mutex;
+	int hand; /* CLOCK hand, next way considered for eviction */
+	struct scan_entry entries[SRC_WAYS];
+};
+
+/**
+ * Fixed capacity table of sources making connection attempts, sharded
+ * into buckets with a mutex each like struct src_table. A source's
+ * sketches start over once its window is over, so that a busy client
+ * does not add up to a scan over a long run; when a bucket fills one of
+ * its sources is evicted in CLOCK order.
+ */
+struct scan_table
+{
+	struct scan_bucket* buckets;
+	int nbuckets;		/* Power of two */
+	long long window;	/* Window length (micro seconds) */
+	/* Bits set once SCAN_PORTS ports, SCAN_HOSTS hosts are seen */
+	int port_bits, host_bits;
+};
+
+/**
+ * Initialise the table.
+ * @arg t
+ *		The table to initialise
+ * @arg capacity
+ *		Maximum number of sources tracked, rounded up to a power of two
+ *		multiple of SRC_WAYS
+ * @arg window_s
+ *		Seconds over which the ports and hosts of a source are counted
+ */
+void scan_table_init(struct scan_table* t, int capacity, int window_s);
+
+/**
+ * Free/deallocate resources of the table.
+ */
+void scan_table_destroy(struct scan_table* t);
+
+/**
+ * Record a connection attempt.
+ * @arg t
+ *		The table to act on
+ * @arg src
+ *		Source address (host byte order)
+ * @arg dst
+ *		Destination address (host byte order)
+ * @arg dport
+ *		Destination port
+ * @arg now
+ *		Current time (micro seconds)
+ * @return
+ *		The SCAN_ flags the source just crossed the threshold of, each
+ *		returned once per window of the source
+ */
+int scan_table_touch(struct scan_table* t, uint32_t src, uint32_t dst, uint16_t dport, long long now);
+
+#endif
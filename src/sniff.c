@@ -1,49 +1,252 @@
 #include "sniff.h"
 /* Includes are in header file */
 
-extern int should_exit;
+/* State shared with sniff_stop, which may run in a signal handler */
+static pcap_t *volatile active_handle = NULL;
+static int wakeup_fds[2] = {-1, -1};
+static volatile long long stop_requested = 0;
+/* Kernel counters of the live capture, read by the reporter */
+static atomic_int drops_known;
+static atomic_uint drops_received, drops_dropped, drops_ifdropped;
 
-// Application main sniffing loop
-void sniff(char *interface, int verbose)
+/* What pcap_dispatch passes to sniff_packet */
+struct sniff_state
+{
+	int verbose;
+	unsigned long count;
+};
+
+/* Called by pcap_dispatch for every captured packet */
+static void sniff_packet(unsigned char *user, const struct pcap_pkthdr *header, const unsigned char *packet)
+{
+	struct sniff_state *state = (struct sniff_state *) user;
+	// Optional: dump raw data to terminal
+	if (state->verbose)
+	{
+		dump(packet, header->caplen);
+	}
+	// Dispatch packet for processing
+	dispatch(header, packet, state->verbose);
+	++state->count;
+}
+
+/* Microseconds on the same clock as get_time, async signal safe */
+static long long sniff_clock(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	return (t.tv_sec * 1000000LL) + t.tv_nsec / 1000;
+}
+
+void sniff_stop(void)
+{
+	if (!stop_requested)
+	{
+		stop_requested = sniff_clock();
+	}
+	should_exit = 1;
+	pcap_t *handle = active_handle;
+	if (handle)
+	{
+		pcap_breakloop(handle);
+	}
+	if (wakeup_fds[1] >= 0)
+	{
+		/* Wakes up the poll in sniff, the byte itself is never read */
+		ssize_t ignored = write(wakeup_fds[1], "", 1);
+		(void) ignored;
+	}
+}
+
+long long sniff_stop_time(void)
+{
+	return stop_requested;
+}
+
+int sniff_drops(struct sniff_drops *drops)
+{
+	if (!atomic_load(&drops_known))
+	{
+		return 0;
+	}
+	drops->received = atomic_load(&drops_received);
+	drops->dropped = atomic_load(&drops_dropped);
+	drops->ifdropped = atomic_load(&drops_ifdropped);
+	return 1;
+}
+
+/* Publish the kernel counters, pcap_stats must be called by the thread
+ * using the handle */
+static void sniff_refresh_drops(pcap_t *pcap_handle)
+{
+	struct pcap_stat ps;
+	if (pcap_stats(pcap_handle, &ps) != 0)
+	{
+		return;
+	}
+	atomic_store(&drops_received, ps.ps_recv);
+	atomic_store(&drops_dropped, ps.ps_drop);
+	atomic_store(&drops_ifdropped, ps.ps_ifdrop);
+	atomic_store(&drops_known, 1);
+}
+
+/**
+ * Open an interface for live capture as set up by opts, exits if it
+ * cannot be activated.
+ */
+static pcap_t *sniff_open_live(char *interface, const struct sniff_options *opts)
 {
-	// Open network interface for packet capture
 	char errbuf[PCAP_ERRBUF_SIZE];
-	pcap_t *pcap_handle = pcap_open_live(interface, 4096, 1, 0, errbuf);
+	pcap_t *pcap_handle = pcap_create(interface, errbuf);
 	if (pcap_handle == NULL)
 	{
 		fprintf(stderr, "Unable to open interface %s\n", errbuf);
 		exit(EXIT_FAILURE);
 	}
+	/* Setters only fail on an activated handle */
+	pcap_set_snaplen(pcap_handle, opts->snaplen);
+	pcap_set_promisc(pcap_handle, opts->promisc);
+	pcap_set_timeout(pcap_handle, opts->timeout_ms);
+	pcap_set_immediate_mode(pcap_handle, opts->immediate);
+	if (opts->buffer_mb)
+	{
+		pcap_set_buffer_size(pcap_handle, opts->buffer_mb * 1024 * 1024);
+	}
+	int r = pcap_activate(pcap_handle);
+	if (r != 0)
+	{
+		/* Generic errors and warnings have their message in the handle */
+		const char *message = r == PCAP_ERROR || r == PCAP_WARNING
+		    ? pcap_geterr(pcap_handle) : pcap_statustostr(r);
+		if (r < 0)
+		{
+			fprintf(stderr, "Unable to open interface %s: %s\n", interface, message);
+			pcap_close(pcap_handle);
+			exit(EXIT_FAILURE);
+		}
+		fprintf(stderr, "[WARNING] %s: %s\n", interface, message);
+	}
+	return pcap_handle;
+}
+
+/**
+ * Wait until the capture handle is readable.
+ * @return
+ *		1 if packets may be ready
+ *		0 if sniff_stop was called
+ */
+static int sniff_wait(pcap_t *pcap_handle, int fd, int timeout_ms)
+{
+	struct pollfd fds[2] = {
+		{fd, POLLIN, 0},
+		{wakeup_fds[0], POLLIN, 0}
+	};
+	while (!should_exit)
+	{
+		/* The timeout bounds the delay of packets the kernel holds back
+		 * until its buffer block fills */
+		int r = poll(fds, 2, timeout_ms);
+		if (r < 0 && errno != EINTR)
+		{
+			fprintf(stderr, "[WARNING] poll failed: %s\n", strerror(errno));
+			return 1;
+		}
+		if (fds[1].revents)
+		{
+			return 0;
+		}
+		if (r >= 0)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Application main sniffing loop
+unsigned long sniff(char *interface, char *file, const struct sniff_options *opts, int verbose)
+{
+	// Open network interface (or file) for packet capture
+	char errbuf[PCAP_ERRBUF_SIZE];
+	pcap_t *pcap_handle = file
+	    ? pcap_open_offline(file, errbuf)
+	    : sniff_open_live(interface, opts);
+	if (pcap_handle == NULL)
+	{
+		fprintf(stderr, "Unable to open file %s\n", errbuf);
+		exit(EXIT_FAILURE);
+	}
 	else
 	{
-		printf("SUCCESS! Opened %s for capture\n", interface);
+		printf("SUCCESS! Opened %s for capture\n", file ? file : interface);
 	}
-	// Capture packets (very ugly code)
-	struct pcap_pkthdr header;
-	const unsigned char *packet;
+	/* Live captures block in poll rather than in pcap, so that sniff_stop
+	 * can wake them up through the pipe */
+	int fd = -1;
+	if (!file)
+	{
+		fd = pcap_get_selectable_fd(pcap_handle);
+		if (fd < 0 || pcap_setnonblock(pcap_handle, 1, errbuf) < 0)
+		{
+			fd = -1;
+		}
+		if (pipe(wakeup_fds) < 0)
+		{
+			fprintf(stderr, "[WARNING] No shutdown wakeup pipe: %s\n", strerror(errno));
+			wakeup_fds[0] = wakeup_fds[1] = -1;
+		}
+	}
+	active_handle = pcap_handle;
+	struct sniff_state state = {verbose, 0};
+	long long stats_at = 0;
+	/* A zero pcap timeout waits for a full buffer, poll must not spin */
+	int poll_ms = opts->timeout_ms > 0 ? opts->timeout_ms : SNIFF_TIMEOUT_MS;
 	while (!should_exit)
 	{
-		// Capture a  packet
-		packet = pcap_next(pcap_handle, &header);
-		if (packet == NULL)
+		if (!file && sniff_clock() - stats_at >= SNIFF_STATS_US)
 		{
-			// pcap_next can return null if no packet is seen within a timeout
-			if (verbose)
-			{
-				printf("No packet received. %s\n", pcap_geterr(pcap_handle));
-			}
+			sniff_refresh_drops(pcap_handle);
+			stats_at = sniff_clock();
 		}
-		else
+		prof_stage(PROF_IDLE);
+		if (fd >= 0 && wakeup_fds[0] >= 0 && !sniff_wait(pcap_handle, fd, poll_ms))
 		{
-			// Optional: dump raw data to terminal
-			if (verbose)
-			{
-				dump(packet, header.len);
-			}
-			// Dispatch packet for processing
-			dispatch(&header, packet, verbose);
+			break;
 		}
+		prof_stage(PROF_CAPTURE);
+		// Capture a burst of packets, handed to the workers in batches
+		int n = pcap_dispatch(pcap_handle, SNIFF_BURST, sniff_packet, (unsigned char *) &state);
+		dispatch_flush();
+		if (n == PCAP_ERROR_BREAK)
+		{
+			break;
+		}
+		if (n < 0)
+		{
+			fprintf(stderr, "Capture error: %s\n", pcap_geterr(pcap_handle));
+			break;
+		}
+		if (n == 0 && file)
+		{
+			// End of the replayed file
+			break;
+		}
+	}
+	active_handle = NULL;
+	if (!file)
+	{
+		sniff_refresh_drops(pcap_handle);
+	}
+	pcap_close(pcap_handle);
+	if (wakeup_fds[0] >= 0)
+	{
+		/* Unpublish before closing, sniff_stop may still be called */
+		int fds[2] = {wakeup_fds[0], wakeup_fds[1]};
+		wakeup_fds[0] = wakeup_fds[1] = -1;
+		close(fds[0]);
+		close(fds[1]);
 	}
+	return state.count;
 }
 
 // Utility/Debugging method for dumping raw packet data
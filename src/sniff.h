@@ -1,13 +1,89 @@
 #ifndef CS241_SNIFF_H
 #define CS241_SNIFF_H
 
+#include <errno.h>
+#include <poll.h>
+#include <signal.h> /* sig_atomic_t */
+#include <stdatomic.h> /* atomic_uint */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h> /* strerror */
+#include <time.h> /* clock_gettime */
+#include <unistd.h> /* pipe, write */
 #include <pcap.h>
 #include <netinet/if_ether.h>
 #include "dispatch.h"
 
-void sniff(char *interface, int verbose);
+/* Packets read from pcap per call, the staged batches are flushed to
+ * the workers after each burst */
+#define SNIFF_BURST 256
+/* Longest a live capture waits before delivering buffered packets */
+#define SNIFF_TIMEOUT_MS 100
+/* Bytes captured of each packet by default */
+#define SNIFF_SNAPLEN 4096
+/* Smallest snaplen, an Ethernet and an IPv6 header, and libpcap's largest */
+#define SNIFF_MIN_SNAPLEN (ETH_HLEN + 40)
+#define SNIFF_MAX_SNAPLEN 262144
+/* Largest kernel buffer (MB), libpcap takes its size in bytes as an int */
+#define SNIFF_MAX_BUFFER_MB 2047
+/* Interval of the kernel drop counters (micro seconds) */
+#define SNIFF_STATS_US 1000000
+
+/* How a live capture is set up, ignored when replaying a file */
+struct sniff_options
+{
+	int snaplen; /* Bytes captured of each packet */
+	int buffer_mb; /* Kernel buffer, 0 for the libpcap default */
+	int timeout_ms; /* Longest packets wait in the kernel buffer */
+	int immediate; /* Deliver every packet as soon as it arrives */
+	int promisc; /* Put the interface in promiscuous mode */
+};
+
+/* Counters of the kernel side of a live capture, since it started */
+struct sniff_drops
+{
+	unsigned int received; /* Packets seen by the kernel filter */
+	unsigned int dropped; /* Lost because the kernel buffer was full */
+	unsigned int ifdropped; /* Lost by the interface or driver */
+};
+
+/* Set once shutdown has been requested, defined in main.c */
+extern volatile sig_atomic_t should_exit;
+
+/**
+ * Capture packets and dispatch them to the workers until should_exit is
+ * set, or, when replaying a file, until the end of the file.
+ * @arg interface
+ *		Network interface to capture from, ignored if file is given
+ * @arg file
+ *		pcap file to replay at full speed instead, NULL for live capture
+ * @arg opts
+ *		Set up of the live capture
+ * @arg verbose
+ *		Non-zero to dump every packet
+ * @return
+ *		Number of packets dispatched
+ */
+unsigned long sniff(char *interface, char *file, const struct sniff_options *opts, int verbose);
+/**
+ * Make sniff return as soon as possible: sets should_exit, breaks out of
+ * pcap and wakes up a capture waiting for packets. Packets already
+ * dispatched are still analysed. Async signal safe.
+ */
+void sniff_stop(void);
+/**
+ * @return
+ *		Time (as get_time) of the first sniff_stop call, 0 if none
+ */
+long long sniff_stop_time(void);
+/**
+ * Kernel counters of the live capture, refreshed by the capture thread
+ * every SNIFF_STATS_US and when it stops.
+ * @return
+ *		1 with drops filled in
+ *		0 if there is no live capture or libpcap cannot tell
+ */
+int sniff_drops(struct sniff_drops *drops);
 void dump(const unsigned char *data, int length);
 
 #endif
@@ -0,0 +1,299 @@
+#include "src_table.h"
+/* Includes are in header file */
+
+void src_table_init(struct src_table* t, int capacity, int window_s)
+{
+	t->nbuckets = 1;
+	t->shift = 32;
+	while (t->nbuckets * SRC_WAYS < capacity)
+	{
+		t->nbuckets *= 2;
+		t->shift--;
+	}
+	t->window = window_s * 1000000LL;
+	t->buckets = mem_alloc(MEM_SOURCES, t->nbuckets * sizeof(struct src_bucket), 1);
+	t->buckets6 = mem_alloc(MEM_SOURCES, t->nbuckets * sizeof(struct src6_bucket), 1);
+	int b;
+	for (b = 0; b < t->nbuckets; ++b)
+	{
+		pthread_mutex_init(&t->buckets[b].mutex, NULL);
+		pthread_mutex_init(&t->buckets6[b].mutex, NULL);
+	}
+}
+
+void src_table_destroy(struct src_table* t)
+{
+	int b;
+	for (b = 0; b < t->nbuckets; ++b)
+	{
+		pthread_mutex_destroy(&t->buckets[b].mutex);
+		pthread_mutex_destroy(&t->buckets6[b].mutex);
+	}
+	mem_free(MEM_SOURCES, t->buckets, t->nbuckets * sizeof(struct src_bucket));
+	mem_free(MEM_SOURCES, t->buckets6, t->nbuckets * sizeof(struct src6_bucket));
+}
+
+/**
+ * Bucket index of a 32 bit hash, from as many of its top bits as there
+ * are buckets (a shift by 32 for a single bucket is done in 64 bits).
+ */
+static inline int src_bucket_index(const struct src_table* t, uint32_t h)
+{
+	return (int) ((uint64_t) h >> t->shift);
+}
+
+static struct src_bucket* src_bucket_of(struct src_table* t, uint32_t ip)
+{
+	/* Fibonacci hashing, top bits are the best mixed */
+	return t->buckets + src_bucket_index(t, ip * 0x9e3779b1u);
+}
+
+/**
+ * Pick the entry a new source replaces: a free entry, else one that aged
+ * out of the window, else the first unreferenced entry under the CLOCK
+ * hand. Bucket mutex must be held.
+ */
+static struct src_entry* src_victim(struct src_table* t, struct src_bucket* b, long long now)
+{
+	int w;
+	for (w = 0; w < SRC_WAYS; ++w)
+	{
+		struct src_entry* e = b->entries + w;
+		if (!e->valid || now - e->last_seen > t->window)
+		{
+			return e;
+		}
+	}
+	for (;;)
+	{
+		struct src_entry* e = b->entries + b->hand;
+		b->hand = (b->hand + 1) % SRC_WAYS;
+		if (!e->referenced)
+		{
+			b->evictions++;
+			return e;
+		}
+		e->referenced = 0;
+	}
+}
+
+int src_table_touch(struct src_table* t, uint32_t ip, long long now)
+{
+	struct src_bucket* b = src_bucket_of(t, ip);
+	int is_new = 0;
+	pthread_mutex_lock(&b->mutex);
+	struct src_entry* e = NULL;
+	int w;
+	for (w = 0; w < SRC_WAYS; ++w)
+	{
+		if (b->entries[w].valid && b->entries[w].ip == ip)
+		{
+			e = b->entries + w;
+			break;
+		}
+	}
+	if (!e)
+	{
+		e = src_victim(t, b, now);
+		e->ip = ip;
+		e->valid = 1;
+		e->syns = 0;
+		is_new = 1;
+	}
+	else if (now - e->last_seen > t->window)
+	{
+		/* Back after being silent for a whole window */
+		e->syns = 0;
+		is_new = 1;
+	}
+	e->syns++;
+	e->last_seen = now;
+	e->referenced = 1;
+	pthread_mutex_unlock(&b->mutex);
+	return is_new;
+}
+
+/**
+ * Way of an IPv6 bucket a new source replaces, as src_victim. Bucket
+ * mutex must be held.
+ */
+static int src6_victim(struct src_table* t, struct src6_bucket* b, long long now)
+{
+	int w;
+	for (w = 0; w < SRC_WAYS; ++w)
+	{
+		if (!b->valid[w] || now - b->last_seen[w] > t->window)
+		{
+			return w;
+		}
+	}
+	for (;;)
+	{
+		w = b->hand;
+		b->hand = (b->hand + 1) % SRC_WAYS;
+		if (!b->referenced[w])
+		{
+			b->evictions++;
+			return w;
+		}
+		b->referenced[w] = 0;
+	}
+}
+
+int src_table_touch6(struct src_table* t, const struct addr6* ip, long long now)
+{
+	struct src6_bucket* b = t->buckets6 + src_bucket_index(t, addr6_hash(ip));
+	int is_new = 0;
+	pthread_mutex_lock(&b->mutex);
+	int w;
+	for (w = 0; w < SRC_WAYS; ++w)
+	{
+		if (b->valid[w] && addr6_eq(b->ip + w, ip))
+		{
+			break;
+		}
+	}
+	if (w == SRC_WAYS)
+	{
+		w = src6_victim(t, b, now);
+		b->ip[w] = *ip;
+		b->valid[w] = 1;
+		b->syns[w] = 0;
+		is_new = 1;
+	}
+	else if (now - b->last_seen[w] > t->window)
+	{
+		b->syns[w] = 0;
+		is_new = 1;
+	}
+	b->syns[w]++;
+	b->last_seen[w] = now;
+	b->referenced[w] = 1;
+	pthread_mutex_unlock(&b->mutex);
+	return is_new;
+}
+
+void src_table_window(struct src_table* t, long long now, int* sources, unsigned long* syns)
+{
+	*sources = 0;
+	*syns = 0;
+	int b, w;
+	for (b = 0; b < t->nbuckets; ++b)
+	{
+		struct src_bucket* bk = t->buckets + b;
+		pthread_mutex_lock(&bk->mutex);
+		for (w = 0; w < SRC_WAYS; ++w)
+		{
+			struct src_entry* e = bk->entries + w;
+			if (e->valid && now - e->last_seen <= t->window)
+			{
+				++*sources;
+				*syns += e->syns;
+			}
+		}
+		pthread_mutex_unlock(&bk->mutex);
+		struct src6_bucket* bk6 = t->buckets6 + b;
+		pthread_mutex_lock(&bk6->mutex);
+		for (w = 0; w < SRC_WAYS; ++w)
+		{
+			if (bk6->valid[w] && now - bk6->last_seen[w] <= t->window)
+			{
+				++*sources;
+				*syns += bk6->syns[w];
+			}
+		}
+		pthread_mutex_unlock(&bk6->mutex);
+	}
+}
+
+unsigned long long src_table_evictions(struct src_table* t)
+{
+	unsigned long long total = 0;
+	int b;
+	for (b = 0; b < t->nbuckets; ++b)
+	{
+		pthread_mutex_lock(&t->buckets[b].mutex);
+		total += t->buckets[b].evictions;
+		pthread_mutex_unlock(&t->buckets[b].mutex);
+		pthread_mutex_lock(&t->buckets6[b].mutex);
+		total += t->buckets6[b].evictions;
+		pthread_mutex_unlock(&t->buckets6[b].mutex);
+	}
+	return total;
+}
+
+int src_table_export(struct src_table* t, struct src_entry* out, int max)
+{
+	int n = 0;
+	int b, w;
+	for (b = 0; b < t->nbuckets; ++b)
+	{
+		struct src_bucket* bk = t->buckets + b;
+		pthread_mutex_lock(&bk->mutex);
+		for (w = 0; w < SRC_WAYS && n < max; ++w)
+		{
+			if (bk->entries[w].valid)
+			{
+				out[n++] = bk->entries[w];
+			}
+		}
+		pthread_mutex_unlock(&bk->mutex);
+	}
+	return n;
+}
+
+int src_table_export6(struct src_table* t, struct src6_entry* out, int max)
+{
+	int n = 0;
+	int b, w;
+	for (b = 0; b < t->nbuckets; ++b)
+	{
+		struct src6_bucket* bk = t->buckets6 + b;
+		pthread_mutex_lock(&bk->mutex);
+		for (w = 0; w < SRC_WAYS && n < max; ++w)
+		{
+			if (bk->valid[w])
+			{
+				out[n].ip = bk->ip[w];
+				out[n].syns = bk->syns[w];
+				out[n].last_seen = bk->last_seen[w];
+				++n;
+			}
+		}
+		pthread_mutex_unlock(&bk->mutex);
+	}
+	return n;
+}
+
+void src_table_restore(struct src_table* t, uint32_t ip, uint32_t syns, long long last_seen)
+{
+	struct src_bucket* b = src_bucket_of(t, ip);
+	pthread_mutex_lock(&b->mutex);
+	struct src_entry* e = src_victim(t, b, last_seen);
+	e->ip = ip;
+	e->syns = syns;
+	e->last_seen = last_seen;
+	e->valid = 1;
+	e->referenced = 1;
+	pthread_mutex_unlock(&b->mutex);
+}
+
+void src_table_restore6(struct src_table* t, const struct addr6* ip, uint32_t syns, long long last_seen)
+{
+	struct src6_bucket* b = t->buckets6 + src_bucket_index(t, addr6_hash(ip));
+	pthread_mutex_lock(&b->mutex);
+	int w = src6_victim(t, b, last_seen);
+	b->ip[w] = *ip;
+	b->syns[w] = syns;
+	b->last_seen[w] = last_seen;
+	b->valid[w] = 1;
+	b->referenced[w] = 1;
+	pthread_mutex_unlock(&b->mutex);
+}
+
+void src_table_restore_evictions(struct src_table* t, unsigned long long evictions)
+{
+	pthread_mutex_lock(&t->buckets[0].mutex);
+	t->buckets[0].evictions += evictions;
+	pthread_mutex_unlock(&t->buckets[0].mutex);
+}
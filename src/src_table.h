@@ -0,0 +1,162 @@
+#ifndef CS241_SRC_TABLE_H
+#define CS241_SRC_TABLE_H
+
+#include <stdlib.h> /* calloc, free */
+#include <stdio.h> /* fprintf */
+#include <stdint.h> /* uint32_t */
+#include <pthread.h> /* pthread_mutex_t */
+#include "mem.h" /* mem_alloc */
+#include "addr6.h" /* struct addr6 */
+
+/* Entries per bucket, a source can only be stored in its bucket */
+#define SRC_WAYS 8
+
+/* One tracked source address */
+struct src_entry
+{
+	uint32_t ip;
+	uint32_t syns;			/* SYN packets since the source (re)entered the window */
+	long long last_seen;	/* Time of last SYN (micro seconds) */
+	unsigned char
+		valid,
+		referenced;			/* CLOCK reference bit */
+};
+
+struct src_bucket
+{
+	pthread_mutex_t mutex;
+	int hand; /* CLOCK hand, next way considered for eviction */
+	unsigned long long evictions;
+	struct src_entry entries[SRC_WAYS];
+};
+
+/**
+ * IPv6 sources, the same entries as src_entry in structure of arrays
+ * form so that the addresses of a bucket are compared back to back.
+ */
+struct src6_bucket
+{
+	struct addr6 ip[SRC_WAYS]; /* First, malloc aligns to 16 bytes */
+	uint32_t syns[SRC_WAYS];
+	long long last_seen[SRC_WAYS];
+	unsigned char valid[SRC_WAYS], referenced[SRC_WAYS];
+	pthread_mutex_t mutex;
+	int hand;
+	unsigned long long evictions;
+};
+
+/* An IPv6 source as copied by src_table_export6 */
+struct src6_entry
+{
+	struct addr6 ip;
+	uint32_t syns;
+	long long last_seen;
+};
+
+/**
+ * Fixed capacity table of recently seen SYN source addresses. Memory is
+ * allocated once, so it stays flat no matter how many (spoofed) sources
+ * are seen. Sources not seen within the window age out; when a bucket
+ * fills with sources still inside the window one of them is evicted in
+ * CLOCK order and counted. IPv6 sources have buckets of their own, as
+ * many as IPv4 ones, and count towards the same window.
+ */
+struct src_table
+{
+	struct src_bucket* buckets;
+	struct src6_bucket* buckets6;
+	int nbuckets;		/* Power of two */
+	int shift;			/* 32 - log2(nbuckets), top hash bits pick the bucket */
+	long long window;	/* Window length (micro seconds) */
+};
+
+/**
+ * Initialise the table.
+ * @arg t
+ *		The table to initialise
+ * @arg capacity
+ *		Maximum number of sources tracked, rounded up to a power of two
+ *		multiple of SRC_WAYS
+ * @arg window_s
+ *		Seconds after which a silent source no longer counts
+ */
+void src_table_init(struct src_table* t, int capacity, int window_s);
+
+/**
+ * Free/deallocate resources of the table.
+ */
+void src_table_destroy(struct src_table* t);
+
+/**
+ * Record a SYN from a source.
+ * @arg t
+ *		The table to act on
+ * @arg ip
+ *		Source address (host byte order)
+ * @arg now
+ *		Current time (micro seconds)
+ * @return
+ *		1 if the source was not in the window before
+ *		0 otherwise.
+ */
+int src_table_touch(struct src_table* t, uint32_t ip, long long now);
+
+/**
+ * Record a SYN from an IPv6 source, as src_table_touch.
+ */
+int src_table_touch6(struct src_table* t, const struct addr6* ip, long long now);
+
+/**
+ * Summarise the sources seen within the window.
+ * @arg t
+ *		The table to summarise
+ * @arg now
+ *		Current time (micro seconds), end of the window
+ * @arg sources
+ *		Set to the number of distinct sources in the window
+ * @arg syns
+ *		Set to the number of SYN packets these sources sent
+ */
+void src_table_window(struct src_table* t, long long now, int* sources, unsigned long* syns);
+
+/**
+ * @return
+ *		Number of sources evicted while still inside the window, that
+ *		is how often the capacity was too small
+ */
+unsigned long long src_table_evictions(struct src_table* t);
+
+/**
+ * Copy the valid IPv4 entries of the table, for checkpointing.
+ * @arg out
+ *		Filled with the entries, room for nbuckets * SRC_WAYS is enough
+ * @arg max
+ *		Capacity of out
+ * @return
+ *		Number of entries copied
+ */
+int src_table_export(struct src_table* t, struct src_entry* out, int max);
+
+/**
+ * Copy the valid IPv6 entries of the table, as src_table_export.
+ */
+int src_table_export6(struct src_table* t, struct src6_entry* out, int max);
+
+/**
+ * Put back a source saved with src_table_export. If its bucket is full
+ * the entry is placed like a new source would be.
+ */
+void src_table_restore(struct src_table* t, uint32_t ip, uint32_t syns, long long last_seen);
+
+/**
+ * Put back an IPv6 source saved with src_table_export6, as
+ * src_table_restore.
+ */
+void src_table_restore6(struct src_table* t, const struct addr6* ip, uint32_t syns, long long last_seen);
+
+/**
+ * Add evictions counted before a restart to the total of the table.
+ */
+void src_table_restore_evictions(struct src_table* t, unsigned long long evictions);
+
+#endif
@@ -0,0 +1,193 @@
+#include "stats.h"
+/* Includes are in header file */
+
+extern long long get_time(void);
+
+/* The live and the spare epoch */
+static struct stats buffers[2];
+/* Buffer workers currently update */
+static struct stats* _Atomic live;
+
+static pthread_t reporter;
+static int reporter_started = 0;
+static int reporter_stop = 0;
+static int reporter_seconds;
+static stats_report_fn reporter_fn;
+/* Resources mutexed: reporter_stop */
+static pthread_mutex_t reporter_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled to stop the reporter before its next deadline */
+static pthread_cond_t reporter_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Zero all counters of a buffer and start a new epoch in it. The buffer
+ * must not be in use by any worker.
+ */
+static void stats_reset(struct stats* st)
+{
+	st->total_syn_packets = 0;
+	st->total_arp_packets = 0;
+	st->total_blacklist_viol = 0;
+	st->total_dns_viol = 0;
+	st->est_blacklist_viol = 0;
+	st->est_dns_viol = 0;
+	atomic_store(&st->payload_inspected, 0);
+	atomic_store(&st->payload_skipped, 0);
+	atomic_store(&st->vertical_scans, 0);
+	atomic_store(&st->horizontal_scans, 0);
+	atomic_store(&st->udp_flood_packets, 0);
+	atomic_store(&st->icmp_flood_packets, 0);
+	atomic_store(&st->udp_floods, 0);
+	atomic_store(&st->icmp_floods, 0);
+	atomic_store(&st->allowed_syn_packets, 0);
+	atomic_store(&st->non_ethernet_frames, 0);
+	st->first_syn_time = 0;
+	st->last_syn_time = 0;
+	int i;
+	for (i = 0; i < HLL_REGISTERS; ++i)
+	{
+		atomic_init(&st->syn_sources_hll[i], 0);
+	}
+	st->epoch_start = get_time();
+	st->epoch_end = 0;
+}
+
+void stats_init(void)
+{
+	int i;
+	for (i = 0; i < 2; ++i)
+	{
+		struct stats* st = buffers + i;
+		pthread_mutex_init(&st->syn_mutex, NULL);
+		pthread_mutex_init(&st->arp_mutex, NULL);
+		pthread_mutex_init(&st->blacklist_mutex, NULL);
+		atomic_init(&st->writers, 0);
+		atomic_init(&st->payload_inspected, 0);
+		atomic_init(&st->payload_skipped, 0);
+		atomic_init(&st->vertical_scans, 0);
+		atomic_init(&st->horizontal_scans, 0);
+		atomic_init(&st->udp_flood_packets, 0);
+		atomic_init(&st->icmp_flood_packets, 0);
+		atomic_init(&st->udp_floods, 0);
+		atomic_init(&st->icmp_floods, 0);
+		atomic_init(&st->allowed_syn_packets, 0);
+		atomic_init(&st->non_ethernet_frames, 0);
+		stats_reset(st);
+	}
+	atomic_init(&live, buffers);
+}
+
+void stats_destroy(void)
+{
+	int i;
+	for (i = 0; i < 2; ++i)
+	{
+		struct stats* st = buffers + i;
+		pthread_mutex_destroy(&st->syn_mutex);
+		pthread_mutex_destroy(&st->arp_mutex);
+		pthread_mutex_destroy(&st->blacklist_mutex);
+	}
+}
+
+struct stats* stats_acquire(void)
+{
+	for (;;)
+	{
+		struct stats* st = atomic_load(&live);
+		atomic_fetch_add(&st->writers, 1);
+		if (st == atomic_load(&live))
+		{
+			return st;
+		}
+		/* Swapped between the load and the increment, the reporter
+		 * may already be reading st, retry with the new buffer */
+		atomic_fetch_sub(&st->writers, 1);
+	}
+}
+
+void stats_release(struct stats* st)
+{
+	atomic_fetch_sub(&st->writers, 1);
+}
+
+struct stats* stats_live(void)
+{
+	return atomic_load(&live);
+}
+
+/**
+ * End the current epoch: make the spare buffer live and wait for the
+ * workers still holding the old one to release it. Only the reporter
+ * waits, workers that acquire after the swap get the new buffer.
+ * @return
+ *		The finished epoch, no longer referenced by any worker
+ */
+static struct stats* stats_swap(void)
+{
+	struct stats* old = atomic_load(&live);
+	struct stats* fresh = old == buffers ? buffers + 1 : buffers;
+	fresh->epoch_start = get_time();
+	atomic_store(&live, fresh);
+	old->epoch_end = fresh->epoch_start;
+	while (atomic_load(&old->writers) > 0)
+	{
+		sched_yield();
+	}
+	return old;
+}
+
+/* Loop executed by the reporter thread */
+static void* reporter_loop(void* arg)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	pthread_mutex_lock(&reporter_mutex);
+	while (!reporter_stop)
+	{
+		/* Deadlines are absolute so reporting time does not drift */
+		deadline.tv_sec += reporter_seconds;
+		while (!reporter_stop
+		    && pthread_cond_timedwait(&reporter_cond, &reporter_mutex, &deadline) != ETIMEDOUT)
+		{
+			/* spurious wake up or stop request */
+		}
+		if (reporter_stop)
+		{
+			break;
+		}
+		pthread_mutex_unlock(&reporter_mutex);
+
+		struct stats* done = stats_swap();
+		reporter_fn(done);
+		stats_reset(done);
+
+		pthread_mutex_lock(&reporter_mutex);
+	}
+	pthread_mutex_unlock(&reporter_mutex);
+	return NULL;
+}
+
+void stats_start_reporter(int seconds, stats_report_fn report)
+{
+	reporter_seconds = seconds;
+	reporter_fn = report;
+	if (pthread_create(&reporter, NULL, &reporter_loop, NULL) != 0)
+	{
+		fprintf(stderr, "%s\n", "[ERROR] Failed to start epoch reporter thread");
+		exit(1);
+	}
+	reporter_started = 1;
+}
+
+void stats_stop_reporter(void)
+{
+	if (!reporter_started)
+	{
+		return;
+	}
+	pthread_mutex_lock(&reporter_mutex);
+	reporter_stop = 1;
+	pthread_cond_signal(&reporter_cond);
+	pthread_mutex_unlock(&reporter_mutex);
+	pthread_join(reporter, NULL);
+	reporter_started = 0;
+}
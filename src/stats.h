@@ -0,0 +1,122 @@
+#ifndef CS241_STATS_H
+#define CS241_STATS_H
+
+#include <stdlib.h> /* exit */
+#include <stdio.h> /* fprintf */
+#include <pthread.h> /* pthread_mutex_t, pthread_cond_t */
+#include <stdatomic.h> /* atomic_int */
+#include <sched.h> /* sched_yield */
+#include <errno.h> /* ETIMEDOUT */
+#include <time.h> /* clock_gettime */
+#include "hll.h"
+
+/**
+ * Detector statistics of one reporting epoch. SYN sources are tracked
+ * across epochs in a struct src_table instead. Two of these exist, the
+ * live one that workers update and a spare one. At the end of an epoch
+ * they are swapped so the finished epoch can be reported and reset while
+ * workers carry on with the fresh buffer.
+ */
+struct stats
+{
+	/* Count of TCP SYN packets received */
+	int total_syn_packets;
+	/* Count of ARP packets received */
+	int total_arp_packets;
+	/* Count of packets to blacklisted URLs */
+	int total_blacklist_viol;
+	/* Count of DNS queries for blacklisted domains */
+	int total_dns_viol;
+	/* Violations counted with the weight of the sampling rate in force
+	 * (sampling.h), estimates of what inspecting everything would find */
+	unsigned long est_blacklist_viol, est_dns_viol;
+	/* Packets whose payload was inspected and skipped by sampling */
+	atomic_ulong payload_inspected, payload_skipped;
+	/* Sources found scanning many ports, many hosts */
+	atomic_ulong vertical_scans, horizontal_scans;
+	/* UDP and ICMP packets over the rate of their destination, and
+	 * destinations that went over it for the first time */
+	atomic_ulong udp_flood_packets, icmp_flood_packets;
+	atomic_ulong udp_floods, icmp_floods;
+	/* SYN packets from allowlisted networks, left out of the counts
+	 * above and of the source table */
+	atomic_ulong allowed_syn_packets;
+	/* Frames that are not Ethernet II (802.3 with LLC, such as STP
+	 * BPDUs), skipped by the detectors */
+	atomic_ulong non_ethernet_frames;
+	long long first_syn_time, last_syn_time;
+	/* Distinct SYN sources of the whole epoch, unlike the source table
+	 * which only holds the window and evicts under pressure */
+	atomic_uchar syn_sources_hll[HLL_REGISTERS];
+	/* Time the epoch started and ended (micro seconds), the end is 0
+	 * while the epoch is still live */
+	long long epoch_start, epoch_end;
+
+	pthread_mutex_t
+		/* Resources mutexed
+		 * total_syn_packets,
+		 * last_syn_time, first_syn_time */
+		syn_mutex,
+		/* Resources mutexed: total_arp_packets */
+		arp_mutex,
+		/* Resources mutexed: total_blacklist_viol, total_dns_viol,
+		 * est_blacklist_viol, est_dns_viol */
+		blacklist_mutex;
+
+	/* Number of workers currently holding this buffer (stats_acquire) */
+	atomic_int writers;
+};
+
+/* Called with a finished epoch, see stats_start_reporter */
+typedef void (*stats_report_fn)(struct stats*);
+
+/**
+ * Initialise both statistics buffers. Must be called before any other
+ * stats_ function.
+ */
+void stats_init(void);
+
+/**
+ * Free all resources of both statistics buffers.
+ */
+void stats_destroy(void);
+
+/**
+ * Get the live statistics buffer for updating. Never blocks, even while
+ * an epoch is being swapped. Every call must be paired with a call to
+ * stats_release once the caller is done with the buffer.
+ * @return
+ *		The live buffer
+ */
+struct stats* stats_acquire(void);
+
+/**
+ * Release a buffer obtained with stats_acquire.
+ * @arg st
+ *		The buffer returned by stats_acquire
+ */
+void stats_release(struct stats* st);
+
+/**
+ * Peek at the live buffer without taking part in the swap protocol,
+ * for reporting the current (unfinished) epoch.
+ */
+struct stats* stats_live(void);
+
+/**
+ * Start a thread that every given number of seconds swaps the live
+ * buffer with the spare, calls report on the finished epoch and then
+ * resets it to become the next spare.
+ * @arg seconds
+ *		Length of an epoch, must be > 0
+ * @arg report
+ *		Called from the reporter thread with each finished epoch
+ */
+void stats_start_reporter(int seconds, stats_report_fn report);
+
+/**
+ * Stop the reporter thread, if started, and wait for it to finish.
+ */
+void stats_stop_reporter(void);
+
+#endif
@@ -0,0 +1,296 @@
+#include "summary.h"
+/* Includes are in header file */
+
+/* Heaviest first, then by address so that merging is deterministic */
+static int by_syns(const void* a, const void* b)
+{
+	const struct summary_source* x = a;
+	const struct summary_source* y = b;
+	if (x->syns != y->syns)
+	{
+		return x->syns < y->syns ? 1 : -1;
+	}
+	return memcmp(x->ip, y->ip, sizeof(x->ip));
+}
+
+/* Prefix of an IPv4 mapped address */
+static const unsigned char v4_mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+/**
+ * Add a source to the heaviest ones, kept sorted, if it is heavy enough.
+ */
+static void top_add(struct summary* s, const unsigned char* ip, uint64_t syns)
+{
+	if (s->ntop == SUMMARY_TOP_K && syns <= s->top[SUMMARY_TOP_K - 1].syns)
+	{
+		return;
+	}
+	int j = s->ntop < SUMMARY_TOP_K ? s->ntop++ : SUMMARY_TOP_K - 1;
+	while (j > 0 && s->top[j - 1].syns < syns)
+	{
+		s->top[j] = s->top[j - 1];
+		--j;
+	}
+	memcpy(s->top[j].ip, ip, sizeof(s->top[j].ip));
+	s->top[j].syns = syns;
+}
+
+void summary_collect(struct summary* s, struct stats* st, struct src_table* sources, long long now)
+{
+	memset(s, 0, sizeof(*s));
+	memcpy(s->magic, SUMMARY_MAGIC, sizeof(s->magic));
+	s->version = SUMMARY_VERSION;
+	s->byte_order = SUMMARY_BYTE_ORDER;
+	s->sensors = 1;
+	s->epoch_start = st->epoch_start;
+	s->epoch_end = st->epoch_end ? st->epoch_end : now;
+
+	pthread_mutex_lock(&st->syn_mutex);
+	s->syn_packets = st->total_syn_packets;
+	s->first_syn_time = st->first_syn_time;
+	s->last_syn_time = st->last_syn_time;
+	pthread_mutex_unlock(&st->syn_mutex);
+	pthread_mutex_lock(&st->arp_mutex);
+	s->arp_packets = st->total_arp_packets;
+	pthread_mutex_unlock(&st->arp_mutex);
+	pthread_mutex_lock(&st->blacklist_mutex);
+	s->blacklist_viol = st->total_blacklist_viol;
+	s->dns_viol = st->total_dns_viol;
+	s->est_blacklist_viol = st->est_blacklist_viol;
+	s->est_dns_viol = st->est_dns_viol;
+	pthread_mutex_unlock(&st->blacklist_mutex);
+	int i;
+	for (i = 0; i < HLL_REGISTERS; ++i)
+	{
+		s->syn_sources_hll[i] = atomic_load_explicit(&st->syn_sources_hll[i], memory_order_relaxed);
+	}
+
+	/* Heaviest sources still in the window, of both families */
+	int capacity = sources->nbuckets * SRC_WAYS;
+	struct src_entry* entries = malloc(capacity * sizeof(struct src_entry));
+	struct src6_entry* entries6 = malloc(capacity * sizeof(struct src6_entry));
+	if (!entries || !entries6)
+	{
+		fprintf(stderr, "%s\n", "[WARNING] Summary without top sources (memory allocation error)");
+		free(entries);
+		free(entries6);
+		return;
+	}
+	int n = src_table_export(sources, entries, capacity);
+	int in_window = 0;
+	for (i = 0; i < n; ++i)
+	{
+		if (s->epoch_end - entries[i].last_seen > sources->window)
+		{
+			continue;
+		}
+		++in_window;
+		unsigned char ip[16];
+		uint32_t be = htonl(entries[i].ip);
+		memcpy(ip, v4_mapped, sizeof(v4_mapped));
+		memcpy(ip + sizeof(v4_mapped), &be, sizeof(be));
+		top_add(s, ip, entries[i].syns);
+	}
+	n = src_table_export6(sources, entries6, capacity);
+	for (i = 0; i < n; ++i)
+	{
+		if (s->epoch_end - entries6[i].last_seen > sources->window)
+		{
+			continue;
+		}
+		++in_window;
+		top_add(s, entries6[i].ip.b, entries6[i].syns);
+	}
+	free(entries);
+	free(entries6);
+	if (in_window > SUMMARY_TOP_K)
+	{
+		s->top_error = s->top[SUMMARY_TOP_K - 1].syns;
+	}
+}
+
+int summary_write(const char* path, const struct summary* s)
+{
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE* f = fopen(tmp, "wb");
+	int ok = f != NULL;
+	ok = ok && fwrite(s, sizeof(*s), 1, f) == 1;
+	if (f && fclose(f) != 0)
+	{
+		ok = 0;
+	}
+	if (!ok || rename(tmp, path) != 0)
+	{
+		fprintf(stderr, "[WARNING] Failed to write summary %s: %s\n", path, strerror(errno));
+		remove(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+int summary_read(const char* path, struct summary* s)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f)
+	{
+		fprintf(stderr, "[WARNING] Cannot open summary %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	/* Exactly one struct, a byte more means another layout */
+	char extra;
+	int whole = fread(s, sizeof(*s), 1, f) == 1 && fread(&extra, 1, 1, f) == 0;
+	fclose(f);
+	const char* problem = NULL;
+	if (!whole)
+	{
+		problem = "has the wrong size";
+	}
+	else if (memcmp(s->magic, SUMMARY_MAGIC, sizeof(s->magic)) != 0)
+	{
+		problem = "is not a summary";
+	}
+	else if (s->version != SUMMARY_VERSION || s->byte_order != SUMMARY_BYTE_ORDER)
+	{
+		problem = "was written by another version or host";
+	}
+	else if (s->ntop > SUMMARY_TOP_K)
+	{
+		problem = "is corrupt";
+	}
+	if (problem)
+	{
+		fprintf(stderr, "[WARNING] Summary %s %s\n", path, problem);
+		return -1;
+	}
+	return 0;
+}
+
+/* Smaller of two times where 0 means none */
+static int64_t earliest(int64_t a, int64_t b)
+{
+	return !a || (b && b < a) ? b : a;
+}
+
+void summary_merge(struct summary* into, const struct summary* s)
+{
+	if (!into->sensors)
+	{
+		memcpy(into->magic, SUMMARY_MAGIC, sizeof(into->magic));
+		into->version = SUMMARY_VERSION;
+		into->byte_order = SUMMARY_BYTE_ORDER;
+	}
+	into->sensors += s->sensors;
+	into->epoch_start = earliest(into->epoch_start, s->epoch_start);
+	into->epoch_end = s->epoch_end > into->epoch_end ? s->epoch_end : into->epoch_end;
+	into->syn_packets += s->syn_packets;
+	into->arp_packets += s->arp_packets;
+	into->blacklist_viol += s->blacklist_viol;
+	into->dns_viol += s->dns_viol;
+	into->est_blacklist_viol += s->est_blacklist_viol;
+	into->est_dns_viol += s->est_dns_viol;
+	into->first_syn_time = earliest(into->first_syn_time, s->first_syn_time);
+	into->last_syn_time = s->last_syn_time > into->last_syn_time ? s->last_syn_time : into->last_syn_time;
+	hll_merge(into->syn_sources_hll, s->syn_sources_hll);
+
+	/* A source listed by only one side may have sent up to the other
+	 * side's error there too */
+	struct summary_source all[2 * SUMMARY_TOP_K];
+	uint32_t n = into->ntop;
+	memcpy(all, into->top, n * sizeof(all[0]));
+	uint32_t i, j;
+	for (i = 0; i < s->ntop; ++i)
+	{
+		j = 0;
+		while (j < n && memcmp(all[j].ip, s->top[i].ip, sizeof(all[j].ip)) != 0)
+		{
+			++j;
+		}
+		if (j == n)
+		{
+			memcpy(all[n].ip, s->top[i].ip, sizeof(all[n].ip));
+			all[n++].syns = 0;
+		}
+		all[j].syns += s->top[i].syns;
+	}
+	qsort(all, n, sizeof(all[0]), by_syns);
+	into->top_error += s->top_error;
+	if (n > SUMMARY_TOP_K)
+	{
+		/* Dropped sources may be that much heavier than the cut off */
+		into->top_error += all[SUMMARY_TOP_K].syns;
+		n = SUMMARY_TOP_K;
+	}
+	memcpy(into->top, all, n * sizeof(all[0]));
+	into->ntop = n;
+}
+
+/* An IPv4 mapped address is printed as IPv4 */
+static void print_ip(const unsigned char* ip)
+{
+	char s[INET6_ADDRSTRLEN];
+	if (memcmp(ip, v4_mapped, sizeof(v4_mapped)) == 0)
+	{
+		printf("%s", inet_ntop(AF_INET, ip + sizeof(v4_mapped), s, sizeof(s)));
+	}
+	else
+	{
+		printf("%s", inet_ntop(AF_INET6, ip, s, sizeof(s)));
+	}
+}
+
+void summary_report(const struct summary* s)
+{
+	printf("Combined Intrusion Detection Report of %u sensors:\n", s->sensors);
+	printf("Epoch length: %6f seconds\n", ((double) (s->epoch_end - s->epoch_start)) / ((double) 1000000));
+
+	printf("SYN flood attack possible: ");
+	if (s->syn_packets)
+	{
+		/* Sensor clocks are assumed to be in sync */
+		double syn_time_s = ((double) (s->last_syn_time - s->first_syn_time)) / ((double) 1000000);
+		double distinct = hll_estimate(s->syn_sources_hll);
+		double syn_unique_ratio = distinct / s->syn_packets;
+		if (syn_unique_ratio > 1)
+		{
+			/* Estimation error on an all unique flood */
+			syn_unique_ratio = 1;
+		}
+		double syn_rate = ((double) s->syn_packets) / syn_time_s;
+		int is_syn_flooding_possible = (syn_unique_ratio >= 0.9f) || (syn_rate > 100.0f);
+		puts(is_syn_flooding_possible?"TRUE":"FALSE");
+		printf("\t%lld SYN packets detected in %6f seconds\n", (long long) s->syn_packets, syn_time_s);
+		printf("\tAbout %.0f distinct source IP addresses\n", distinct);
+		printf("\tSYN unique ratio: %f\n", syn_unique_ratio);
+		printf("\tSYN rate: %f SYN packets/sec\n", syn_rate);
+		if (s->ntop)
+		{
+			printf("\tHeaviest sources in the window (counts may be low by up to %llu):\n",
+			    (unsigned long long) s->top_error);
+		}
+		uint32_t i;
+		for (i = 0; i < s->ntop; ++i)
+		{
+			printf("\t\t");
+			print_ip(s->top[i].ip);
+			printf(" %llu SYN packets\n", (unsigned long long) s->top[i].syns);
+		}
+	}
+	else
+	{
+		puts("FALSE\n\tNo SYN packets received");
+	}
+
+	printf("ARP cache poisoning possible: %s\n", s->arp_packets?"TRUE":"FALSE");
+	printf("\t%lld ARP packets received\n", (long long) s->arp_packets);
+	printf("URL Blacklist violations: %lld\n", (long long) s->blacklist_viol);
+	if (s->est_blacklist_viol != s->blacklist_viol)
+	{
+		printf("\tEstimated without sampling: %lld\n", (long long) s->est_blacklist_viol);
+	}
+	printf("DNS Blacklist violations: %lld\n", (long long) s->dns_viol);
+	if (s->est_dns_viol != s->dns_viol)
+	{
+		printf("\tEstimated without sampling: %lld\n", (long long) s->est_dns_viol);
+	}
+}
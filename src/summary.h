@@ -0,0 +1,107 @@
+#ifndef CS241_SUMMARY_H
+#define CS241_SUMMARY_H
+
+#include <stdio.h> /* fopen, fwrite, rename */
+#include <stdlib.h> /* malloc, qsort */
+#include <string.h> /* memcmp, memset */
+#include <stdint.h> /* uint32_t, int64_t */
+#include <errno.h> /* errno */
+#include <arpa/inet.h> /* inet_ntop */
+#include "hll.h"
+#include "stats.h"
+#include "src_table.h"
+
+/*
+ * Summary file, the state of one sensor's epoch in a form that sensors
+ * can be merged from: counters add, SYN time bounds widen, the sketch
+ * of distinct sources takes the register-wise maximum and the heaviest
+ * sources add up by address. A merged summary has the same format, so
+ * merging can be done in stages. All integers in host byte order, one
+ * fixed size struct summary per file.
+ */
+#define SUMMARY_MAGIC "IDSSUMM"
+/* Bump whenever the layout changes, older files are then refused */
+#define SUMMARY_VERSION 2
+/* Written as is, reads back differently on a host of other endianness */
+#define SUMMARY_BYTE_ORDER 0x01020304u
+/* Heaviest SYN sources kept */
+#define SUMMARY_TOP_K 32
+
+struct summary_source
+{
+	/* IPv6, or IPv4 mapped (::ffff:a.b.c.d), in network byte order */
+	unsigned char ip[16];
+	uint64_t syns;
+};
+
+struct summary
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t sensors; /* Sensor summaries merged into this one */
+	uint32_t ntop;
+	/* Earliest start and latest end of the merged epochs */
+	int64_t epoch_start, epoch_end;
+	int64_t syn_packets;
+	int64_t arp_packets;
+	int64_t blacklist_viol, dns_viol;
+	/* Estimates under overload sampling, equal to the above without */
+	int64_t est_blacklist_viol, est_dns_viol;
+	/* Of the SYN packets, 0 if there were none */
+	int64_t first_syn_time, last_syn_time;
+	/* SYN counts of the sources in top[] are low by at most this much,
+	 * and a source missing from it sent no more than this */
+	uint64_t top_error;
+	/* Heaviest sources in the SYN windows, ntop of them by count */
+	struct summary_source top[SUMMARY_TOP_K];
+	uint8_t syn_sources_hll[HLL_REGISTERS];
+};
+
+/**
+ * Summarise an epoch of this sensor.
+ * @arg s
+ *		Filled with the summary
+ * @arg st
+ *		The epoch, finished or live
+ * @arg sources
+ *		SYN source table the heaviest sources are taken from
+ * @arg now
+ *		Current time (micro seconds), end of a live epoch
+ */
+void summary_collect(struct summary* s, struct stats* st, struct src_table* sources, long long now);
+
+/**
+ * Write a summary. The file is written next to path and renamed over
+ * it, so path always holds a complete summary.
+ * @return
+ *		0 on success
+ *		-1 on failure, with a message printed
+ */
+int summary_write(const char* path, const struct summary* s);
+
+/**
+ * Read a summary written by summary_write.
+ * @return
+ *		0 on success
+ *		-1 if the file is missing, truncated or of another version, with a
+ *		message printed
+ */
+int summary_read(const char* path, struct summary* s);
+
+/**
+ * Merge a summary into another.
+ * @arg into
+ *		Merged into, a zeroed struct is an empty summary
+ * @arg s
+ *		The summary to add
+ */
+void summary_merge(struct summary* into, const struct summary* s);
+
+/**
+ * Print a report of a (merged) summary in the style of the sensor's
+ * own report.
+ */
+void summary_report(const struct summary* s);
+
+#endif
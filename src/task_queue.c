@@ -1,40 +1,142 @@
 #include "task_queue.h"
 
-void enqueue(struct queue* q, const unsigned char* data, size_t n, int verbose)
+struct queueitem* queueitem_new(int owner, size_t cap)
 {
-	struct queueitem* newitem = malloc(sizeof(struct queueitem));
-	newitem->data = malloc(n);
-	if (!newitem || !newitem->data)
+	struct queueitem* item = mem_alloc(MEM_QUEUE, sizeof(struct queueitem) + cap, 0);
+	item->data = (unsigned char*) (item + 1);
+	item->cap = cap;
+	item->owner = owner;
+	return item;
+}
+
+struct queueitem* queueitem_try_new(int owner, size_t cap)
+{
+	struct queueitem* item = mem_try_alloc(MEM_QUEUE, sizeof(struct queueitem) + cap);
+	if (item)
+	{
+		item->data = (unsigned char*) (item + 1);
+		item->cap = cap;
+		item->owner = owner;
+	}
+	return item;
+}
+
+void queueitem_free(struct queueitem* item)
+{
+	mem_free(MEM_QUEUE, item, sizeof(struct queueitem) + item->cap);
+}
+
+void queue_init(struct queue* q, int owner, int nitems)
+{
+	q->slots = QUEUE_INITIAL_SLOTS;
+	q->ring = mem_alloc(MEM_QUEUE, q->slots * sizeof(struct queueitem*), 1);
+	q->head = 0;
+	q->tail = 0;
+	q->free = NULL;
+	q->owner = owner;
+	int i;
+	for (i = 0; i < nitems; ++i)
 	{
-		fprintf(stderr, "%s\n", "FAILED TO ALLOCATE NEW TASK QUEUE ITEM");
-		exit(1);
+		struct queueitem* item = queueitem_new(owner, QUEUE_ITEM_CAP);
+		memset(item->data, 0, QUEUE_ITEM_CAP);
+		item->next = q->free;
+		q->free = item;
 	}
-	newitem->verbose = verbose;
-	newitem->next = NULL;
-	memcpy(newitem->data, data, n);
+}
 
-	if (q->head) /* Not empty */
+void queue_destroy(struct queue* q)
+{
+	struct queueitem* item;
+	while ((item = dequeue(q)))
 	{
-		struct queueitem* current = q->head;
-		while (current->next)
-		{
-			current = current->next;
-		}
-		current->next = newitem;
+		queueitem_free(item);
 	}
-	else /* was empty */
+	while (q->free)
 	{
-		q->head = newitem;
+		item = q->free;
+		q->free = item->next;
+		queueitem_free(item);
 	}
+	mem_free(MEM_QUEUE, q->ring, q->slots * sizeof(struct queueitem*));
+	q->ring = NULL;
+}
+
+unsigned int queue_size(struct queue* q)
+{
+	return q->tail - q->head;
+}
+
+struct queueitem* queue_item_get(struct queue* q, size_t n)
+{
+	if (q->free && n <= QUEUE_ITEM_CAP)
+	{
+		struct queueitem* item = q->free;
+		q->free = item->next;
+		return item;
+	}
+	return queueitem_try_new(q->owner, n > QUEUE_ITEM_CAP ? n : QUEUE_ITEM_CAP);
+}
+
+/* Double the ring, keeping items in order */
+static void queue_grow(struct queue* q)
+{
+	unsigned int n = queue_size(q);
+	/* Always granted, the items it holds are what the budget limits */
+	struct queueitem** ring = mem_alloc(MEM_QUEUE, 2 * q->slots * sizeof(struct queueitem*), 0);
+	unsigned int i;
+	for (i = 0; i < n; ++i)
+	{
+		ring[i] = q->ring[(q->head + i) & (q->slots - 1)];
+	}
+	mem_free(MEM_QUEUE, q->ring, q->slots * sizeof(struct queueitem*));
+	q->ring = ring;
+	q->slots *= 2;
+	q->head = 0;
+	q->tail = n;
+}
+
+void enqueue(struct queue* q, struct queueitem* item)
+{
+	if (queue_size(q) == q->slots)
+	{
+		queue_grow(q);
+	}
+	q->ring[q->tail++ & (q->slots - 1)] = item;
 }
 
 struct queueitem* dequeue(struct queue* q)
 {
-	if (!q->head)
+	if (q->head == q->tail)
 	{
 		return NULL;
 	}
-	struct queueitem* t = q->head;
-	q->head = q->head->next;
-	return t;
+	return q->ring[q->head++ & (q->slots - 1)];
+}
+
+int queue_steal(struct queue* q, struct queueitem** items, int max)
+{
+	int n = (queue_size(q) + 1) / 2;
+	if (n > max)
+	{
+		n = max;
+	}
+	int i;
+	/* Stored oldest first, like dequeue would return them */
+	for (i = n - 1; i >= 0; --i)
+	{
+		items[i] = q->ring[--q->tail & (q->slots - 1)];
+	}
+	return n;
+}
+
+void queue_recycle(struct queue* q, struct queueitem* item)
+{
+	if (item->cap != QUEUE_ITEM_CAP)
+	{
+		/* Oversized, not worth keeping around */
+		queueitem_free(item);
+		return;
+	}
+	item->next = q->free;
+	q->free = item;
 }
\ No newline at end of file
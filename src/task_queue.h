@@ -4,25 +4,76 @@
 #include <stdio.h> /* fprintf */
 #include <stdlib.h> /* malloc */
 #include <string.h> /* memcpy */
+#include <stdatomic.h> /* atomic_int */
+#include <sys/time.h> /* struct timeval */
+#include "mem.h" /* mem_alloc */
 
-/* Linked list implementation of queue */
+/* Items preallocated per queue, and the data capacity of each. Frames
+ * larger than QUEUE_ITEM_CAP get an item of their own that is freed
+ * rather than recycled. */
+#define QUEUE_POOL_ITEMS 512
+#define QUEUE_ITEM_CAP 2048
+/* Initial number of slots of the ring, grows by doubling */
+#define QUEUE_INITIAL_SLOTS 1024
+
+/* A captured frame waiting to be analysed */
 struct queueitem
 {
-	unsigned char* data;
+	unsigned char* data; /* Points just past the item, same allocation */
+	int len; /* Number of bytes in data */
+	int cap; /* Number of bytes data can hold */
+	int wirelen; /* Length of the frame on the wire */
+	struct timeval ts; /* Capture time */
+	long long queued_at; /* When handed to a worker (micro seconds) */
 	int verbose;
-	struct queueitem *next;
+	int owner; /* Id of the worker whose pool the item belongs to */
+	/* Holders of the item: the queue or worker analysing it, plus the
+	 * pcap writer (pcap_writer.h). It goes back to the pool at 0. */
+	atomic_int refs;
+	struct queueitem *next; /* Link in the free list */
 };
-/* Only need to store pointer to head of linked list. */
+
+/* Double ended queue of items in a ring buffer. The owner takes the
+ * oldest items from the head, thieves take the newest from the tail.
+ * A free list of items is kept for reuse so that filling the queue does
+ * not allocate. Not thread safe, callers provide locking. */
 struct queue
 {
-	struct queueitem* head;
+	struct queueitem** ring;
+	unsigned int slots; /* Size of ring, power of two */
+	unsigned int head; /* Index of the oldest item */
+	unsigned int tail; /* Index one past the newest item */
+	struct queueitem* free;
+	int owner; /* Stamped on the items the pool allocates */
 };
 
-/* Makes of copy of given data of size n and stores it in a queue item.
- * Do not forget to free pointer after using. */
-void enqueue(struct queue* q, const unsigned char* data, size_t n, int verbose);
-/* Pop the oldest item that is in the queue (FIFO) 
- * Do not forget to free data pointer after done */
+/* Allocate an item and its data in one block, outside any pool */
+struct queueitem* queueitem_new(int owner, size_t cap);
+/* Same, but NULL if the memory budget (mem.h) is spent */
+struct queueitem* queueitem_try_new(int owner, size_t cap);
+/* Free an item of either */
+void queueitem_free(struct queueitem* item);
+/* Initialise an empty queue with nitems items ready for reuse. The
+ * memory of the items is written here, so the pages end up local to
+ * the calling thread's NUMA node (first touch). */
+void queue_init(struct queue* q, int owner, int nitems);
+/* Free all items, queued or not */
+void queue_destroy(struct queue* q);
+/* Number of items in the queue */
+unsigned int queue_size(struct queue* q);
+/* Get an item able to hold n bytes from the free list, allocating one
+ * if the free list is empty or n is too large. NULL if that allocation
+ * is refused by the memory budget. */
+struct queueitem* queue_item_get(struct queue* q, size_t n);
+/* Append an item filled by the caller */
+void enqueue(struct queue* q, struct queueitem* item);
+/* Pop the oldest item that is in the queue (FIFO), NULL if empty.
+ * Do not forget to queue_recycle the item after done */
 struct queueitem* dequeue(struct queue* q);
+/* Take up to max of the newest items, but never more than half of the
+ * queue (rounded up). Returns the number of items stored in items. */
+int queue_steal(struct queue* q, struct queueitem** items, int max);
+/* Give back an item to the free list of the queue that owns it */
+void queue_recycle(struct queue* q, struct queueitem* item);
 
 #endif
\ No newline at end of file
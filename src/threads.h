@@ -0,0 +1,14 @@
+#ifndef CS241_THREADS_H
+#define CS241_THREADS_H
+
+/*
+ * Thread limits shared by the dispatcher and the profiler, which cannot
+ * include dispatch.h: it includes the profiler through analysis.h.
+ */
+
+/* Upper bound on worker threads (-t) */
+#define MAX_THREADS 256
+/* Threads started besides the workers that profile themselves: capture */
+#define OTHER_THREADS 1
+
+#endif
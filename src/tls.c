@@ -0,0 +1,89 @@
+#include "tls.h"
+
+/* Big endian 16 bit value at p */
+#define TLS_U16(p) ((int) (((p)[0] << 8) | (p)[1]))
+
+/* Record and handshake types */
+#define TLS_HANDSHAKE 0x16
+#define TLS_CLIENT_HELLO 0x01
+#define TLS_EXT_SERVER_NAME 0x0000
+#define TLS_SNI_HOST_NAME 0x00
+
+int tls_client_hello_sni(const unsigned char* p, int n, const char** name, int* namelen)
+{
+	/* Record header: type(1) version(2) length(2) */
+	if (n < 5 || p[0] != TLS_HANDSHAKE || p[1] != 0x03)
+	{
+		return 0;
+	}
+	int end = 5 + TLS_U16(p + 3);
+	if (end > n)
+	{
+		end = n;
+	}
+
+	/* Handshake header: type(1) length(3) */
+	int i = 5;
+	if (i + 4 > end || p[i] != TLS_CLIENT_HELLO)
+	{
+		return 0;
+	}
+	i += 4;
+	/* client_version(2) random(32) */
+	i += 2 + 32;
+	/* session_id: length(1) */
+	if (i + 1 > end)
+	{
+		return 0;
+	}
+	i += 1 + p[i];
+	/* cipher_suites: length(2) */
+	if (i + 2 > end)
+	{
+		return 0;
+	}
+	i += 2 + TLS_U16(p + i);
+	/* compression_methods: length(1) */
+	if (i + 1 > end)
+	{
+		return 0;
+	}
+	i += 1 + p[i];
+	/* extensions: length(2) */
+	if (i + 2 > end)
+	{
+		return 0;
+	}
+	int ext_end = i + 2 + TLS_U16(p + i);
+	if (ext_end > end)
+	{
+		ext_end = end;
+	}
+	i += 2;
+
+	/* Each extension: type(2) length(2) data */
+	while (i + 4 <= ext_end)
+	{
+		int type = TLS_U16(p + i);
+		int len = TLS_U16(p + i + 2);
+		i += 4;
+		if (type == TLS_EXT_SERVER_NAME)
+		{
+			/* server_name_list length(2), name_type(1), host_name length(2) */
+			if (i + 5 > ext_end || p[i + 2] != TLS_SNI_HOST_NAME)
+			{
+				return 0;
+			}
+			int hlen = TLS_U16(p + i + 3);
+			if (hlen == 0 || i + 5 + hlen > ext_end)
+			{
+				return 0;
+			}
+			*name = (const char*) (p + i + 5);
+			*namelen = hlen;
+			return 1;
+		}
+		i += len;
+	}
+	return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef CS241_TLS_H
+#define CS241_TLS_H
+
+/**
+ * Extracts the Server Name Indication from a TLS ClientHello without
+ * copying or allocating. Only the bytes given are parsed, a ClientHello
+ * continuing in later segments is parsed up to where it is cut.
+ * @arg p
+ *		TCP payload, expected to start with a TLS handshake record
+ * @arg n
+ *		Length of p
+ * @arg name
+ *		Set to the host name inside p (not null terminated) when found
+ * @arg namelen
+ *		Set to the length of the host name when found
+ * @return
+ *		1 if p holds a ClientHello with a host name SNI entry
+ *		0 otherwise.
+ */
+int tls_client_hello_sni(const unsigned char* p, int n, const char** name, int* namelen);
+
+#endif